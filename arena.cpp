@@ -0,0 +1,290 @@
+#include "Angel.h"
+#include "arena.h"
+#include "mesh.h"
+#include "glstate.h"
+#include "stats.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <vector>
+
+extern GLuint vPosition, vColor;
+
+struct ArenaBlock
+{
+    GLuint buffer;
+    GLuint vao;
+    long bytes;
+    std::map<long, long> freeRanges; // Offset to size, never adjacent
+};
+
+// Contents waiting for flushArena(), at srcOffset in the staging data
+struct StagedCopy
+{
+    int block;
+    long dstOffset;
+    long srcOffset;
+    long bytes;
+};
+
+static std::vector<ArenaBlock> blocks;
+static std::vector<unsigned char> staging;
+static std::vector<StagedCopy> stagedCopies;
+
+// Totals since startup, for printArenaStats()
+static long allocatedBytes = 0;
+static long rangesAllocated = 0;
+static long rangesLive = 0;
+static long stagedUploads = 0;
+static long copyCalls = 0;
+static long flushes = 0;
+static long vertexArrays = 0;
+
+static bool isImmutableSupported()
+{
+    return glewIsSupported("GL_VERSION_4_4") || glewIsSupported("GL_ARB_buffer_storage");
+}
+
+static void setUpVertexArray(GLuint buffer)
+{
+    const VertexLayout &layout = getVertexLayout(vertexFormat);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+
+    glEnableVertexAttribArray(vPosition);
+    glVertexAttribPointer(vPosition, 4, layout.positionType, layout.positionNormalized, layout.stride, BUFFER_OFFSET(0));
+
+    glEnableVertexAttribArray(vColor);
+    glVertexAttribPointer(vColor, 4, layout.colorType, layout.colorNormalized, layout.stride, BUFFER_OFFSET(layout.colorOffset));
+}
+
+static int createBlock(long bytes)
+{
+    ArenaBlock block;
+    block.bytes = bytes;
+    block.freeRanges[0] = bytes;
+
+    // Never written by the CPU, only by copies from the staging buffer
+    glGenBuffers(1, &block.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, block.buffer);
+    if (isImmutableSupported())
+        glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, 0);
+    else
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenVertexArrays(1, &block.vao);
+    glBindVertexArray(block.vao);
+    setUpVertexArray(block.buffer);
+    vertexArrays++;
+
+    // The vertex array binding changed behind the state cache
+    resetGLState();
+
+    blocks.push_back(block);
+    return blocks.size() - 1;
+}
+
+// First fit in one block; the padding before an aligned start and the tail
+// after the range stay free
+static bool allocateInBlock(int index, long bytes, long alignment, long &offset)
+{
+    ArenaBlock &block = blocks[index];
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it)
+    {
+        long start = (it->first + alignment - 1) / alignment * alignment;
+        long end = it->first + it->second;
+        if (start + bytes > end)
+            continue;
+
+        long freeStart = it->first;
+        block.freeRanges.erase(it);
+        if (start > freeStart)
+            block.freeRanges[freeStart] = start - freeStart;
+        if (end > start + bytes)
+            block.freeRanges[start + bytes] = end - (start + bytes);
+        offset = start;
+        return true;
+    }
+    return false;
+}
+
+ArenaRange allocateArena(const void *data, long bytes, long alignment)
+{
+    ArenaRange range;
+    if (bytes <= 0)
+        return range;
+
+    long offset = 0;
+    int block = -1;
+    for (size_t i = 0; i < blocks.size() && block < 0; ++i)
+    {
+        if (allocateInBlock(i, bytes, alignment, offset))
+            block = i;
+    }
+    if (block < 0)
+    {
+        long size = (bytes + ArenaBlockBytes - 1) / ArenaBlockBytes * ArenaBlockBytes;
+        block = createBlock(size);
+        allocateInBlock(block, bytes, alignment, offset);
+    }
+
+    range.block = block;
+    range.offset = offset;
+    range.bytes = bytes;
+    allocatedBytes += bytes;
+    rangesAllocated++;
+    rangesLive++;
+
+    // Copies that continue the previous one in both buffers are merged
+    long srcOffset = staging.size();
+    staging.insert(staging.end(), (const unsigned char *)data, (const unsigned char *)data + bytes);
+    stagedUploads++;
+    if (!stagedCopies.empty())
+    {
+        StagedCopy &last = stagedCopies.back();
+        if (last.block == block && last.dstOffset + last.bytes == offset && last.srcOffset + last.bytes == srcOffset)
+        {
+            last.bytes += bytes;
+            return range;
+        }
+    }
+    StagedCopy copy = {block, offset, srcOffset, bytes};
+    stagedCopies.push_back(copy);
+    return range;
+}
+
+void freeArena(ArenaRange &range)
+{
+    if (range.block < 0)
+        return;
+
+    std::map<long, long> &ranges = blocks[range.block].freeRanges;
+    long start = range.offset;
+    long end = range.offset + range.bytes;
+
+    // Merge with the free neighbours on both sides
+    auto next = ranges.lower_bound(start);
+    if (next != ranges.end() && next->first == end)
+    {
+        end += next->second;
+        next = ranges.erase(next);
+    }
+    if (next != ranges.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == start)
+        {
+            start = previous->first;
+            ranges.erase(previous);
+        }
+    }
+    ranges[start] = end - start;
+
+    allocatedBytes -= range.bytes;
+    rangesLive--;
+    range = ArenaRange();
+}
+
+void flushArena()
+{
+    if (stagedCopies.empty())
+        return;
+
+    // One staging buffer for everything pending, deleted right away
+    GLuint stagingBuffer;
+    glGenBuffers(1, &stagingBuffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+    glBufferData(GL_COPY_READ_BUFFER, staging.size(), &staging[0], GL_STREAM_COPY);
+    frameStats.bytesUploaded += staging.size();
+    for (const auto &copy : stagedCopies)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, blocks[copy.block].buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copy.srcOffset, copy.dstOffset, copy.bytes);
+        copyCalls++;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // The GL keeps the contents until the copies are done
+    glDeleteBuffers(1, &stagingBuffer);
+    flushes++;
+
+    staging.clear();
+    staging.shrink_to_fit();
+    stagedCopies.clear();
+}
+
+bool arenaContains(const ArenaRange &range, const void *data, long bytes)
+{
+    if (range.block < 0 || range.bytes != bytes)
+        return false;
+
+    // Still staged: compare with the copy that covers the range
+    for (const auto &copy : stagedCopies)
+    {
+        if (copy.block == range.block && copy.dstOffset <= range.offset &&
+            range.offset + bytes <= copy.dstOffset + copy.bytes)
+            return memcmp(&staging[copy.srcOffset + range.offset - copy.dstOffset], data, bytes) == 0;
+    }
+
+    std::vector<unsigned char> contents(bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, blocks[range.block].buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, range.offset, bytes, &contents[0]);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return memcmp(&contents[0], data, bytes) == 0;
+}
+
+GLuint arenaBuffer(int block)
+{
+    return blocks[block].buffer;
+}
+
+GLuint arenaVertexArray(int block)
+{
+    if (block < 0 || block >= int(blocks.size()))
+    {
+        std::cerr << "No arena block " << block << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return blocks[block].vao;
+}
+
+GLuint createArenaVertexArray(int block)
+{
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    setUpVertexArray(blocks[block].buffer);
+    vertexArrays++;
+    resetGLState();
+    return vao;
+}
+
+void printArenaStats()
+{
+    long totalBytes = 0, freeBytes = 0, largestFree = 0, freeRanges = 0;
+    for (const auto &block : blocks)
+    {
+        totalBytes += block.bytes;
+        for (const auto &range : block.freeRanges)
+        {
+            freeBytes += range.second;
+            largestFree = std::max(largestFree, range.second);
+            freeRanges++;
+        }
+    }
+
+    // Share of the free space outside the largest free range, 0 when it is
+    // all in one piece
+    double fragmentation = freeBytes > 0 ? 1.0 - double(largestFree) / freeBytes : 0.0;
+    printf("Geometry arena: %d blocks, %.1f MB on the GPU, %.1f MB in %ld ranges (%ld allocated), "
+           "%.2f MB padding\n",
+           int(blocks.size()), totalBytes / 1048576.0, allocatedBytes / 1048576.0, rangesLive, rangesAllocated,
+           (totalBytes - freeBytes - allocatedBytes) / 1048576.0);
+    printf("Geometry arena: %ld free ranges, largest %.1f MB, fragmentation %.3f\n",
+           freeRanges, largestFree / 1048576.0, fragmentation);
+    printf("Geometry arena: %ld uploads in %ld copies over %ld flushes, %d buffers and %ld vertex arrays\n",
+           stagedUploads, copyCalls, flushes, int(blocks.size()), vertexArrays);
+}
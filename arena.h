@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "Angel.h"
+
+// Static geometry arena. Vertices and indices of every object live in a
+// few large immutable buffers ("blocks") instead of two buffers and a VAO
+// per object; objects hold offset ranges and draw with a base vertex.
+// Ranges come from a first-fit free list per block that merges neighbours
+// when they are freed. Contents are staged in memory and reach the GPU in
+// flushArena() through one staging buffer and a copy per contiguous run.
+
+const long ArenaBlockBytes = 4 * 1024 * 1024; // Larger ranges get a block of their own
+
+// Offset range in one block; block -1 is an empty range
+struct ArenaRange
+{
+    int block = -1;
+    long offset = 0;
+    long bytes = 0;
+};
+
+// Reserve a range starting at a multiple of alignment and stage its
+// contents. They are on the GPU once flushArena() has run.
+ArenaRange allocateArena(const void *data, long bytes, long alignment);
+
+// Return a range to its block's free list and clear it
+void freeArena(ArenaRange &range);
+
+// Copy all staged contents to their blocks; nothing to do when none are
+// pending. Called at the end of init(), at the start of display() and
+// before geometry uploaded mid-frame is drawn.
+void flushArena();
+
+// Whether a range holds exactly these bytes, compared with the staged copy
+// while it is pending and read back from the block once flushed
+bool arenaContains(const ArenaRange &range, const void *data, long bytes);
+
+GLuint arenaBuffer(int block);
+
+// Vertex array of a block: vPosition and vColor in the selected vertex
+// format from offset 0, and the block as element buffer
+GLuint arenaVertexArray(int block);
+
+// New vertex array with the same setup, for draws that add attributes
+// (the instanced buildings); leaves it bound
+GLuint createArenaVertexArray(int block);
+
+// Blocks, bytes, free ranges and fragmentation, printed at startup
+void printArenaStats();
+
+#endif
@@ -0,0 +1,167 @@
+#version 430
+
+// GPU culling (gpucull.cpp): one invocation per static object. Tests the
+// world box against the frustum and the previous frame's depth pyramid,
+// steps the level of detail as lod.cpp does, and appends a draw command for
+// the chosen level.
+
+layout(local_size_x = 64) in;
+
+// Same layout as CullObject in gpucull.cpp
+struct CullObject
+{
+    vec4 center; // World box center, w = bounding sphere radius
+    vec4 extent; // World box half size
+    ivec4 info;  // x = first draw record, y = levels, z = first threshold, w = thresholds
+};
+
+layout(std430, binding = 2) readonly buffer CullObjects
+{
+    CullObject objects[];
+};
+
+// Screen sizes of the level thresholds of every object (Object::lodSizes)
+layout(std430, binding = 3) readonly buffer LodSizes
+{
+    float lodSizes[];
+};
+
+// Index count, first index, base vertex of every draw record (indirect.cpp)
+layout(std430, binding = 4) readonly buffer RecordMeshes
+{
+    uvec4 recordMeshes[];
+};
+
+// Chosen level of every object, kept between frames for the hysteresis
+layout(std430, binding = 5) buffer Levels
+{
+    int levels[];
+};
+
+// DrawElementsIndirectCommand, five words each
+layout(std430, binding = 6) writeonly buffer Commands
+{
+    uint commands[];
+};
+
+layout(std430, binding = 7) buffer Counters
+{
+    uint drawCount;
+    uint triangleCount;
+};
+
+uniform int uObjectCount;
+uniform bool uFrustumCulling;
+uniform vec4 uFrustum[6];
+uniform vec3 uEye;
+uniform float uLodPixels; // Bias times pixels per unit at distance one, 0 with LOD off
+uniform float uLodHysteresis;
+
+uniform bool uHiZ;
+uniform sampler2D uHiZPyramid;
+uniform mat4 uHiZViewProjection; // Of the frame the pyramid was taken from
+uniform ivec2 uHiZSize;
+uniform int uHiZLevels;
+
+bool isInsideFrustum(vec3 center, vec3 extent)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        vec4 p = uFrustum[i];
+        float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+        float radius = abs(p.x) * extent.x + abs(p.y) * extent.y + abs(p.z) * extent.z;
+        if (distance + radius < 0.0)
+            return false;
+    }
+    return true;
+}
+
+// True if the box was behind the depth of the previous frame
+bool isOccluded(vec3 center, vec3 extent)
+{
+    vec3 lo = vec3(1e9);
+    vec3 hi = vec3(-1e9);
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = center + extent * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = uHiZViewProjection * vec4(corner, 1.0);
+        if (clip.w <= 0.0)
+            return false; // Reaches behind the eye
+        vec3 ndc = clip.xyz / clip.w;
+        lo = min(lo, ndc);
+        hi = max(hi, ndc);
+    }
+
+    // Not on screen last frame, so nothing is known about it
+    if (lo.z < -1.0 || lo.x > 1.0 || lo.y > 1.0 || hi.x < -1.0 || hi.y < -1.0)
+        return false;
+
+    // Pixel rectangle, then the level where it spans at most two texels
+    ivec2 pixelMin = ivec2(clamp(lo.xy * 0.5 + 0.5, 0.0, 1.0) * vec2(uHiZSize));
+    ivec2 pixelMax = ivec2(clamp(hi.xy * 0.5 + 0.5, 0.0, 1.0) * vec2(uHiZSize));
+    ivec2 span = pixelMax - pixelMin;
+    int level = int(ceil(log2(float(max(max(span.x, span.y), 1)))));
+    level = min(level, uHiZLevels - 1);
+
+    // A texel covers the pixels under it; the last one of an odd row also
+    // covers the one left over
+    ivec2 levelSize = max(uHiZSize >> level, ivec2(1));
+    ivec2 a = min(pixelMin >> level, levelSize - 1);
+    ivec2 b = min(pixelMax >> level, levelSize - 1);
+    float farthest = 0.0;
+    for (int y = a.y; y <= b.y; ++y)
+    {
+        for (int x = a.x; x <= b.x; ++x)
+            farthest = max(farthest, texelFetch(uHiZPyramid, ivec2(x, y), level).r);
+    }
+    return lo.z * 0.5 + 0.5 > farthest;
+}
+
+void main()
+{
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= uObjectCount)
+        return;
+
+    CullObject object = objects[index];
+    vec3 center = object.center.xyz;
+    vec3 extent = object.extent.xyz;
+    if (uFrustumCulling && !isInsideFrustum(center, extent))
+        return;
+
+    // Step from the current level towards the one the size calls for
+    int level = levels[index];
+    int thresholds = object.info.w;
+    if (uLodPixels <= 0.0)
+    {
+        level = 0;
+    }
+    else if (thresholds > 0)
+    {
+        float radius = object.center.w;
+        float distance = length(center - uEye);
+        float size = distance <= radius ? 1e9 : 2.0 * radius * uLodPixels / distance;
+        int first = object.info.z;
+        while (level < thresholds && size < lodSizes[first + level] * (1.0 - uLodHysteresis))
+            level++;
+        while (level > 0 && size > lodSizes[first + level - 1] * (1.0 + uLodHysteresis))
+            level--;
+    }
+    levels[index] = level;
+
+    // Past the last level the object is too small to draw
+    if (level >= object.info.y)
+        return;
+    if (uHiZ && isOccluded(center, extent))
+        return;
+
+    uint record = uint(object.info.x + level);
+    uvec4 mesh = recordMeshes[record];
+    uint slot = atomicAdd(drawCount, 1u);
+    atomicAdd(triangleCount, mesh.x / 3u);
+    commands[slot * 5u + 0u] = mesh.x;
+    commands[slot * 5u + 1u] = 1u;
+    commands[slot * 5u + 2u] = mesh.y;
+    commands[slot * 5u + 3u] = mesh.z;
+    commands[slot * 5u + 4u] = record;
+}
@@ -0,0 +1,37 @@
+#version 430
+
+// Hi-Z pyramid (gpucull.cpp): each texel of a level keeps the farthest depth
+// of the texels under it in the level below, level 0 being the depth buffer
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uSource; // Depth copy for level 0, the pyramid above
+uniform int uSourceLevel;
+uniform bool uCopy;        // Level 0: copy the depth as is
+layout(r32f, binding = 0) writeonly uniform image2D uTarget;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uTarget);
+    if (texel.x >= size.x || texel.y >= size.y)
+        return;
+
+    if (uCopy)
+    {
+        imageStore(uTarget, texel, vec4(texelFetch(uSource, texel, 0).r));
+        return;
+    }
+
+    // The last texel of an odd row or column also takes the one left over
+    ivec2 sourceSize = textureSize(uSource, uSourceLevel);
+    ivec2 first = texel * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(texel, size - 1)) * (sourceSize & 1), sourceSize - 1);
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+    {
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, texelFetch(uSource, ivec2(x, y), uSourceLevel).r);
+    }
+    imageStore(uTarget, texel, vec4(farthest));
+}
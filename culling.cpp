@@ -0,0 +1,83 @@
+#include "Angel.h"
+#include "culling.h"
+#include <algorithm>
+
+bool frustumCulling = true;
+bool spatialCulling = true;
+FrustumPlanes worldFrustum;
+
+void extractFrustum(const mat4 &clip, FrustumPlanes &frustum)
+{
+    // Gribb/Hartmann: each plane is the last row plus or minus another row
+    frustum.planes[0] = clip[3] + clip[0]; // Left
+    frustum.planes[1] = clip[3] - clip[0]; // Right
+    frustum.planes[2] = clip[3] + clip[1]; // Bottom
+    frustum.planes[3] = clip[3] - clip[1]; // Top
+    frustum.planes[4] = clip[3] + clip[2]; // Near
+    frustum.planes[5] = clip[3] - clip[2]; // Far
+}
+
+bool isBoxVisible(const FrustumPlanes &frustum, const vec3 &center, const vec3 &extent)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        const vec4 &p = frustum.planes[i];
+        float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+        float radius = std::fabs(p.x) * extent.x + std::fabs(p.y) * extent.y + std::fabs(p.z) * extent.z;
+        if (distance + radius < 0.0f)
+            return false; // Entirely outside this plane
+    }
+    return true;
+}
+
+FrustumTest classifyBox(const FrustumPlanes &frustum, const vec3 &center, const vec3 &extent)
+{
+    FrustumTest result = FRUSTUM_INSIDE;
+    for (int i = 0; i < 6; ++i)
+    {
+        const vec4 &p = frustum.planes[i];
+        float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+        float radius = std::fabs(p.x) * extent.x + std::fabs(p.y) * extent.y + std::fabs(p.z) * extent.z;
+        if (distance + radius < 0.0f)
+            return FRUSTUM_OUTSIDE;
+        if (distance - radius < 0.0f)
+            result = FRUSTUM_INTERSECT; // Straddles this plane
+    }
+    return result;
+}
+
+bool isObjectVisible(const FrustumPlanes &frustum, const Object &obj, const mat4 &matrix)
+{
+    vec3 center = (obj.boundsMin + obj.boundsMax) * 0.5f;
+    vec3 extent = (obj.boundsMax - obj.boundsMin) * 0.5f;
+
+    // Transform the box and take the box that encloses the result (Arvo)
+    vec3 worldCenter;
+    vec3 worldExtent;
+    for (int i = 0; i < 3; ++i)
+    {
+        worldCenter[i] = matrix[i][0] * center.x + matrix[i][1] * center.y + matrix[i][2] * center.z + matrix[i][3];
+        worldExtent[i] = std::fabs(matrix[i][0]) * extent.x + std::fabs(matrix[i][1]) * extent.y + std::fabs(matrix[i][2]) * extent.z;
+    }
+
+    return isBoxVisible(frustum, worldCenter, worldExtent);
+}
+
+void computeBounds(Object &obj)
+{
+    if (obj.points.empty())
+    {
+        obj.boundsMin = obj.boundsMax = vec3(0.0, 0.0, 0.0);
+        return;
+    }
+
+    obj.boundsMin = obj.boundsMax = vec3(obj.points[0].x, obj.points[0].y, obj.points[0].z);
+    for (size_t i = 1; i < obj.points.size(); ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            obj.boundsMin[k] = std::min(obj.boundsMin[k], obj.points[i][k]);
+            obj.boundsMax[k] = std::max(obj.boundsMax[k], obj.points[i][k]);
+        }
+    }
+}
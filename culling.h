@@ -0,0 +1,38 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include "Angel.h"
+#include "objects.h"
+
+// Six clip planes (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside
+struct FrustumPlanes
+{
+    vec4 planes[6];
+};
+
+extern bool frustumCulling; // Toggled with 'c'
+extern bool spatialCulling; // Cull buildings through the spatial index, toggled with 'h'
+extern FrustumPlanes worldFrustum; // World space, from projection * view
+
+// Build the frustum planes of a (row-major) clip matrix
+void extractFrustum(const mat4 &clip, FrustumPlanes &frustum);
+
+// Box given by center and half extents
+bool isBoxVisible(const FrustumPlanes &frustum, const vec3 &center, const vec3 &extent);
+
+// Where a box lies relative to the frustum, for hierarchical culling
+enum FrustumTest
+{
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECT,
+    FRUSTUM_INSIDE
+};
+FrustumTest classifyBox(const FrustumPlanes &frustum, const vec3 &center, const vec3 &extent);
+
+// Tests an object's local bounds after transforming them by matrix
+bool isObjectVisible(const FrustumPlanes &frustum, const Object &obj, const mat4 &matrix);
+
+// Local-space bounding box of an object's vertices
+void computeBounds(Object &obj);
+
+#endif
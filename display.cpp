@@ -3,21 +3,40 @@
 #include "globals.h"
 #include "objects.h"
 #include "input.h"
+#include "stats.h"
+#include "culling.h"
+#include "spatial.h"
+#include "occlusion.h"
+#include "queries.h"
+#include "pvs.h"
+#include "lod.h"
+#include "impostor.h"
+#include "drawlist.h"
+#include "glstate.h"
+#include "overdraw.h"
+#include "transforms.h"
+#include "indirect.h"
+#include "gpucull.h"
+#include "ring.h"
+#include "arena.h"
+#include "props.h"
+#include "scene.h"
+#include "world.h"
 
 // External variables
 extern mat4 model_view;
 extern mat4 projection;
-extern GLuint ModelView, Projection;
 extern GLuint vPosition, vColor;
 
 // Objects from objects.cpp
 extern Object ground;
 extern Object roads;
-extern std::vector<Object> buildings;
+extern Object staticBatch;
+extern Object buildingMesh;
+extern std::vector<BuildingInstance> buildingInstances;
 extern std::vector<TrafficLight> trafficLights;
 extern Object carBody;
 extern Object carWheel;
-extern std::vector<mat4> wheelTransforms;
 
 // Camera parameters from input.cpp
 extern vec4 eye;
@@ -29,94 +48,343 @@ extern vec3 carPosition;
 extern GLfloat carRotation;
 extern GLfloat wheelRotation;
 
+// Per-object mode: buildings that passed frustum culling this frame
+static std::vector<int> visibleBuildings;
+
+static void findVisibleBuildings(std::vector<int> &visible)
+{
+    // Street-level views start from the precomputed set of the car's cell
+    const std::vector<int> *pvs = pvsCulling ? lookupPVS(carPosition, eye) : NULL;
+    if (pvs != NULL)
+    {
+        for (int index : *pvs)
+        {
+            if (frustumCulling)
+            {
+                frameStats.boxTests++;
+                if (!isBuildingVisible(worldFrustum, index))
+                {
+                    frameStats.culledObjects++;
+                    continue;
+                }
+            }
+            visible.push_back(index);
+        }
+        frameStats.culledObjects += buildings.size() - pvs->size();
+        return;
+    }
+
+    if (frustumCulling && spatialCulling)
+    {
+        // Whole blocks are rejected or accepted by the spatial index
+        queryFrustum(cityIndex, worldFrustum, visible);
+        frameStats.culledObjects += buildings.size() - visible.size();
+        return;
+    }
+
+    for (size_t i = 0; i < buildings.size(); ++i)
+    {
+        if (frustumCulling)
+        {
+            frameStats.boxTests++;
+            if (!isBuildingVisible(worldFrustum, i))
+            {
+                frameStats.culledObjects++;
+                continue;
+            }
+        }
+        visible.push_back(i);
+    }
+}
+
+// Per-object and indirect modes cull and draw every building on its own,
+// unless the GPU does it
+static bool drawsBuildingObjects()
+{
+    return staticRenderMode == RENDER_PER_OBJECT || (staticRenderMode == RENDER_INDIRECT && !isGpuCullingActive());
+}
+
+// Occlusion queries draw block by block, so indirect mode goes without them
+static bool usesOcclusionQueries()
+{
+    return staticRenderMode == RENDER_PER_OBJECT && occlusionMode == OCCLUSION_QUERIES;
+}
+
+// Choose the levels of detail of everything drawn this frame in one pass
+static void selectFrameLods()
+{
+    selectLod(carWheel, sceneWorld(wheelNodes[0]));
+
+    if (!isGpuCullingActive() && !isInstancedPropsActive())
+    {
+        for (auto &tl : trafficLights)
+        {
+            for (int k = 0; k < 3; ++k)
+                selectLod(tl.lights[k], tl.lights[k].modelMatrix);
+        }
+    }
+
+    if (drawsBuildingObjects())
+        selectLods(buildings, visibleBuildings);
+}
+
 void display()
 {
+    beginFrameStats();
+    beginRingFrame();
+    flushArena(); // Geometry created since the last frame
+    resetGLState();
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (overdrawMode)
+        beginOverdraw();
 
-    // Set up the view matrix
+    // Set up the view matrix; it reaches the shaders once, in the camera block
     model_view = LookAt(eye, at, up);
+    setCamera(model_view, projection);
+    uploadStaticMatrices();
 
-    // Draw the ground
-    drawObject(ground, model_view);
+    // World-space frustum planes for culling
+    extractFrustum(projection * model_view, worldFrustum);
 
-    // Draw the roads
-    drawObject(roads, model_view);
+    if (staticRenderMode == RENDER_BATCHED)
+    {
+        // Ground, roads and buildings in one draw
+        drawObject(staticBatch);
+    }
+    else if (staticRenderMode == RENDER_INSTANCED)
+    {
+        drawObject(ground);
+        drawObject(roads);
 
-    // Draw buildings
-    for (const auto &building : buildings)
+        // Every building in one instanced draw
+        drawObjectInstanced(buildingMesh, buildingInstances.size());
+    }
+    else if (isGpuCullingActive())
     {
-        drawObject(building, model_view * building.modelMatrix);
+        // Ground, roads, buildings and traffic lights are culled and drawn
+        // by the GPU, without a look at any of them here
+        cullOnGpu(projection, eye);
     }
+    else
+    {
+        // Draw the ground
+        drawObject(ground);
 
-    // Draw traffic lights
-    for (auto &tl : trafficLights)
+        // Draw the roads
+        drawObject(roads);
+
+        // Buildings inside the frustum; with occlusion queries they are
+        // found block by block when drawn
+        visibleBuildings.clear();
+        if (!usesOcclusionQueries())
+            findVisibleBuildings(visibleBuildings);
+
+        // The occluders are rasterized on worker threads while the rest of
+        // the scene is submitted; the buildings are drawn last
+        if (occlusionMode == OCCLUSION_SOFTWARE)
+            beginOcclusion(projection * model_view, eye, visibleBuildings);
+    }
+
+    // The car is the only object that moves; only its nodes are recomputed,
+    // and only when it moved
+    updateCarNodes();
+    updateScene();
+    const mat4 &car_model = sceneWorld(carNode);
+    selectFrameLods();
+
+    // Draw traffic lights, one instanced draw per part or light by light;
+    // with GPU culling they are part of the static scene
+    if (isInstancedPropsActive())
+    {
+        drawProps();
+    }
+    else if (!isGpuCullingActive())
     {
-        mat4 tl_mv = model_view * tl.modelMatrix;
+        for (const auto &tl : trafficLights)
+        {
+            // Draw the base (main pole)
+            drawObject(tl.base);
+
+            // Draw the light box
+            drawObject(tl.lightBox);
 
-        // Draw the base (main pole)
-        drawObject(tl.base, tl_mv);
+            // Draw the connector pole
+            drawObject(tl.connectorPole);
 
-        // Draw the light box
-        drawObject(tl.lightBox, tl_mv);
+            // Draw the lights; the buffers never change, the shader lights the
+            // lamp whose slot matches the current state
+            for (int k = 0; k < 3; ++k)
+                drawLamp(tl.lights[k], k, tl.state);
+        }
+    }
 
-        // Draw the connector pole
-        mat4 connectorPole_mv = tl_mv * tl.connectorPole.modelMatrix;
-        drawObject(tl.connectorPole, connectorPole_mv);
+    // Draw car body
+    drawObject(carBody, car_model);
 
-        // Draw the lights
-        for (int k = 0; k < 3; ++k)
+    // Draw wheels
+    for (SceneNode wheel : wheelNodes)
+        drawObject(carWheel, sceneWorld(wheel));
+
+    if (drawsBuildingObjects() && !usesOcclusionQueries())
+    {
+        if (occlusionMode == OCCLUSION_SOFTWARE)
+            endOcclusion();
+
+        for (int index : visibleBuildings)
         {
-            color4 offColor = color4(0.1, 0.1, 0.1, 1.0); // Dim color for off lights
-            color4 onColor;
-
-            // Determine which light should be on
-            if (tl.state == RED && k == 0)
-                onColor = color4(1.0, 0.0, 0.0, 1.0); // Red
-            else if (tl.state == GREEN && k == 1)
-                onColor = color4(0.0, 1.0, 0.0, 1.0); // Green
-            else if (tl.state == YELLOW && k == 2)
-                onColor = color4(1.0, 1.0, 0.0, 1.0); // Yellow
-            else
-                onColor = offColor;
-
-            // Update the colors of the light
-            for (size_t i = 0; i < tl.lights[k].colors.size(); ++i)
+            if (occlusionMode == OCCLUSION_SOFTWARE && isBuildingOccluded(index))
+                continue;
+
+            // Far buildings are drawn below as impostors
+            if (impostorsEnabled && isImpostorDistance(index, eye))
             {
-                tl.lights[k].colors[i] = onColor;
+                addImpostor(index);
+                continue;
             }
 
-            // Update the color buffer
-            glBindBuffer(GL_ARRAY_BUFFER, tl.lights[k].buffer);
-            glBufferSubData(GL_ARRAY_BUFFER,
-                            tl.lights[k].points.size() * sizeof(point4),
-                            tl.lights[k].colors.size() * sizeof(color4),
-                            &tl.lights[k].colors[0]);
+            drawBuilding(index);
+        }
+    }
+
+    // Everything recorded so far goes out sorted by state, and the static
+    // scene of indirect mode in one multi-draw
+    submitDrawList();
+    submitIndirectDraws();
 
-            // Draw the light
-            drawObject(tl.lights[k], tl_mv);
+    // With occlusion queries the blocks are submitted one at a time, once
+    // the rest of the scene is in the depth buffer
+    if (usesOcclusionQueries())
+        drawBuildingsWithQueries(eye);
+
+    drawImpostors(eye);
+
+    // The depth of this frame is what the GPU culls against in the next
+    updateHiZ(model_view, projection);
+
+    if (overdrawMode)
+        endOverdraw();
+
+    glutSwapBuffers();
+
+    endFrameStats();
+}
+
+// Culling and level of detail shared by the draw functions; NULL when the
+// object is not drawn
+static const Object *visibleMesh(const Object &obj, const mat4 &model, bool cull)
+{
+    // Skip objects entirely outside the view frustum
+    if (cull && frustumCulling)
+    {
+        frameStats.boxTests++;
+        if (!isObjectVisible(worldFrustum, obj, model))
+        {
+            frameStats.culledObjects++;
+            return NULL;
         }
     }
 
-    // Draw the car
-    mat4 car_mv = model_view * Translate(carPosition + Angel::vec3(0.0, 0.5, 0.0)) * RotateY(carRotation + 90.0) * Scale(0.6, 0.6, 0.6);
+    // Too small on screen to be drawn at all
+    if (isLodHidden(obj))
+    {
+        frameStats.culledObjects++;
+        return NULL;
+    }
+    frameStats.visibleObjects++;
 
-    // Draw car body
-    drawObject(carBody, car_mv);
+    // The level of detail chosen for this frame
+    return &lodMesh(obj);
+}
 
-    // Draw wheels
-    for (const auto &transform : wheelTransforms)
+// Record a draw; levels of detail share the matrix of the object they belong to
+static void recordDraw(const Object &obj, const mat4 &model, bool cull, int lampSlot = -1, int lightState = 0)
+{
+    const Object *mesh = visibleMesh(obj, model, cull);
+    if (mesh == NULL)
+        return;
+
+    // A command of the multi-draw; the draw call is counted when it is issued
+    if (staticRenderMode == RENDER_INDIRECT && obj.drawRecord >= 0)
     {
-        mat4 wheel_mv = car_mv * transform * RotateX(90) * RotateY(-wheelRotation);
-        drawObject(carWheel, wheel_mv);
+        addIndirectDraw(obj.drawRecord + obj.lodLevel);
+        frameStats.triangles += mesh->numIndices / 3;
+        return;
     }
 
-    glutSwapBuffers();
+    addDraw(*mesh, model, obj.matrixSlot, 0, lampSlot, lightState);
+    frameStats.drawCalls++;
+    frameStats.triangles += mesh->numIndices / 3;
 }
 
-void drawObject(const Object &obj, const mat4 &mv)
+void drawObject(const Object &obj, bool cull)
 {
-    glUniformMatrix4fv(ModelView, 1, GL_TRUE, mv);
+    recordDraw(obj, obj.modelMatrix, cull);
+}
+
+void drawObject(const Object &obj, const mat4 &model, bool cull)
+{
+    recordDraw(obj, model, cull);
+}
+
+void drawBuilding(int index)
+{
+    frameStats.visibleObjects++;
+    int level = buildings.lodLevels[index];
+    MeshHandle handle = buildings.levelMeshes[index * BuildingLevels + level];
+    const Mesh &mesh = meshes[handle];
+
+    // A command of the multi-draw; the draw call is counted when it is issued
+    if (staticRenderMode == RENDER_INDIRECT && buildings.drawRecords[index] >= 0)
+    {
+        addIndirectDraw(buildings.drawRecords[index] + level);
+        frameStats.triangles += mesh.numIndices / 3;
+        return;
+    }
+
+    addDraw(handle, buildings.centers[index], buildings.extents[index], buildings.modelMatrices[index],
+            buildings.matrixSlots[index]);
+    frameStats.drawCalls++;
+    frameStats.triangles += mesh.numIndices / 3;
+}
+
+void drawLamp(const Object &lamp, int slot, int state)
+{
+    recordDraw(lamp, lamp.modelMatrix, true, slot, state);
+}
+
+void drawObjectInstanced(const Object &obj, int instanceCount, int lampSlot)
+{
+    // Bounds cover all instances, so this only culls the draw as a whole
+    if (frustumCulling)
+    {
+        frameStats.boxTests++;
+        if (!isObjectVisible(worldFrustum, obj, obj.modelMatrix))
+        {
+            frameStats.culledObjects += instanceCount;
+            return;
+        }
+    }
+    frameStats.visibleObjects += instanceCount;
+
+    addDraw(obj, obj.modelMatrix, obj.matrixSlot, instanceCount, lampSlot);
+    frameStats.drawCalls++;
+    frameStats.triangles += long(obj.numIndices / 3) * instanceCount;
+}
+
+// Switch the static render mode, creating per-building objects on first use
+void setStaticRenderMode(StaticRenderMode mode)
+{
+    if (mode == RENDER_INDIRECT && !isIndirectSupported())
+    {
+        std::cerr << "Indirect mode needs OpenGL 4.3, using per-object mode" << std::endl;
+        mode = RENDER_PER_OBJECT;
+    }
+
+    if (mode != RENDER_INSTANCED)
+        createBuildingObjects();
+    if (mode == RENDER_INDIRECT)
+        createIndirectScene();
 
-    glBindVertexArray(obj.vao);
-    glDrawArrays(GL_TRIANGLES, 0, obj.numVertices);
+    staticRenderMode = mode;
 }
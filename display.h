@@ -3,8 +3,23 @@
 
 #include "objects.h" // For the Object struct
 #include "Angel.h"   // For mat4
+#include "globals.h" // For StaticRenderMode
 
 void display();
-void drawObject(const Object &obj, const Angel::mat4 &mv);
+// Static object, drawn with its matrix stored on the GPU; cull = false for
+// objects the caller has already found visible
+void drawObject(const Object &obj, bool cull = true);
+// Moving object, with its world matrix for this frame
+void drawObject(const Object &obj, const Angel::mat4 &model, bool cull = true);
+// Building of the world store (world.h), already found visible, at its
+// chosen level
+void drawBuilding(int index);
+// Traffic light lamp, lit when slot matches the light state
+void drawLamp(const Object &lamp, int slot, int state);
+// Instanced draw culled as a whole by the object's bounds: buildings when
+// obj has no matrix slot, otherwise instance i uses the matrix at slot + i
+// (lamps also take the state of light i, see props.h)
+void drawObjectInstanced(const Object &obj, int instanceCount, int lampSlot = -1);
+void setStaticRenderMode(StaticRenderMode mode);
 
 #endif
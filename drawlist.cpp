@@ -0,0 +1,130 @@
+#include "Angel.h"
+#include "drawlist.h"
+#include "glstate.h"
+#include "registry.h"
+#include "stats.h"
+#include <algorithm>
+#include <vector>
+
+bool drawSorting = true;
+bool frontToBack = true;
+
+extern GLuint program;
+extern GLuint Model, ModelIndex, Instanced, InstancedProps;
+extern mat4 model_view;
+extern GLuint LightState, LampSlot;
+extern GLuint PositionScale, PositionOffset;
+
+static std::vector<DrawItem> drawItems;
+static std::vector<DrawItem> sortScratch;
+
+// Depth buckets cover [0, DepthRange) in view space
+const float DepthRange = 1000.0f;
+
+static uint64_t makeKey(GLuint vao, float depth)
+{
+    uint64_t bucket = uint64_t(std::min(std::max(depth, 0.0f) / DepthRange, 1.0f) * 65535.0f);
+    uint64_t coarse = frontToBack ? bucket >> 8 : 0;
+    return (coarse << 56) |
+           (uint64_t(vao & 0xffffff) << 32) |
+           (bucket << 16);
+}
+
+void addDraw(const Object &mesh, const mat4 &model, int matrixSlot, int instanceCount, int lampSlot, int lightState)
+{
+    // World bounds
+    vec3 center = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+    vec3 extent = (mesh.boundsMax - mesh.boundsMin) * 0.5f;
+    vec3 worldCenter, worldExtent;
+    for (int i = 0; i < 3; ++i)
+    {
+        worldCenter[i] = model[i][0] * center.x + model[i][1] * center.y + model[i][2] * center.z + model[i][3];
+        worldExtent[i] = std::fabs(model[i][0]) * extent.x + std::fabs(model[i][1]) * extent.y + std::fabs(model[i][2]) * extent.z;
+    }
+    addDraw(mesh.mesh, worldCenter, worldExtent, model, matrixSlot, instanceCount, lampSlot, lightState);
+}
+
+void addDraw(MeshHandle mesh, const vec3 &worldCenter, const vec3 &worldExtent, const mat4 &model, int matrixSlot,
+             int instanceCount, int lampSlot, int lightState)
+{
+    // Distance along the view direction of the far side of the bounds
+    float depth = -model_view[2][3];
+    for (int i = 0; i < 3; ++i)
+        depth += -model_view[2][i] * worldCenter[i] + std::fabs(model_view[2][i]) * worldExtent[i];
+
+    DrawItem item;
+    item.key = makeKey(meshes[mesh].vao, depth);
+    item.mesh = mesh;
+    item.matrixSlot = matrixSlot;
+    if (matrixSlot < 0)
+        item.model = model;
+    item.instanceCount = instanceCount;
+    item.lampSlot = lampSlot;
+    item.lightState = lightState;
+    drawItems.push_back(item);
+}
+
+void sortDrawItems(std::vector<DrawItem> &items, std::vector<DrawItem> &scratch)
+{
+    // Bytes that are the same in every key need no pass
+    uint64_t anyBits = 0, allBits = ~uint64_t(0);
+    for (const auto &item : items)
+    {
+        anyBits |= item.key;
+        allBits &= item.key;
+    }
+    uint64_t varying = anyBits & ~allBits;
+
+    scratch.resize(items.size());
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        if (((varying >> shift) & 0xff) == 0)
+            continue;
+
+        size_t offsets[256] = {};
+        for (const auto &item : items)
+            offsets[(item.key >> shift) & 0xff]++;
+        size_t total = 0;
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            size_t count = offsets[digit];
+            offsets[digit] = total;
+            total += count;
+        }
+        for (const auto &item : items)
+            scratch[offsets[(item.key >> shift) & 0xff]++] = item;
+        items.swap(scratch);
+    }
+}
+
+void submitDrawList()
+{
+    if (drawSorting)
+        sortDrawItems(drawItems, sortScratch);
+
+    for (const auto &item : drawItems)
+    {
+        const Mesh &mesh = meshes[item.mesh];
+        useProgram(program);
+        bindVertexArray(mesh.vao);
+        setUniform1i(ModelIndex, item.matrixSlot);
+        if (item.matrixSlot < 0)
+            setUniformMatrix4(Model, item.model);
+        setUniform3f(PositionScale, mesh.positionScale);
+        setUniform3f(PositionOffset, mesh.positionOffset);
+        bool props = item.instanceCount > 0 && item.matrixSlot >= 0;
+        setUniform1i(Instanced, item.instanceCount > 0 && !props);
+        setUniform1i(InstancedProps, props);
+        setUniform1i(LampSlot, item.lampSlot);
+        if (item.lampSlot >= 0)
+            setUniform1i(LightState, item.lightState);
+
+        if (item.instanceCount > 0)
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.numIndices, mesh.indexType, BUFFER_OFFSET(mesh.indexOffset),
+                                              item.instanceCount, mesh.baseVertex);
+        else
+            glDrawElementsBaseVertex(GL_TRIANGLES, mesh.numIndices, mesh.indexType, BUFFER_OFFSET(mesh.indexOffset), mesh.baseVertex);
+        countGLCall();
+    }
+    drawItems.clear();
+}
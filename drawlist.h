@@ -0,0 +1,52 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "Angel.h"
+#include "objects.h"
+#include <cstdint>
+#include <vector>
+
+// Draw list: drawObject() and friends only record draws. submitDrawList()
+// sorts them by a 64-bit key and issues them through the GL state cache,
+// so that draws sharing a vertex array follow each other. Every recorded
+// draw uses the main program (impostors, the overdraw view and indirect
+// mode draw outside the list), so the key has no program field.
+//
+// Key layout, most significant first:
+//   8 bits coarse depth, 24 bits vertex array, 16 bits fine depth,
+//   16 bits unused
+// Coarse depth orders opaque draws roughly front to back so that early depth
+// tests reject hidden fragments; draws in the same depth slab still group by
+// vertex array. Depth is taken at the far side of the bounds, so that large
+// objects under everything else (ground, roads) go last.
+
+extern bool drawSorting; // Off with --no-draw-sorting: draws go out in submission order
+extern bool frontToBack; // Off with --no-front-to-back: coarse depth is left out of the key
+
+struct DrawItem
+{
+    uint64_t key;
+    MeshHandle mesh;    // Level of detail already chosen
+    int matrixSlot;     // Static world matrix, or -1 to use model
+    mat4 model;
+    int instanceCount; // 0 for a single draw
+    int lampSlot;      // -1 except for traffic light lamps
+    int lightState;
+};
+
+// Record one draw of an uploaded mesh with its world matrix; a static one
+// (matrixSlot >= 0) is only used for the sort key. Instanced draws with a
+// matrix slot are props (props.h), the others instanced buildings.
+void addDraw(const Object &mesh, const mat4 &model, int matrixSlot, int instanceCount = 0, int lampSlot = -1, int lightState = 0);
+
+// Same, for a mesh whose world box is already known (the world store)
+void addDraw(MeshHandle mesh, const vec3 &worldCenter, const vec3 &worldExtent, const mat4 &model, int matrixSlot,
+             int instanceCount = 0, int lampSlot = -1, int lightState = 0);
+
+// Sort and issue the recorded draws, then empty the list
+void submitDrawList();
+
+// Sort items by key (stable LSD radix sort, 8 bits per pass)
+void sortDrawItems(std::vector<DrawItem> &items, std::vector<DrawItem> &scratch);
+
+#endif
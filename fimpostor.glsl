@@ -0,0 +1,15 @@
+#version 150
+
+in vec4 color;
+in vec3 texCoord;
+out vec4 fColor;
+
+// Coverage of the building in each snapshot
+uniform sampler2DArray uAtlas;
+
+void main()
+{
+    if (texture(uAtlas, texCoord).r < 0.5)
+        discard;
+    fColor = color;
+}
@@ -0,0 +1,16 @@
+#version 150
+
+out vec4 fColor;
+
+// Fragment counts are accumulated in alpha
+uniform sampler2D uOverdraw;
+
+const vec3 heat[5] = vec3[5](vec3(0.0, 0.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0),
+                             vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0));
+
+void main()
+{
+    float count = min(texelFetch(uOverdraw, ivec2(gl_FragCoord.xy), 0).a, 4.0);
+    int low = int(floor(count));
+    fColor = vec4(mix(heat[low], heat[min(low + 1, 4)], count - float(low)), 1.0);
+}
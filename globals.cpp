@@ -12,3 +12,6 @@ GLfloat wheelRotation = 0.0f; // For wheel animation
 
 // Global variable for view mode
 int viewMode = 1; // Default view (F1)
+
+// Static city render mode (cycled with 'b')
+StaticRenderMode staticRenderMode = RENDER_BATCHED;
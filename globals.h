@@ -16,4 +16,14 @@ extern GLfloat wheelRotation;
 // Global variable for view mode
 extern int viewMode;
 
+// How the static city (ground, roads, buildings) is submitted
+enum StaticRenderMode
+{
+    RENDER_PER_OBJECT, // One draw per building
+    RENDER_BATCHED,    // Everything merged into one world-space buffer
+    RENDER_INSTANCED,  // One unit building drawn once per instance
+    RENDER_INDIRECT    // Per-object culling, one multi-draw from shared buffers
+};
+extern StaticRenderMode staticRenderMode;
+
 #endif
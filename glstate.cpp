@@ -0,0 +1,110 @@
+#include "Angel.h"
+#include "glstate.h"
+#include "stats.h"
+#include <cstring>
+#include <map>
+#include <vector>
+
+bool glStateCache = true;
+
+// Last value of one uniform, as raw floats (integers are stored as one float)
+struct CachedUniform
+{
+    bool valid;
+    GLfloat value[16];
+};
+
+static GLuint currentProgram = 0;
+static GLuint currentVao = 0;
+static bool stateKnown = false;
+
+// Uniform values per program, indexed by location
+static std::map<GLuint, std::vector<CachedUniform>> uniformCache;
+static std::vector<CachedUniform> *currentUniforms = NULL;
+
+void resetGLState()
+{
+    stateKnown = false;
+    uniformCache.clear();
+    currentUniforms = NULL;
+}
+
+void countGLCall()
+{
+    frameStats.glCalls++;
+}
+
+// True if the call must be issued; counts it either way
+static bool stateChanged(bool changed)
+{
+    if (changed || !glStateCache)
+    {
+        frameStats.glCalls++;
+        return true;
+    }
+    frameStats.glCallsSkipped++;
+    return false;
+}
+
+void useProgram(GLuint program)
+{
+    if (stateChanged(!stateKnown || program != currentProgram))
+        glUseProgram(program);
+
+    if (!stateKnown)
+        currentVao = ~0u; // The VAO binding is not known either
+    stateKnown = true;
+    currentProgram = program;
+    currentUniforms = &uniformCache[program];
+}
+
+void bindVertexArray(GLuint vao)
+{
+    if (stateChanged(!stateKnown || vao != currentVao))
+        glBindVertexArray(vao);
+    currentVao = vao;
+}
+
+// Compare and store a uniform value; true if it has to be set
+static bool uniformChanged(GLint location, const GLfloat *value, int count)
+{
+    if (location < 0 || currentUniforms == NULL)
+        return stateChanged(true);
+
+    if (int(currentUniforms->size()) <= location)
+    {
+        CachedUniform empty = {false, {}};
+        currentUniforms->resize(location + 1, empty);
+    }
+    CachedUniform &cached = (*currentUniforms)[location];
+    bool changed = !cached.valid || memcmp(cached.value, value, count * sizeof(GLfloat)) != 0;
+    cached.valid = true;
+    memcpy(cached.value, value, count * sizeof(GLfloat));
+    return stateChanged(changed);
+}
+
+void setUniform1i(GLint location, GLint value)
+{
+    GLfloat stored = GLfloat(value);
+    if (uniformChanged(location, &stored, 1))
+        glUniform1i(location, value);
+}
+
+void setUniform3f(GLint location, const vec3 &value)
+{
+    GLfloat stored[3] = {value.x, value.y, value.z};
+    if (uniformChanged(location, stored, 3))
+        glUniform3fv(location, 1, stored);
+}
+
+void setUniformMatrix4(GLint location, const mat4 &value)
+{
+    GLfloat stored[16];
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            stored[4 * i + j] = value[i][j];
+    }
+    if (uniformChanged(location, stored, 16))
+        glUniformMatrix4fv(location, 1, GL_TRUE, stored);
+}
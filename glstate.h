@@ -0,0 +1,26 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "Angel.h"
+
+// Thin cache of the GL state set while drawing. Calls that would not change
+// anything are skipped; issued and skipped calls are counted in frameStats.
+// State set with raw GL calls is not seen, so resetGLState() must follow
+// them (display() resets at the start of every frame).
+
+extern bool glStateCache; // Off with --no-state-cache: every call is issued
+
+void resetGLState();
+
+void useProgram(GLuint program);
+void bindVertexArray(GLuint vao);
+
+// Uniforms of the current program
+void setUniform1i(GLint location, GLint value);
+void setUniform3f(GLint location, const vec3 &value);
+void setUniformMatrix4(GLint location, const mat4 &value); // Row-major, like Angel
+
+// Count a call issued directly, such as a draw
+void countGLCall();
+
+#endif
@@ -0,0 +1,490 @@
+#include "Angel.h"
+#include "gpucull.h"
+#include "globals.h"
+#include "objects.h"
+#include "indirect.h"
+#include "culling.h"
+#include "lod.h"
+#include "world.h"
+#include "glstate.h"
+#include "stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <vector>
+
+bool gpuCulling = false;
+bool hizCulling = false;
+bool verifyGpuCulling = false;
+
+extern GLuint program;
+
+// Same layout as CullObject in ccull.glsl
+struct CullObject
+{
+    vec4 center; // w = bounding sphere radius
+    vec4 extent;
+    GLint info[4]; // First draw record, levels, first threshold, thresholds
+};
+
+static bool created = false;
+static GLuint cullProgram = 0, hizProgram = 0;
+static GLint objectCountLocation, frustumCullingLocation, frustumLocation, eyeLocation;
+static GLint lodPixelsLocation, hiZLocation, hiZViewProjectionLocation, hiZSizeLocation, hiZLevelsLocation;
+static GLint copyLocation, sourceLevelLocation;
+static GLuint objectBuffer = 0, lodSizeBuffer = 0, levelBuffer = 0, counterBuffer = 0;
+static int commandCapacity = 0;
+static bool drawCountSupported = false; // ARB_indirect_parameters
+static std::vector<CullObject> cullObjects;
+static std::vector<GLfloat> lodSizes;
+
+// CPU copy of the chosen levels, for the reference check only
+static std::vector<GLint> referenceLevels;
+
+// Depth of the last frame and its pyramid
+static GLuint depthTexture = 0, hizTexture = 0;
+static int hizWidth = 0, hizHeight = 0, hizLevels = 0;
+static bool hizValid = false;
+static mat4 hizViewProjection;
+
+// What each cull object is, to report differences from the CPU reference
+static const char *cullObjectNames[] = {"ground", "roads", "building", "traffic light"};
+static std::vector<int> cullObjectKinds;
+static std::vector<int> recordObjects; // Cull object of every draw record
+
+// InitShader() only builds vertex and fragment programs
+static GLuint initComputeShader(const char *file)
+{
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL)
+    {
+        std::cerr << "Failed to read " << file << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<char> source;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        source.insert(source.end(), buffer, buffer + read);
+    source.push_back('\0');
+    fclose(fp);
+
+    const GLchar *text = &source[0];
+    GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &text, NULL);
+    glCompileShader(shader);
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status)
+    {
+        GLint logSize;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logSize);
+        std::vector<char> log(logSize + 1);
+        glGetShaderInfoLog(shader, logSize, NULL, &log[0]);
+        std::cerr << file << " failed to compile:" << std::endl << &log[0] << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    GLuint computeProgram = glCreateProgram();
+    glAttachShader(computeProgram, shader);
+    glLinkProgram(computeProgram);
+    glGetProgramiv(computeProgram, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        std::cerr << file << " failed to link" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return computeProgram;
+}
+
+// World box, bounding sphere and levels of an object of the indirect scene
+static void addCullBox(const vec3 &worldCenter, const vec3 &worldExtent, float radius, int drawRecord, int levels,
+                       const float *sizes, int sizeCount, int level, int kind)
+{
+    CullObject cull;
+    for (int i = 0; i < 3; ++i)
+    {
+        cull.center[i] = worldCenter[i];
+        cull.extent[i] = worldExtent[i];
+    }
+    cull.center.w = radius;
+    cull.extent.w = 0.0f;
+    cull.info[0] = drawRecord;
+    cull.info[1] = levels;
+    cull.info[2] = lodSizes.size();
+    cull.info[3] = sizeCount;
+    cullObjects.push_back(cull);
+    lodSizes.insert(lodSizes.end(), sizes, sizes + sizeCount);
+    referenceLevels.push_back(level);
+    cullObjectKinds.push_back(kind);
+    recordObjects.resize(drawRecord + levels, cullObjects.size() - 1);
+}
+
+static void addCullObject(const Object &obj, int kind)
+{
+    vec3 center = (obj.boundsMin + obj.boundsMax) * 0.5f;
+    vec3 extent = (obj.boundsMax - obj.boundsMin) * 0.5f;
+    const mat4 &m = obj.modelMatrix;
+
+    // Same world box as isObjectVisible(), same sphere as lodScreenSize()
+    vec3 worldCenter, worldExtent;
+    float scale = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        worldCenter[i] = m[i][0] * center.x + m[i][1] * center.y + m[i][2] * center.z + m[i][3];
+        worldExtent[i] = std::fabs(m[i][0]) * extent.x + std::fabs(m[i][1]) * extent.y + std::fabs(m[i][2]) * extent.z;
+        scale = std::max(scale, m[0][i] * m[0][i] + m[1][i] * m[1][i] + m[2][i] * m[2][i]);
+    }
+    addCullBox(worldCenter, worldExtent, length(extent) * std::sqrt(scale), obj.drawRecord, obj.lods.size() + 1,
+               obj.lodSizes.empty() ? NULL : &obj.lodSizes[0], obj.lodSizes.size(), obj.lodLevel, kind);
+}
+
+static void createGpuCulling()
+{
+    created = true;
+    createIndirectScene();
+
+    // Same objects, in the same order, as the indirect scene
+    addCullObject(ground, 0);
+    addCullObject(roads, 1);
+    for (size_t i = 0; i < buildings.size(); ++i)
+    {
+        addCullBox(buildings.centers[i], buildings.extents[i], buildings.radii[i], buildings.drawRecords[i],
+                   BuildingLevels, buildings.lodSizes, BuildingLevels - 1, buildings.lodLevels[i], 2);
+    }
+    for (const auto &tl : trafficLights)
+    {
+        addCullObject(tl.base, 3);
+        addCullObject(tl.lightBox, 3);
+        addCullObject(tl.connectorPole, 3);
+        for (int k = 0; k < 3; ++k)
+            addCullObject(tl.lights[k], 3);
+    }
+    if (lodSizes.empty())
+        lodSizes.push_back(0.0f); // Keep the buffer non-empty
+
+    cullProgram = initComputeShader("ccull.glsl");
+    hizProgram = initComputeShader("chiz.glsl");
+    objectCountLocation = glGetUniformLocation(cullProgram, "uObjectCount");
+    frustumCullingLocation = glGetUniformLocation(cullProgram, "uFrustumCulling");
+    frustumLocation = glGetUniformLocation(cullProgram, "uFrustum");
+    eyeLocation = glGetUniformLocation(cullProgram, "uEye");
+    lodPixelsLocation = glGetUniformLocation(cullProgram, "uLodPixels");
+    hiZLocation = glGetUniformLocation(cullProgram, "uHiZ");
+    hiZViewProjectionLocation = glGetUniformLocation(cullProgram, "uHiZViewProjection");
+    hiZSizeLocation = glGetUniformLocation(cullProgram, "uHiZSize");
+    hiZLevelsLocation = glGetUniformLocation(cullProgram, "uHiZLevels");
+    glUseProgram(cullProgram);
+    glUniform1f(glGetUniformLocation(cullProgram, "uLodHysteresis"), LodHysteresis);
+    glUniform1i(glGetUniformLocation(cullProgram, "uHiZPyramid"), HiZUnit);
+    copyLocation = glGetUniformLocation(hizProgram, "uCopy");
+    sourceLevelLocation = glGetUniformLocation(hizProgram, "uSourceLevel");
+    glUseProgram(hizProgram);
+    glUniform1i(glGetUniformLocation(hizProgram, "uSource"), HiZUnit);
+
+    glGenBuffers(1, &objectBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cullObjects.size() * sizeof(CullObject), &cullObjects[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &lodSizeBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lodSizeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, lodSizes.size() * sizeof(GLfloat), &lodSizes[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &levelBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, levelBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, referenceLevels.size() * sizeof(GLint), &referenceLevels[0], GL_DYNAMIC_COPY);
+    frameStats.bytesUploaded += cullObjects.size() * sizeof(CullObject) + lodSizes.size() * sizeof(GLfloat) +
+                                referenceLevels.size() * sizeof(GLint);
+    glGenBuffers(1, &counterBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+
+    // At most one command per object
+    commandCapacity = cullObjects.size();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectCommandBuffer());
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commandCapacity * 5 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    drawCountSupported = glewIsSupported("GL_ARB_indirect_parameters");
+
+    glUseProgram(program);
+    resetGLState();
+
+    std::cout << "GPU culling: " << cullObjects.size() << " objects, draw count "
+              << (drawCountSupported ? "read by the GL" : "fixed, unused commands zeroed") << std::endl;
+}
+
+bool isGpuCullingActive()
+{
+    return gpuCulling && staticRenderMode == RENDER_INDIRECT;
+}
+
+// Level and visibility of one object as ccull.glsl decides them, without the
+// Hi-Z test; -1 when not drawn
+static int referenceRecord(int index, const vec4 &eye, float pixels)
+{
+    const CullObject &object = cullObjects[index];
+    vec3 center(object.center.x, object.center.y, object.center.z);
+    vec3 extent(object.extent.x, object.extent.y, object.extent.z);
+    if (frustumCulling && !isBoxVisible(worldFrustum, center, extent))
+        return -1;
+
+    int level = referenceLevels[index];
+    int thresholds = object.info[3];
+    if (pixels <= 0.0f)
+    {
+        level = 0;
+    }
+    else if (thresholds > 0)
+    {
+        float radius = object.center.w;
+        float distance = length(center - vec3(eye.x, eye.y, eye.z));
+        float size = distance <= radius ? 1e9f : 2.0f * radius * pixels / distance;
+        const GLfloat *sizes = &lodSizes[object.info[2]];
+        while (level < thresholds && size < sizes[level] * (1.0f - LodHysteresis))
+            level++;
+        while (level > 0 && size > sizes[level - 1] * (1.0f + LodHysteresis))
+            level--;
+    }
+    referenceLevels[index] = level;
+
+    if (level >= object.info[1])
+        return -1;
+    return object.info[0] + level;
+}
+
+// True if the box lies behind every pixel it covered in the depth of the
+// previous frame, tested pixel by pixel
+static bool isBehindDepth(const CullObject &object, const std::vector<GLfloat> &depth)
+{
+    vec3 lo(1e9f, 1e9f, 1e9f), hi(-1e9f, -1e9f, -1e9f);
+    for (int i = 0; i < 8; ++i)
+    {
+        vec4 corner(object.center.x + ((i & 1) ? object.extent.x : -object.extent.x),
+                    object.center.y + ((i & 2) ? object.extent.y : -object.extent.y),
+                    object.center.z + ((i & 4) ? object.extent.z : -object.extent.z), 1.0f);
+        vec4 clip = hizViewProjection * corner;
+        if (clip.w <= 0.0f)
+            return false;
+        for (int k = 0; k < 3; ++k)
+        {
+            lo[k] = std::min(lo[k], clip[k] / clip.w);
+            hi[k] = std::max(hi[k], clip[k] / clip.w);
+        }
+    }
+
+    int x0 = std::max(0, int((lo.x * 0.5f + 0.5f) * hizWidth)), x1 = std::min(hizWidth - 1, int((hi.x * 0.5f + 0.5f) * hizWidth));
+    int y0 = std::max(0, int((lo.y * 0.5f + 0.5f) * hizHeight)), y1 = std::min(hizHeight - 1, int((hi.y * 0.5f + 0.5f) * hizHeight));
+    float nearest = lo.z * 0.5f + 0.5f;
+    for (int y = y0; y <= y1; ++y)
+    {
+        for (int x = x0; x <= x1; ++x)
+        {
+            if (nearest <= depth[y * hizWidth + x])
+                return false;
+        }
+    }
+    return true;
+}
+
+// Read back this frame's commands and compare the records drawn with the CPU
+// reference. Frustum and levels must agree exactly; the Hi-Z test may only
+// leave out more, and each object it leaves out must be behind the depth
+static void verifyCommands(GLuint drawCount, const vec4 &eye, float pixels)
+{
+    std::vector<GLuint> commands(drawCount * 5);
+    if (drawCount > 0)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectCommandBuffer());
+        glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(GLuint), &commands[0]);
+    }
+    std::vector<GLuint> gpuRecords;
+    for (GLuint i = 0; i < drawCount; ++i)
+        gpuRecords.push_back(commands[i * 5 + 4]);
+    std::sort(gpuRecords.begin(), gpuRecords.end());
+
+    std::vector<GLuint> cpuRecords;
+    for (size_t i = 0; i < cullObjects.size(); ++i)
+    {
+        int record = referenceRecord(i, eye, pixels);
+        if (record >= 0)
+            cpuRecords.push_back(record);
+    }
+    std::sort(cpuRecords.begin(), cpuRecords.end());
+
+    // Drawn by the GPU only, and left out by the GPU only
+    std::vector<GLuint> gpuOnly, cpuOnly;
+    std::set_difference(gpuRecords.begin(), gpuRecords.end(), cpuRecords.begin(), cpuRecords.end(), std::back_inserter(gpuOnly));
+    std::set_difference(cpuRecords.begin(), cpuRecords.end(), gpuRecords.begin(), gpuRecords.end(), std::back_inserter(cpuOnly));
+
+    std::vector<GLuint> mismatches = gpuOnly;
+    int hiddenByHiZ = 0;
+    if (hizCulling && hizValid)
+    {
+        std::vector<GLfloat> depth(hizWidth * hizHeight);
+        glBindTexture(GL_TEXTURE_2D, hizTexture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, &depth[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        for (GLuint record : cpuOnly)
+        {
+            if (isBehindDepth(cullObjects[recordObjects[record]], depth))
+                hiddenByHiZ++;
+            else
+                mismatches.push_back(record);
+        }
+    }
+    else
+    {
+        mismatches.insert(mismatches.end(), cpuOnly.begin(), cpuOnly.end());
+    }
+
+    if (mismatches.empty())
+    {
+        if (hiddenByHiZ > 0)
+            printf("GPU culling verified: %d drawn, %d more hidden by Hi-Z\n", int(gpuRecords.size()), hiddenByHiZ);
+        return;
+    }
+
+    int object = recordObjects[mismatches[0]];
+    printf("GPU culling mismatch: %d drawn, %d by the CPU reference, %d differ, first object %d (%s), level %d\n",
+           int(gpuRecords.size()), int(cpuRecords.size()), int(mismatches.size()), object,
+           cullObjectNames[cullObjectKinds[object]], int(mismatches[0]) - cullObjects[object].info[0]);
+
+    // Carry on from the GPU's levels so one difference does not linger
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, levelBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, referenceLevels.size() * sizeof(GLint), &referenceLevels[0]);
+}
+
+void cullOnGpu(const mat4 &projection, const vec4 &eye)
+{
+    if (!created)
+        createGpuCulling();
+
+    // Zero the counters; without a draw count the commands too, so the ones
+    // past the count draw nothing
+    GLuint zero = 0;
+    if (!drawCountSupported)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectCommandBuffer());
+        glClearBufferData(GL_DRAW_INDIRECT_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, objectBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, lodSizeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, indirectRecordMeshBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, levelBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, indirectCommandBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, counterBuffer);
+
+    // Pixels per unit at distance one, scaled by the bias (lod.cpp)
+    float pixels = lodEnabled ? lodBias * 0.5f * lodScreenHeight * projection[1][1] : 0.0f;
+    bool hizUsed = hizCulling && hizValid;
+
+    useProgram(cullProgram);
+    glUniform1i(objectCountLocation, cullObjects.size());
+    glUniform1i(frustumCullingLocation, frustumCulling);
+    glUniform4fv(frustumLocation, 6, &worldFrustum.planes[0][0]);
+    glUniform3f(eyeLocation, eye.x, eye.y, eye.z);
+    glUniform1f(lodPixelsLocation, pixels);
+    glUniform1i(hiZLocation, hizUsed);
+    if (hizUsed)
+    {
+        glActiveTexture(GL_TEXTURE0 + HiZUnit);
+        glBindTexture(GL_TEXTURE_2D, hizTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniformMatrix4fv(hiZViewProjectionLocation, 1, GL_TRUE, hizViewProjection);
+        glUniform2i(hiZSizeLocation, hizWidth, hizHeight);
+        glUniform1i(hiZLevelsLocation, hizLevels);
+    }
+    glDispatchCompute((cullObjects.size() + 63) / 64, 1, 1);
+    countGLCall();
+
+    // The commands are read as draw parameters, the counters by the draw or
+    // the readback below
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    drawIndirectCommands(drawCountSupported ? counterBuffer : 0, commandCapacity);
+
+    // The counters are read back for the statistics only when they are
+    // reported, as it waits for the dispatch
+    if (benchMode || verifyGpuCulling)
+    {
+        GLuint counters[2];
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+        frameStats.visibleObjects += counters[0];
+        frameStats.culledObjects += cullObjects.size() - counters[0];
+        frameStats.triangles += counters[1];
+
+        if (verifyGpuCulling)
+            verifyCommands(counters[0], eye, pixels);
+    }
+}
+
+// Depth copy and pyramid the size of the viewport
+static void createHiZ(int width, int height)
+{
+    if (depthTexture == 0)
+    {
+        glGenTextures(1, &depthTexture);
+        glGenTextures(1, &hizTexture);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+    // Texture storage is immutable, so a new size needs a new texture
+    glDeleteTextures(1, &hizTexture);
+    glGenTextures(1, &hizTexture);
+    hizLevels = 1;
+    while ((std::max(width, height) >> hizLevels) > 0)
+        hizLevels++;
+    glBindTexture(GL_TEXTURE_2D, hizTexture);
+    glTexStorage2D(GL_TEXTURE_2D, hizLevels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    hizWidth = width;
+    hizHeight = height;
+}
+
+void updateHiZ(const mat4 &view, const mat4 &projection)
+{
+    if (!isGpuCullingActive() || !hizCulling)
+    {
+        hizValid = false;
+        return;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != hizWidth || viewport[3] != hizHeight)
+        createHiZ(viewport[2], viewport[3]);
+
+    // Depth of the frame just drawn, from the current framebuffer
+    glActiveTexture(GL_TEXTURE0 + HiZUnit);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], hizWidth, hizHeight);
+
+    // Level 0 is the depth as is, each level above the farthest of the one below
+    useProgram(hizProgram);
+    for (int level = 0; level < hizLevels; ++level)
+    {
+        int width = std::max(hizWidth >> level, 1);
+        int height = std::max(hizHeight >> level, 1);
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : hizTexture);
+        glUniform1i(copyLocation, level == 0);
+        glUniform1i(sourceLevelLocation, level - 1);
+        glBindImageTexture(0, hizTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        countGLCall();
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    hizViewProjection = projection * view;
+    hizValid = true;
+}
@@ -0,0 +1,29 @@
+#ifndef GPUCULL_H
+#define GPUCULL_H
+
+#include "Angel.h"
+
+// GPU culling of indirect mode: a compute shader (ccull.glsl) runs once per
+// static object, tests its world box against the frustum and, with Hi-Z on,
+// against a depth pyramid of the previous frame, steps its level of detail
+// and appends a command for the chosen level to the indirect command buffer.
+// The CPU only uploads the camera and issues one dispatch and one draw; it
+// never touches the objects. Impostors and software occlusion are CPU-side
+// and do not apply. Needs OpenGL 4.3.
+
+extern bool gpuCulling;       // Indirect mode culls on the GPU, toggled with 'g'
+extern bool hizCulling;       // Also test against the previous frame's depth, toggled with 'z'
+extern bool verifyGpuCulling; // Compare every frame with the CPU reference (--verify-gpu-culling)
+
+const int HiZUnit = 2; // Texture unit of the depth pyramid while it is used
+
+// True while display() should leave the static scene to cullOnGpu()
+bool isGpuCullingActive();
+
+// Cull, select levels and draw the whole static scene of indirect mode
+void cullOnGpu(const mat4 &projection, const vec4 &eye);
+
+// Keep the depth of the finished frame as next frame's Hi-Z pyramid
+void updateHiZ(const mat4 &view, const mat4 &projection);
+
+#endif
@@ -0,0 +1,198 @@
+#include "Angel.h"
+#include "impostor.h"
+#include "objects.h"
+#include "display.h"
+#include "stats.h"
+#include "glstate.h"
+#include "transforms.h"
+#include "ring.h"
+#include "arena.h"
+#include "registry.h"
+#include <vector>
+
+bool impostorsEnabled = true;
+float impostorDistance = 80.0f;
+
+extern GLuint program;
+extern GLuint Model, ModelIndex;
+extern GLuint PositionScale, PositionOffset;
+
+// Building heights covered by the classes (see createBuildings)
+const float ImpostorMinHeight = 2.0f;
+const float ImpostorMaxHeight = 5.0f;
+const float ImpostorClassStep = (ImpostorMaxHeight - ImpostorMinHeight) / ImpostorClasses;
+
+static GLuint impostorProgram = 0;
+static GLuint impostorEye;
+static GLuint atlasTexture = 0;
+static GLuint cardVao = 0;
+static GLuint cardBuffer = 0;
+static GLuint cardInstance, cardInstanceColor; // Instance attribute locations
+static std::vector<BuildingInstance> queuedImpostors;
+
+// Same mapping as decodeDirection() in vimpostor.glsl
+static vec3 decodeDirection(float ex, float ey)
+{
+    float px = 0.5f * (ex + ey);
+    float pz = 0.5f * (ex - ey);
+    return normalize(vec3(px, 1.0f - std::fabs(px) - std::fabs(pz), pz));
+}
+
+// Render every height class from every frame direction into the atlas
+static void renderAtlas()
+{
+    int atlasSize = ImpostorFrames * ImpostorFrameSize;
+    glGenTextures(1, &atlasTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlasTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, atlasSize, atlasSize, ImpostorClasses, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    // Only coverage is kept: buildings are a single flat color
+    GLint viewport[4];
+    GLfloat clearColor[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(program);
+    glUniform1i(ModelIndex, -1);
+    glUniformMatrix4fv(Model, 1, GL_TRUE, mat4());
+
+    for (int layer = 0; layer < ImpostorClasses; ++layer)
+    {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, atlasTexture, 0, layer);
+        glViewport(0, 0, atlasSize, atlasSize);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        // One building of the class height, drawn through the regular shader
+        float height = ImpostorMinHeight + (layer + 0.5f) * ImpostorClassStep;
+        BuildingInstance instance;
+        instance.position = vec4(0.0, 0.0, 0.0, height);
+        instance.color = color4(1.0, 1.0, 1.0, 1.0);
+        Object building;
+        buildBuilding(building, instance);
+        uploadObject(building, "impostor source");
+        flushArena();
+
+        float top = height + buildingRoofHeight;
+        vec3 center(0.0, 0.5f * top, 0.0);
+        float radius = length(vec3(buildingSize, 0.5f * top, buildingSize));
+        mat4 ortho = Ortho(-radius, radius, -radius, radius, 0.5f, 2.0f * radius + 1.0f);
+
+        for (int fy = 0; fy < ImpostorFrames; ++fy)
+        {
+            for (int fx = 0; fx < ImpostorFrames; ++fx)
+            {
+                vec3 d = decodeDirection((fx + 0.5f) / ImpostorFrames * 2.0f - 1.0f,
+                                         (fy + 0.5f) / ImpostorFrames * 2.0f - 1.0f);
+                vec4 reference = d.y > 0.999f ? vec4(0.0, 0.0, -1.0, 0.0) : vec4(0.0, 1.0, 0.0, 0.0);
+                vec3 eye = center + d * (radius + 0.5f);
+                mat4 view = LookAt(vec4(eye, 1.0), vec4(center, 1.0), reference);
+
+                glViewport(fx * ImpostorFrameSize, fy * ImpostorFrameSize, ImpostorFrameSize, ImpostorFrameSize);
+                setCamera(view, ortho);
+                const Mesh &mesh = meshes[building.mesh];
+                glUniform3fv(PositionScale, 1, mesh.positionScale);
+                glUniform3fv(PositionOffset, 1, mesh.positionOffset);
+                glBindVertexArray(mesh.vao);
+                glDrawElementsBaseVertex(GL_TRIANGLES, building.numIndices, mesh.indexType,
+                                         BUFFER_OFFSET(mesh.indexOffset), mesh.baseVertex);
+            }
+        }
+
+        releaseMesh(building.mesh);
+    }
+
+    // Restore the window state
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glDeleteFramebuffers(1, &fbo);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void createImpostors()
+{
+    impostorProgram = InitShader("vimpostor.glsl", "fimpostor.glsl");
+    bindTransforms(impostorProgram);
+    glUseProgram(impostorProgram);
+
+    impostorEye = glGetUniformLocation(impostorProgram, "uEye");
+    glUniform1i(glGetUniformLocation(impostorProgram, "uFrames"), ImpostorFrames);
+    glUniform1i(glGetUniformLocation(impostorProgram, "uClasses"), ImpostorClasses);
+    glUniform1f(glGetUniformLocation(impostorProgram, "uMinHeight"), ImpostorMinHeight);
+    glUniform1f(glGetUniformLocation(impostorProgram, "uClassStep"), ImpostorClassStep);
+    glUniform1f(glGetUniformLocation(impostorProgram, "uHalfWidth"), buildingSize);
+    glUniform1f(glGetUniformLocation(impostorProgram, "uRoofHeight"), buildingRoofHeight);
+    glUniform1i(glGetUniformLocation(impostorProgram, "uAtlas"), 0);
+
+    // Card corners, and the per-instance data streamed every frame
+    GLfloat corners[] = {-1.0, -1.0, 1.0, -1.0, 1.0, 1.0, -1.0, -1.0, 1.0, 1.0, -1.0, 1.0};
+    glGenVertexArrays(1, &cardVao);
+    glBindVertexArray(cardVao);
+    glGenBuffers(1, &cardBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, cardBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    frameStats.bytesUploaded += sizeof(corners);
+    GLuint vCorner = glGetAttribLocation(impostorProgram, "vCorner");
+    glEnableVertexAttribArray(vCorner);
+    glVertexAttribPointer(vCorner, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+    // Instances are read from the ring buffer, at an offset set per frame
+    cardInstance = glGetAttribLocation(impostorProgram, "vInstance");
+    glEnableVertexAttribArray(cardInstance);
+    glVertexAttribDivisor(cardInstance, 1);
+    cardInstanceColor = glGetAttribLocation(impostorProgram, "vInstanceColor");
+    glEnableVertexAttribArray(cardInstanceColor);
+    glVertexAttribDivisor(cardInstanceColor, 1);
+
+    renderAtlas();
+}
+
+bool isImpostorDistance(int index, const vec4 &eye)
+{
+    const vec4 &position = buildingInstances[index].position;
+    vec3 d(position.x - eye.x, position.y - eye.y, position.z - eye.z);
+    return dot(d, d) > impostorDistance * impostorDistance;
+}
+
+void addImpostor(int index)
+{
+    queuedImpostors.push_back(buildingInstances[index]);
+}
+
+void drawImpostors(const vec4 &eye)
+{
+    if (queuedImpostors.empty())
+        return;
+
+    useProgram(impostorProgram);
+    setUniform3f(impostorEye, vec3(eye.x, eye.y, eye.z));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlasTexture);
+
+    // Point the instance attributes at this frame's range of the ring
+    GLintptr offset = writeRing(&queuedImpostors[0], queuedImpostors.size() * sizeof(BuildingInstance));
+    bindVertexArray(cardVao);
+    glBindBuffer(GL_ARRAY_BUFFER, ringBuffer());
+    glVertexAttribPointer(cardInstance, 4, GL_FLOAT, GL_FALSE, sizeof(BuildingInstance), BUFFER_OFFSET(offset));
+    glVertexAttribPointer(cardInstanceColor, 4, GL_FLOAT, GL_FALSE, sizeof(BuildingInstance), BUFFER_OFFSET(offset + sizeof(vec4)));
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, queuedImpostors.size());
+    countGLCall();
+    frameStats.drawCalls++;
+    frameStats.triangles += 2 * queuedImpostors.size();
+    frameStats.visibleObjects += queuedImpostors.size();
+
+    useProgram(program);
+    queuedImpostors.clear();
+}
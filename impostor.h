@@ -0,0 +1,32 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include "Angel.h"
+
+// Impostors: in per-object mode, buildings further than impostorDistance are
+// drawn as cards in one instanced draw. Heights are grouped into classes and
+// each class is rendered once into a layer of a texture array, from
+// ImpostorFrames x ImpostorFrames directions over the upper hemisphere
+// (hemi-octahedral layout). A card shows the snapshot taken closest to the
+// direction of the eye.
+
+extern bool impostorsEnabled;  // Toggled with 'i'
+extern float impostorDistance; // From the eye to the building position
+
+const int ImpostorClasses = 8;
+const int ImpostorFrames = 9; // Odd, so that one frame looks straight down
+const int ImpostorFrameSize = 64;
+
+// Load the impostor shaders and render the atlas; called from init()
+void createImpostors();
+
+// True if a building of buildingInstances is far enough for an impostor
+bool isImpostorDistance(int index, const vec4 &eye);
+
+// Queue a building for drawImpostors()
+void addImpostor(int index);
+
+// Draw the queued buildings with one instanced draw and clear the queue
+void drawImpostors(const vec4 &eye);
+
+#endif
@@ -456,6 +456,39 @@ class mat4 {
     friend mat4 operator * ( const GLfloat s, const mat4& m )
 	{ return m * s; }
 	
+#ifdef ANGEL_SIMD
+    //  Row i of the product is the sum over k of _m[i][k] * m[k], started
+    //  from zero and added in k order like the loops below
+    mat4 operator * ( const mat4& m ) const {
+	mat4  a;
+
+#ifdef ANGEL_AVX
+	// Two rows at a time, each half of a register against the same m[k]
+	const __m128* b = reinterpret_cast<const __m128*>( &m._m[0].x );
+	__m256 b0 = _mm256_broadcast_ps( b );
+	__m256 b1 = _mm256_broadcast_ps( b + 1 );
+	__m256 b2 = _mm256_broadcast_ps( b + 2 );
+	__m256 b3 = _mm256_broadcast_ps( b + 3 );
+	for ( int i = 0; i < 4; i += 2 ) {
+	    __m256 rows = _mm256_loadu_ps( &_m[i].x );
+	    __m256 r = _mm256_setzero_ps();
+	    r = _mm256_add_ps( r, _mm256_mul_ps( _mm256_permute_ps( rows, 0x00 ), b0 ) );
+	    r = _mm256_add_ps( r, _mm256_mul_ps( _mm256_permute_ps( rows, 0x55 ), b1 ) );
+	    r = _mm256_add_ps( r, _mm256_mul_ps( _mm256_permute_ps( rows, 0xaa ), b2 ) );
+	    r = _mm256_add_ps( r, _mm256_mul_ps( _mm256_permute_ps( rows, 0xff ), b3 ) );
+	    _mm256_storeu_ps( &a._m[i].x, r );
+	}
+#else
+	simd::float4 b0 = m._m[0].simd(), b1 = m._m[1].simd();
+	simd::float4 b2 = m._m[2].simd(), b3 = m._m[3].simd();
+	for ( int i = 0; i < 4; ++i ) {
+	    simd::store( &a._m[i].x, simd::rowTimes( _m[i].simd(), b0, b1, b2, b3 ) );
+	}
+#endif
+
+	return a;
+    }
+#else
     mat4 operator * ( const mat4& m ) const {
 	mat4  a( 0.0 );
 
@@ -469,6 +502,7 @@ class mat4 {
 
 	return a;
     }
+#endif
 
     //
     //  --- (modifying) Arithematic Operators ---
@@ -489,19 +523,8 @@ class mat4 {
 	return *this;
     }
 
-    mat4& operator *= ( const mat4& m ) {
-	mat4  a( 0.0 );
-
-	for ( int i = 0; i < 4; ++i ) {
-	    for ( int j = 0; j < 4; ++j ) {
-		for ( int k = 0; k < 4; ++k ) {
-		    a[i][j] += _m[i][k] * m[k][j];
-		}
-	    }
-	}
-
-	return *this = a;
-    }
+    mat4& operator *= ( const mat4& m )
+	{ return *this = *this * m; }
 
     mat4& operator /= ( const GLfloat s ) {
 #ifdef DEBUG
@@ -520,6 +543,22 @@ class mat4 {
     //  --- Matrix / Vector operators ---
     //
 
+#ifdef ANGEL_SIMD
+    //  The columns times the components of v, added in the same order as
+    //  the sums of the plain version
+    vec4 operator * ( const vec4& v ) const {  // m * v
+	simd::float4 c0 = _m[0].simd(), c1 = _m[1].simd();
+	simd::float4 c2 = _m[2].simd(), c3 = _m[3].simd();
+	simd::transpose( c0, c1, c2, c3 );
+
+	simd::float4 p = v.simd();
+	simd::float4 r = simd::mul( c0, simd::lane<0>( p ) );
+	r = simd::add( r, simd::mul( c1, simd::lane<1>( p ) ) );
+	r = simd::add( r, simd::mul( c2, simd::lane<2>( p ) ) );
+	r = simd::add( r, simd::mul( c3, simd::lane<3>( p ) ) );
+	return vec4( r );
+    }
+#else
     vec4 operator * ( const vec4& v ) const {  // m * v
 	return vec4( _m[0][0]*v.x + _m[0][1]*v.y + _m[0][2]*v.z + _m[0][3]*v.w,
 		     _m[1][0]*v.x + _m[1][1]*v.y + _m[1][2]*v.z + _m[1][3]*v.w,
@@ -527,6 +566,7 @@ class mat4 {
 		     _m[3][0]*v.x + _m[3][1]*v.y + _m[3][2]*v.z + _m[3][3]*v.w
 	    );
     }
+#endif
 	
     //
     //  --- Insertion and Extraction Operators ---
@@ -567,6 +607,14 @@ mat4 matrixCompMult( const mat4& A, const mat4& B ) {
 	A[3][0]*B[3][0], A[3][1]*B[3][1], A[3][2]*B[3][2], A[3][3]*B[3][3] );
 }
 
+#ifdef ANGEL_SIMD
+inline
+mat4 transpose( const mat4& A ) {
+    simd::float4 r0 = A[0].simd(), r1 = A[1].simd(), r2 = A[2].simd(), r3 = A[3].simd();
+    simd::transpose( r0, r1, r2, r3 );
+    return mat4( vec4( r0 ), vec4( r1 ), vec4( r2 ), vec4( r3 ) );
+}
+#else
 inline
 mat4 transpose( const mat4& A ) {
     return mat4( A[0][0], A[1][0], A[2][0], A[3][0],
@@ -574,6 +622,7 @@ mat4 transpose( const mat4& A ) {
 		 A[0][2], A[1][2], A[2][2], A[3][2],
 		 A[0][3], A[1][3], A[2][3], A[3][3] );
 }
+#endif
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -745,14 +794,11 @@ mat4 Perspective( const GLfloat fovy, const GLfloat aspect,
     GLfloat top   = tan(fovy*DegreesToRadians/2) * zNear;
     GLfloat right = top * aspect;
 
-    mat4 c;
-    c[0][0] = zNear/right;
-    c[1][1] = zNear/top;
-    c[2][2] = -(zFar + zNear)/(zFar - zNear);
-    c[2][3] = -2.0*zFar*zNear/(zFar - zNear);
-    c[3][2] = -1.0;
-    c[3][3] = 0.0;
-    return c;
+    // Written a row at a time rather than over an identity matrix
+    return mat4( vec4( zNear/right, 0.0, 0.0, 0.0 ),
+		 vec4( 0.0, zNear/top, 0.0, 0.0 ),
+		 vec4( 0.0, 0.0, -(zFar + zNear)/(zFar - zNear), -2.0*zFar*zNear/(zFar - zNear) ),
+		 vec4( 0.0, 0.0, -1.0, 0.0 ) );
 }
 
 //----------------------------------------------------------------------------
@@ -767,8 +813,21 @@ mat4 LookAt( const vec4& eye, const vec4& at, const vec4& up )
     vec4 u = vec4(normalize(cross(up,n)), 0.0);
     vec4 v = vec4(normalize(cross(n,u)), 0.0);
     vec4 t = vec4(0.0, 0.0, 0.0, 1.0);
+#ifdef ANGEL_SIMD
+    //  c * Translate( -eye ) with the rows of both in registers, rather
+    //  than built in memory a float at a time and loaded back
+    simd::float4 t0 = vec4( 1.0, 0.0, 0.0, -eye.x ).simd();
+    simd::float4 t1 = vec4( 0.0, 1.0, 0.0, -eye.y ).simd();
+    simd::float4 t2 = vec4( 0.0, 0.0, 1.0, -eye.z ).simd();
+    simd::float4 t3 = t.simd();
+    return mat4( vec4( simd::rowTimes( u.simd(), t0, t1, t2, t3 ) ),
+		 vec4( simd::rowTimes( v.simd(), t0, t1, t2, t3 ) ),
+		 vec4( simd::rowTimes( n.simd(), t0, t1, t2, t3 ) ),
+		 vec4( simd::rowTimes( t3, t0, t1, t2, t3 ) ) );
+#else
     mat4 c = mat4(u, v, n, t);
     return c * Translate( -eye );
+#endif
 }
 
 //----------------------------------------------------------------------------
@@ -9,8 +9,98 @@
 
 #include "Angel.h"
 
+//----------------------------------------------------------------------------
+//
+//  --- SIMD selection ---
+//
+//   vec4 and mat4 are 16-byte aligned, and their arithmetic uses SSE (AVX
+//   for mat4 products when compiled with -mavx) or NEON, whichever the
+//   compiler targets.  Define ANGEL_NO_SIMD to use the plain C++ code.
+//   The kernels add in the same order as the plain code and never fuse a
+//   multiply with an add, so both give the same bits.
+//
+
+#if !defined(ANGEL_NO_SIMD) && (defined(__SSE__) || defined(_M_X64))
+#  define ANGEL_SSE
+#  include <xmmintrin.h>
+#  ifdef __AVX__
+#    define ANGEL_AVX
+#    include <immintrin.h>
+#  endif
+#elif !defined(ANGEL_NO_SIMD) && defined(__ARM_NEON)
+#  define ANGEL_NEON
+#  include <arm_neon.h>
+#endif
+
+#if defined(ANGEL_SSE) || defined(ANGEL_NEON)
+#  define ANGEL_SIMD
+#endif
+
 namespace Angel {
 
+#ifdef ANGEL_SIMD
+//  Four floats in a register, and the few operations vec4 and mat4 need
+namespace simd {
+
+#ifdef ANGEL_SSE
+typedef __m128 float4;
+
+inline float4 load( const GLfloat* p ) { return _mm_load_ps( p ); }
+inline void store( GLfloat* p, float4 v ) { _mm_store_ps( p, v ); }
+inline float4 splat( GLfloat s ) { return _mm_set1_ps( s ); }
+inline float4 zero() { return _mm_setzero_ps(); }
+inline float4 add( float4 a, float4 b ) { return _mm_add_ps( a, b ); }
+inline float4 sub( float4 a, float4 b ) { return _mm_sub_ps( a, b ); }
+inline float4 mul( float4 a, float4 b ) { return _mm_mul_ps( a, b ); }
+inline float4 neg( float4 v ) { return _mm_xor_ps( v, _mm_set1_ps( -0.0f ) ); }
+
+// Lane i of v in every lane
+template <int i>
+inline float4 lane( float4 v ) { return _mm_shuffle_ps( v, v, _MM_SHUFFLE(i, i, i, i) ); }
+
+inline void transpose( float4& r0, float4& r1, float4& r2, float4& r3 )
+    { _MM_TRANSPOSE4_PS( r0, r1, r2, r3 ); }
+#else
+typedef float32x4_t float4;
+
+inline float4 load( const GLfloat* p ) { return vld1q_f32( p ); }
+inline void store( GLfloat* p, float4 v ) { vst1q_f32( p, v ); }
+inline float4 splat( GLfloat s ) { return vdupq_n_f32( s ); }
+inline float4 zero() { return vdupq_n_f32( 0.0f ); }
+inline float4 add( float4 a, float4 b ) { return vaddq_f32( a, b ); }
+inline float4 sub( float4 a, float4 b ) { return vsubq_f32( a, b ); }
+inline float4 mul( float4 a, float4 b ) { return vmulq_f32( a, b ); }
+inline float4 neg( float4 v ) { return vnegq_f32( v ); }
+
+template <int i>
+inline float4 lane( float4 v ) { return vdupq_n_f32( vgetq_lane_f32( v, i ) ); }
+
+inline void transpose( float4& r0, float4& r1, float4& r2, float4& r3 )
+{
+    float32x4x2_t t01 = vtrnq_f32( r0, r1 );  // (x0 x1 z0 z1) (y0 y1 w0 w1)
+    float32x4x2_t t23 = vtrnq_f32( r2, r3 );
+    r0 = vcombine_f32( vget_low_f32( t01.val[0] ), vget_low_f32( t23.val[0] ) );
+    r1 = vcombine_f32( vget_low_f32( t01.val[1] ), vget_low_f32( t23.val[1] ) );
+    r2 = vcombine_f32( vget_high_f32( t01.val[0] ), vget_high_f32( t23.val[0] ) );
+    r3 = vcombine_f32( vget_high_f32( t01.val[1] ), vget_high_f32( t23.val[1] ) );
+}
+#endif
+
+// Row r times the matrix with rows b0 to b3, summed from zero in the order
+// of the plain mat4 product
+inline float4 rowTimes( float4 r, float4 b0, float4 b1, float4 b2, float4 b3 )
+{
+    float4 p = zero();
+    p = add( p, mul( lane<0>( r ), b0 ) );
+    p = add( p, mul( lane<1>( r ), b1 ) );
+    p = add( p, mul( lane<2>( r ), b2 ) );
+    p = add( p, mul( lane<3>( r ), b3 ) );
+    return p;
+}
+
+}  // namespace simd
+#endif // ANGEL_SIMD
+
 //////////////////////////////////////////////////////////////////////////////
 //
 //  vec2.h - 2D vector
@@ -303,7 +393,7 @@ vec3 cross(const vec3& a, const vec3& b )
 //
 //////////////////////////////////////////////////////////////////////////////
 
-struct vec4 {
+struct alignas(16) vec4 {
 
     GLfloat  x;
     GLfloat  y;
@@ -322,7 +412,13 @@ struct vec4 {
 
     vec4( const vec4& v ) { x = v.x;  y = v.y;  z = v.z;  w = v.w; }
 
-    vec4( const vec3& v, const float s = 1.0 ) : w(w)
+#ifdef ANGEL_SIMD
+    explicit vec4( simd::float4 v ) { simd::store( &x, v ); }
+
+    simd::float4 simd() const { return simd::load( &x ); }
+#endif
+
+    vec4( const vec3& v, const float s = 1.0 ) : w(s)
 	{ x = v.x;  y = v.y;  z = v.z; }
 
     vec4( const vec2& v, const float z, const float w ) : z(z), w(w)
@@ -339,9 +435,24 @@ struct vec4 {
     //  --- (non-modifying) Arithematic Operators ---
     //
 
+#ifdef ANGEL_SIMD
+    vec4 operator - () const  // unary minus operator
+	{ return vec4( simd::neg( simd() ) ); }
+#else
     vec4 operator - () const  // unary minus operator
 	{ return vec4( -x, -y, -z, -w ); }
+#endif
 
+#ifdef ANGEL_SIMD
+    vec4 operator + ( const vec4& v ) const
+	{ return vec4( simd::add( simd(), v.simd() ) ); }
+
+    vec4 operator - ( const vec4& v ) const
+	{ return vec4( simd::sub( simd(), v.simd() ) ); }
+
+    vec4 operator * ( const GLfloat s ) const
+	{ return vec4( simd::mul( simd::splat( s ), simd() ) ); }
+#else
     vec4 operator + ( const vec4& v ) const
 	{ return vec4( x + v.x, y + v.y, z + v.z, w + v.w ); }
 
@@ -350,6 +461,7 @@ struct vec4 {
 
     vec4 operator * ( const GLfloat s ) const
 	{ return vec4( s*x, s*y, s*z, s*w ); }
+#endif
 
     vec4 operator * ( const vec4& v ) const
 	{ return vec4( x*v.x, y*v.y, z*v.z, w*v.z ); }
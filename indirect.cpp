@@ -0,0 +1,273 @@
+#include "Angel.h"
+#include "indirect.h"
+#include "mesh.h"
+#include "glstate.h"
+#include "transforms.h"
+#include "stats.h"
+#include "ring.h"
+#include "registry.h"
+#include "arena.h"
+#include "world.h"
+#include <unordered_map>
+#include <vector>
+
+extern GLuint program;
+
+// Layout of a command consumed by glMultiDrawElementsIndirect
+struct DrawCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// std430 layout of DrawRecord in vindirect.glsl; the model matrix is stored
+// column-major, as GLSL reads it
+struct DrawRecord
+{
+    mat4 model;
+    vec4 positionScale;
+    vec4 positionOffset;
+    GLint material[4];
+};
+
+// Where the mesh of a record lives in the shared buffers
+struct MeshRange
+{
+    GLuint count;
+    GLuint firstIndex;
+    GLint baseVertex;
+};
+
+static bool created = false;
+static GLuint indirectProgram = 0;
+static GLuint indirectVao = 0;
+static GLuint sharedVertices = 0, sharedIndices = 0;
+static GLuint recordBuffer = 0, recordIndexBuffer = 0;
+static GLuint commandBuffer = 0;
+static GLuint recordMeshBuffer = 0;
+static std::vector<MeshRange> recordMeshes;
+static std::unordered_map<MeshHandle, MeshRange> placedMeshes; // Range of each registered mesh
+static std::vector<DrawCommand> commands;
+static std::vector<GLint> lightStates;
+
+bool isIndirectSupported()
+{
+    return glewIsSupported("GL_VERSION_4_3");
+}
+
+// Append the levels of an object, finest first, to the shared buffers, one
+// record each; returns the first record
+static int addLevels(const MeshHandle *levels, int levelCount, const mat4 &model, std::vector<unsigned char> &vertices,
+                     std::vector<GLuint> &indices, std::vector<DrawRecord> &records, int lampSlot, int trafficLight)
+{
+    int stride = getVertexLayout(vertexFormat).stride;
+    int first = records.size();
+
+    for (int level = 0; level < levelCount; ++level)
+    {
+        MeshHandle handle = levels[level];
+
+        // Objects sharing a registered mesh share its range; the contents
+        // come from the arena, the CPU copies are gone
+        auto placed = placedMeshes.find(handle);
+        if (placed == placedMeshes.end())
+        {
+            std::vector<unsigned char> meshVertices;
+            std::vector<GLuint> meshIndices;
+            readMesh(handle, meshVertices, meshIndices);
+
+            MeshRange range;
+            range.count = meshIndices.size();
+            range.firstIndex = indices.size();
+            range.baseVertex = vertices.size() / stride;
+            vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+            indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+            placed = placedMeshes.insert(std::make_pair(handle, range)).first;
+        }
+        recordMeshes.push_back(placed->second);
+
+        DrawRecord record;
+        record.model = transpose(model);
+        record.positionScale = vec4(meshes[handle].positionScale, 0.0);
+        record.positionOffset = vec4(meshes[handle].positionOffset, 0.0);
+        record.material[0] = lampSlot;
+        record.material[1] = trafficLight;
+        record.material[2] = record.material[3] = 0;
+        records.push_back(record);
+    }
+    return first;
+}
+
+static void addObject(Object &obj, std::vector<unsigned char> &vertices, std::vector<GLuint> &indices,
+                      std::vector<DrawRecord> &records, int lampSlot, int trafficLight)
+{
+    std::vector<MeshHandle> levels(1, obj.mesh);
+    for (const auto &lod : obj.lods)
+        levels.push_back(lod.mesh);
+    obj.drawRecord = addLevels(&levels[0], levels.size(), obj.modelMatrix, vertices, indices, records, lampSlot,
+                               trafficLight);
+}
+
+void createIndirectScene()
+{
+    if (created)
+        return;
+    created = true;
+
+    std::vector<unsigned char> vertices;
+    std::vector<GLuint> indices;
+    std::vector<DrawRecord> records;
+    flushArena(); // Meshes are read back from their blocks
+
+    addObject(ground, vertices, indices, records, -1, 0);
+    addObject(roads, vertices, indices, records, -1, 0);
+    for (size_t i = 0; i < buildings.size(); ++i)
+    {
+        buildings.drawRecords[i] = addLevels(&buildings.levelMeshes[i * BuildingLevels], BuildingLevels,
+                                             buildings.modelMatrices[i], vertices, indices, records, -1, 0);
+    }
+    for (size_t i = 0; i < trafficLights.size(); ++i)
+    {
+        TrafficLight &tl = trafficLights[i];
+        addObject(tl.base, vertices, indices, records, -1, i);
+        addObject(tl.lightBox, vertices, indices, records, -1, i);
+        addObject(tl.connectorPole, vertices, indices, records, -1, i);
+        for (int k = 0; k < 3; ++k)
+            addObject(tl.lights[k], vertices, indices, records, k, i);
+    }
+    vertexBufferBytes += vertices.size();
+
+    indirectProgram = InitShader("vindirect.glsl", "fshader.glsl");
+    bindTransforms(indirectProgram);
+
+    glGenVertexArrays(1, &indirectVao);
+    glBindVertexArray(indirectVao);
+
+    glGenBuffers(1, &sharedVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, sharedVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &sharedIndices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+    frameStats.bytesUploaded += vertices.size() + indices.size() * sizeof(GLuint);
+
+    const VertexLayout &layout = getVertexLayout(vertexFormat);
+    GLuint position = glGetAttribLocation(indirectProgram, "vPosition");
+    glEnableVertexAttribArray(position);
+    glVertexAttribPointer(position, 4, layout.positionType, layout.positionNormalized, layout.stride, BUFFER_OFFSET(0));
+    GLuint color = glGetAttribLocation(indirectProgram, "vColor");
+    glEnableVertexAttribArray(color);
+    glVertexAttribPointer(color, 4, layout.colorType, layout.colorNormalized, layout.stride, BUFFER_OFFSET(layout.colorOffset));
+
+    // Record indices 0, 1, 2, ..., advanced once per instance: with one
+    // instance per command, the base instance picks the record
+    std::vector<GLuint> recordIndices(records.size());
+    for (size_t i = 0; i < recordIndices.size(); ++i)
+        recordIndices[i] = i;
+    glGenBuffers(1, &recordIndexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, recordIndexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, recordIndices.size() * sizeof(GLuint), &recordIndices[0], GL_STATIC_DRAW);
+    frameStats.bytesUploaded += recordIndices.size() * sizeof(GLuint);
+    GLuint drawRecord = glGetAttribLocation(indirectProgram, "vDrawRecord");
+    glEnableVertexAttribArray(drawRecord);
+    glVertexAttribIPointer(drawRecord, 1, GL_UNSIGNED_INT, 0, BUFFER_OFFSET(0));
+    glVertexAttribDivisor(drawRecord, 1);
+
+    glGenBuffers(1, &recordBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawRecord), &records[0], GL_STATIC_DRAW);
+    frameStats.bytesUploaded += records.size() * sizeof(DrawRecord);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, recordBuffer);
+
+    lightStates.assign(trafficLights.size() + 1, 0);
+
+    // Written by GPU culling (gpucull.h); the commands recorded on the CPU go
+    // through the ring buffer
+    glGenBuffers(1, &commandBuffer);
+
+    // Mesh ranges again for GPU culling, padded to a uvec4 each
+    std::vector<GLuint> ranges;
+    for (const auto &range : recordMeshes)
+    {
+        GLuint padded[4] = {range.count, range.firstIndex, GLuint(range.baseVertex), 0};
+        ranges.insert(ranges.end(), padded, padded + 4);
+    }
+    glGenBuffers(1, &recordMeshBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, recordMeshBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ranges.size() * sizeof(GLuint), &ranges[0], GL_STATIC_DRAW);
+    frameStats.bytesUploaded += ranges.size() * sizeof(GLuint);
+
+    glUseProgram(program);
+    resetGLState();
+
+    std::cout << "Indirect scene: " << records.size() << " draw records, "
+              << vertices.size() / 1024 << " KB vertices, " << indices.size() * sizeof(GLuint) / 1024 << " KB indices" << std::endl;
+}
+
+void addIndirectDraw(int record)
+{
+    const MeshRange &range = recordMeshes[record];
+    DrawCommand command = {range.count, 1, range.firstIndex, range.baseVertex, GLuint(record)};
+    commands.push_back(command);
+}
+
+// Light states change every few seconds; a handful of bytes per frame
+static void uploadLightStates()
+{
+    for (size_t i = 0; i < trafficLights.size(); ++i)
+        lightStates[i] = trafficLights[i].state;
+    long bytes = lightStates.size() * sizeof(GLint);
+    GLintptr offset = writeRing(&lightStates[0], bytes);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, ringBuffer(), offset, bytes);
+}
+
+void submitIndirectDraws()
+{
+    if (commands.empty())
+        return;
+
+    uploadLightStates();
+    GLintptr offset = writeRing(&commands[0], commands.size() * sizeof(DrawCommand));
+
+    useProgram(indirectProgram);
+    bindVertexArray(indirectVao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ringBuffer());
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, BUFFER_OFFSET(offset), commands.size(), 0);
+    countGLCall();
+    frameStats.drawCalls++;
+
+    commands.clear();
+}
+
+GLuint indirectRecordMeshBuffer()
+{
+    return recordMeshBuffer;
+}
+
+GLuint indirectCommandBuffer()
+{
+    return commandBuffer;
+}
+
+void drawIndirectCommands(GLuint countBuffer, int maxDraws)
+{
+    uploadLightStates();
+
+    useProgram(indirectProgram);
+    bindVertexArray(indirectVao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if (countBuffer != 0)
+    {
+        glBindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+        glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, BUFFER_OFFSET(0), 0, maxDraws, 0);
+    }
+    else
+    {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, BUFFER_OFFSET(0), maxDraws, 0);
+    }
+    countGLCall();
+    frameStats.drawCalls++;
+}
@@ -0,0 +1,40 @@
+#ifndef INDIRECT_H
+#define INDIRECT_H
+
+#include "Angel.h"
+#include "objects.h"
+
+// Indirect mode: every static mesh (ground, roads, buildings and their
+// levels, traffic lights) is suballocated into one shared vertex buffer and
+// one index buffer behind a single vertex array. Each mesh of each object
+// has a draw record (world matrix, dequantization, material) in a shader
+// storage buffer; a draw command's base instance is its record, read in the
+// shader through an instanced attribute. The frame's static draws go out as
+// one glMultiDrawElementsIndirect. Needs OpenGL 4.3.
+
+// True if the GL can run indirect mode
+bool isIndirectSupported();
+
+// Build the shared buffers and draw records of everything static; uses the
+// levels of detail, so it runs after they are generated
+void createIndirectScene();
+
+// Add a command for one draw record (Object::drawRecord + level)
+void addIndirectDraw(int record);
+
+// Issue the commands added this frame in one call, then clear them
+void submitIndirectDraws();
+
+// For GPU culling (gpucull.h), which writes the commands itself: the mesh
+// of every record as a uvec4 (index count, first index, base vertex, unused)
+// in a shader storage buffer, and the command buffer it fills (commands
+// added on the CPU go through the ring buffer instead)
+GLuint indirectRecordMeshBuffer();
+GLuint indirectCommandBuffer();
+
+// Draw the first maxDraws commands already in the command buffer; with a
+// countBuffer the number drawn is read from its first word
+// (ARB_indirect_parameters), otherwise unused commands must be zero
+void drawIndirectCommands(GLuint countBuffer, int maxDraws);
+
+#endif
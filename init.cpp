@@ -4,12 +4,25 @@
 #include "display.h"
 #include "globals.h"
 #include "input.h"
+#include "mesh.h"
+#include "pvs.h"
+#include "simplify.h"
+#include "impostor.h"
+#include "transforms.h"
+#include "ring.h"
+#include "arena.h"
+#include "registry.h"
+#include "props.h"
+#include "world.h"
 
 // External variables from other files
 extern GLuint program;
 extern GLuint vPosition, vColor;
+extern GLuint vInstance, vInstanceColor;
 extern mat4 projection;
-extern GLuint ModelView, Projection;
+extern GLuint Model, ModelIndex, Instanced, InstancedProps;
+extern GLuint LightState, LampSlot;
+extern GLuint PositionScale, PositionOffset;
 
 // Function prototypes for object creation
 void createCar();
@@ -17,6 +30,7 @@ void createBuildings();
 void createGround();
 void createRoads();
 void createTrafficLights();
+void createBuildingObjects();
 
 void init()
 {
@@ -24,9 +38,17 @@ void init()
     program = InitShader("vshader.glsl", "fshader.glsl");
     glUseProgram(program);
 
+    // Ring buffer of per-frame data, which holds the camera block, and the
+    // static matrix buffer, filled as objects are created
+    createRing();
+    createTransforms();
+    bindTransforms(program);
+
     // Get attribute locations
     vPosition = glGetAttribLocation(program, "vPosition");
     vColor = glGetAttribLocation(program, "vColor");
+    vInstance = glGetAttribLocation(program, "vInstance");
+    vInstanceColor = glGetAttribLocation(program, "vInstanceColor");
 
     // Create objects
     createCar();
@@ -35,6 +57,38 @@ void init()
     createRoads();
     createTrafficLights();
 
+    // Per-building objects and the static batch are only built when needed
+    if (staticRenderMode != RENDER_INSTANCED)
+        createBuildingObjects();
+
+    // Generated levels of detail for the meshes without hand-made ones
+    std::vector<Object *> lodCandidates = {&carBody, &carWheel, &ground, &roads};
+    for (auto &tl : trafficLights)
+    {
+        lodCandidates.push_back(&tl.base);
+        lodCandidates.push_back(&tl.lightBox);
+        lodCandidates.push_back(&tl.connectorPole);
+    }
+    generateLods(lodCandidates);
+
+    // Every light carries a copy of the parts' geometry, read by nothing
+    // after this; indirect mode reads the meshes back from the arena
+    for (auto &tl : trafficLights)
+    {
+        releaseGeometry(tl.base);
+        releaseGeometry(tl.lightBox);
+        releaseGeometry(tl.connectorPole);
+        for (int k = 0; k < 3; ++k)
+            releaseGeometry(tl.lights[k]);
+    }
+
+    if (meshReport)
+        printMeshReport();
+
+    // Visible sets per road cell, from the cache file when it matches
+    if (pvsCulling)
+        buildPVS();
+
     // Enable depth testing
     glEnable(GL_DEPTH_TEST);
 
@@ -42,12 +96,36 @@ void init()
     glClearColor(0.5, 0.8, 0.92, 1.0); // Sky blue
 
     // Get uniform locations
-    ModelView = glGetUniformLocation(program, "uModelView");
-    Projection = glGetUniformLocation(program, "uProjection");
+    Model = glGetUniformLocation(program, "uModel");
+    ModelIndex = glGetUniformLocation(program, "uModelIndex");
+    Instanced = glGetUniformLocation(program, "uInstanced");
+    InstancedProps = glGetUniformLocation(program, "uInstancedProps");
+    LightState = glGetUniformLocation(program, "uLightState");
+    LampSlot = glGetUniformLocation(program, "uLampSlot");
+    PositionScale = glGetUniformLocation(program, "uPositionScale");
+    PositionOffset = glGetUniformLocation(program, "uPositionOffset");
 
-    // Set up projection matrix
+    // Only traffic light lamps set a slot
+    glUniform1i(LampSlot, -1);
+
+    // Set up projection matrix; display() uploads it with the view
     projection = Perspective(45.0, 800.0 / 600.0, 0.1, 1000.0);
-    glUniformMatrix4fv(Projection, 1, GL_TRUE, projection);
+
+    // Snapshots of far buildings; uses the uniforms above
+    createImpostors();
+
+    // One instanced draw per traffic light part
+    createProps();
+
+    // The shared buffers of indirect mode hold the levels generated above
+    if (staticRenderMode == RENDER_INDIRECT)
+        setStaticRenderMode(RENDER_INDIRECT);
+
+    // All static geometry reaches its arena blocks in one go
+    flushArena();
+    printRegistryStats();
+    printArenaStats();
+    printWorldStats();
 
     // Initialize camera position
     updateCamera();
@@ -3,6 +3,15 @@
 #include "globals.h"
 #include "objects.h"
 #include "display.h"
+#include "culling.h"
+#include "spatial.h"
+#include "occlusion.h"
+#include "pvs.h"
+#include "lod.h"
+#include "impostor.h"
+#include "overdraw.h"
+#include "gpucull.h"
+#include "props.h"
 
 // External variables from other files
 extern int viewMode;
@@ -13,7 +22,6 @@ extern vec4 eye;
 extern vec4 at;
 extern vec4 up;
 extern mat4 projection;
-extern GLuint Projection;
 
 // Movement variables
 bool movingForward = false;
@@ -35,10 +43,122 @@ void keyboard(unsigned char key, int x, int y)
     case 'Q':
         exit(EXIT_SUCCESS);
         break;
+    case 'b':
+    case 'B':
+    {
+        // Cycle per-object -> batched -> instanced -> indirect
+        static const char *modeNames[] = {"per-object", "batched", "instanced", "indirect"};
+        StaticRenderMode mode = StaticRenderMode((staticRenderMode + 1) % 4);
+        setStaticRenderMode(mode);
+        std::cout << "Static city rendering: " << modeNames[staticRenderMode] << std::endl;
+        break;
+    }
+    case 'c':
+    case 'C':
+        frustumCulling = !frustumCulling;
+        std::cout << "Frustum culling " << (frustumCulling ? "on" : "off") << std::endl;
+        break;
+    case 'h':
+    case 'H':
+        spatialCulling = !spatialCulling;
+        std::cout << "Spatial index culling " << (spatialCulling ? "on" : "off") << std::endl;
+        break;
+    case 'p':
+    case 'P':
+        // The sets are loaded or built in the background on first use, and
+        // used once ready
+        pvsCulling = !pvsCulling;
+        if (pvsCulling)
+            startPVSBuild();
+        std::cout << "PVS culling " << (pvsCulling ? "on" : "off")
+                  << (pvsCulling && !isPVSReady() ? ", once the sets are built" : "") << std::endl;
+        break;
+    case 'o':
+    case 'O':
+    {
+        // Cycle off -> software -> queries
+        static const char *occlusionNames[] = {"off", "software", "hardware queries"};
+        occlusionMode = OcclusionMode((occlusionMode + 1) % 3);
+        std::cout << "Occlusion culling: " << occlusionNames[occlusionMode] << std::endl;
+        break;
+    }
+    case 'l':
+    case 'L':
+        lodEnabled = !lodEnabled;
+        std::cout << "Level of detail " << (lodEnabled ? "on" : "off") << std::endl;
+        break;
+    case 'i':
+    case 'I':
+        impostorsEnabled = !impostorsEnabled;
+        std::cout << "Impostors " << (impostorsEnabled ? "on" : "off") << std::endl;
+        break;
+    case 'v':
+    case 'V':
+        overdrawMode = !overdrawMode;
+        std::cout << "Overdraw view " << (overdrawMode ? "on" : "off") << std::endl;
+        break;
+    case 'g':
+    case 'G':
+        gpuCulling = !gpuCulling;
+        std::cout << "GPU culling " << (gpuCulling ? "on" : "off")
+                  << (gpuCulling && staticRenderMode != RENDER_INDIRECT ? " (indirect mode only)" : "") << std::endl;
+        break;
+    case 'z':
+    case 'Z':
+        hizCulling = !hizCulling;
+        std::cout << "Hi-Z occlusion culling " << (hizCulling ? "on" : "off") << std::endl;
+        break;
+    case 'k':
+    case 'K':
+        instancedProps = !instancedProps;
+        std::cout << "Instanced props " << (instancedProps ? "on" : "off") << std::endl;
+        break;
+    case '[':
+    case ']':
+        // Lower bias switches to coarser meshes closer to the camera
+        lodBias *= (key == ']') ? 1.25f : 0.8f;
+        std::cout << "LOD bias " << lodBias << std::endl;
+        break;
     }
     glutPostRedisplay();
 }
 
+// Pick the building under the cursor with a ray through the spatial index
+void mouse(int button, int state, int x, int y)
+{
+    if (button != GLUT_LEFT_BUTTON || state != GLUT_DOWN)
+        return;
+
+    int width = glutGet(GLUT_WINDOW_WIDTH);
+    int height = glutGet(GLUT_WINDOW_HEIGHT);
+    if (width <= 0 || height <= 0)
+        return;
+
+    // Camera basis, as built by LookAt
+    vec3 eyePosition(eye.x, eye.y, eye.z);
+    vec3 forward = normalize(vec3(at.x, at.y, at.z) - eyePosition);
+    vec3 right = normalize(cross(forward, vec3(up.x, up.y, up.z)));
+    vec3 cameraUp = cross(right, forward);
+
+    // Same field of view as the projection set in reshape()
+    float tanHalfFovy = std::tan(45.0f * DegreesToRadians * 0.5f);
+    float ndcX = 2.0f * (x + 0.5f) / width - 1.0f;
+    float ndcY = 1.0f - 2.0f * (y + 0.5f) / height;
+    vec3 direction = normalize(forward + right * (ndcX * tanHalfFovy * width / height) + cameraUp * (ndcY * tanHalfFovy));
+
+    float distance;
+    int hit = raycast(cityIndex, eyePosition, direction, distance);
+    if (hit < 0)
+    {
+        std::cout << "Picked nothing" << std::endl;
+        return;
+    }
+
+    const vec4 &position = buildingInstances[hit].position;
+    std::cout << "Picked building " << hit << " at (" << position.x << ", " << position.z
+              << "), height " << position.w << ", distance " << distance << std::endl;
+}
+
 void special(int key, int x, int y)
 {
     switch (key)
@@ -97,10 +217,10 @@ void keyUpSpecial(int key, int x, int y)
 void reshape(int width, int height)
 {
     glViewport(0, 0, width, height);
+    lodScreenHeight = height;
 
     // Update projection matrix
     projection = Perspective(45.0, GLfloat(width) / height, 0.1, 1000.0);
-    glUniformMatrix4fv(Projection, 1, GL_TRUE, projection);
 }
 
 void idle()
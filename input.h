@@ -3,6 +3,7 @@
 
 void keyboard(unsigned char key, int x, int y);
 void special(int key, int x, int y);
+void mouse(int button, int state, int x, int y);
 void keyUpSpecial(int key, int x, int y);
 void reshape(int width, int height);
 void idle();
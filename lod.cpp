@@ -0,0 +1,106 @@
+#include "Angel.h"
+#include "lod.h"
+#include <algorithm>
+
+bool lodEnabled = true;
+float lodBias = 1.0f;
+int lodScreenHeight = 600;
+
+extern mat4 projection;
+extern vec4 eye;
+
+void addLod(Object &obj, const Object &coarse, float screenSize)
+{
+    obj.lods.push_back(coarse);
+    obj.lods.back().lods.clear();
+    obj.lodSizes.push_back(screenSize);
+}
+
+void addLodCutoff(Object &obj, float screenSize)
+{
+    obj.lodSizes.push_back(screenSize);
+}
+
+// Pixels covered by one unit at distance one, from the vertical field of view
+static float pixelsPerUnit()
+{
+    return 0.5f * lodScreenHeight * projection[1][1];
+}
+
+// Sphere given by its center relative to the eye
+static float sphereScreenSize(const vec3 &offset, float radius, float pixels)
+{
+    float distance = length(offset);
+    if (distance <= radius)
+        return 1e9f; // Eye inside the sphere
+    return 2.0f * radius * pixels / distance;
+}
+
+static float sphereScreenSize(const Object &obj, const mat4 &model, float pixels)
+{
+    vec3 center = (obj.boundsMin + obj.boundsMax) * 0.5f;
+    vec3 extent = (obj.boundsMax - obj.boundsMin) * 0.5f;
+
+    // Center relative to the eye, and the radius under the largest axis
+    // scale of the model matrix
+    vec3 offset;
+    float scale = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        offset[i] = model[i][0] * center.x + model[i][1] * center.y + model[i][2] * center.z + model[i][3] - eye[i];
+        scale = std::max(scale, model[0][i] * model[0][i] + model[1][i] * model[1][i] + model[2][i] * model[2][i]);
+    }
+    return sphereScreenSize(offset, length(extent) * std::sqrt(scale), pixels);
+}
+
+float lodScreenSize(const Object &obj, const mat4 &model)
+{
+    return sphereScreenSize(obj, model, pixelsPerUnit());
+}
+
+// Step from the current level towards the one the size calls for
+static int stepLevel(int level, const float *sizes, int levels, float size)
+{
+    while (level < levels && size < sizes[level] * (1.0f - LodHysteresis))
+        level++;
+    while (level > 0 && size > sizes[level - 1] * (1.0f + LodHysteresis))
+        level--;
+    return level;
+}
+
+static void updateLevel(Object &obj, float size)
+{
+    obj.lodLevel = stepLevel(obj.lodLevel, &obj.lodSizes[0], obj.lodSizes.size(), size);
+}
+
+void selectLod(Object &obj, const mat4 &model)
+{
+    if (obj.lodSizes.empty())
+        return;
+
+    if (!lodEnabled)
+    {
+        obj.lodLevel = 0;
+        return;
+    }
+    updateLevel(obj, lodBias * lodScreenSize(obj, model));
+}
+
+void selectLods(BuildingStore &store, const std::vector<int> &indices)
+{
+    if (!lodEnabled)
+    {
+        for (int index : indices)
+            store.lodLevels[index] = 0;
+        return;
+    }
+
+    // Only the world sphere and the level of each building are read
+    float pixels = lodBias * pixelsPerUnit();
+    vec3 eyePosition(eye.x, eye.y, eye.z);
+    for (int index : indices)
+    {
+        float size = sphereScreenSize(store.centers[index] - eyePosition, store.radii[index], pixels);
+        store.lodLevels[index] = stepLevel(store.lodLevels[index], store.lodSizes, BuildingLevels - 1, size);
+    }
+}
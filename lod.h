@@ -0,0 +1,51 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "Angel.h"
+#include "objects.h"
+#include "world.h"
+#include <vector>
+
+// Level of detail: an object can carry coarser meshes (Object::lods), used
+// when its bounding sphere covers few pixels on screen. Levels are chosen
+// once per frame for everything about to be drawn, and drawObject() draws
+// the chosen mesh.
+
+extern bool lodEnabled;     // Toggled with 'l'
+extern float lodBias;       // Multiplies screen sizes; above 1 keeps detail longer ('[' and ']')
+extern int lodScreenHeight; // Viewport height in pixels, set by reshape()
+
+// A level only changes once the size is this far (relative) past its
+// threshold, so objects near a threshold do not flicker between levels
+const float LodHysteresis = 0.15f;
+
+// Add an uploaded coarser mesh, drawn while obj covers fewer than
+// screenSize pixels; levels are added finest first
+void addLod(Object &obj, const Object &coarse, float screenSize);
+
+// Skip the object entirely below screenSize pixels, after its last level
+void addLodCutoff(Object &obj, float screenSize);
+
+// Projected diameter of the object's bounding sphere, in pixels, seen from
+// the eye
+float lodScreenSize(const Object &obj, const mat4 &model);
+
+// Choose the level of one object drawn with the given world matrix
+void selectLod(Object &obj, const mat4 &model);
+
+// Same, for the listed buildings of the world store
+void selectLods(BuildingStore &store, const std::vector<int> &indices);
+
+// True when the chosen level skips the object
+inline bool isLodHidden(const Object &obj)
+{
+    return obj.lodLevel > int(obj.lods.size());
+}
+
+// Mesh of the chosen level
+inline const Object &lodMesh(const Object &obj)
+{
+    return obj.lodLevel > 0 ? obj.lods[obj.lodLevel - 1] : obj;
+}
+
+#endif
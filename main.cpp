@@ -3,14 +3,223 @@
 #include "display.h"
 #include "input.h"
 #include "objects.h"
+#include "stats.h"
+#include "globals.h"
+#include "mesh.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "pvs.h"
+#include "lod.h"
+#include "simplify.h"
+#include "impostor.h"
+#include "drawlist.h"
+#include "glstate.h"
+#include "overdraw.h"
+#include "gpucull.h"
+#include "props.h"
+#include <cstring>
 
 // External variables (from other files)
 extern GLuint program;
 extern mat4 projection;
 
+// Parse command line options (GLUT removes its own options first)
+//   --bench [frames]   render each bench configuration and report stats
+//   --grid N           half-size of the city grid in blocks
+//   --buildings N      maximum number of buildings
+//   --mode M           static city mode: per-object, batched, instanced or indirect
+//   --view N           starting camera view (1-4, same as F1-F4)
+//   --no-culling       start with frustum culling disabled
+//   --no-spatial-index cull buildings one by one instead of through the quadtree
+//   --occlusion M      occlusion culling: off, software or queries
+//   --pvs              start with the per-cell visible sets enabled
+//   --pvs-file F       cache file of the visible sets (default city.pvs)
+//   --verify-pvs       check the visible sets against densely sampled eyes
+//   --no-lod           always draw the full detail meshes
+//   --lod-bias B       scale screen sizes for LOD selection (default 1)
+//   --no-lod-generation  skip the simplified levels generated at startup
+//   --lod-cache F      cache file of the generated levels (default lod.cache)
+//   --no-impostors     draw far buildings with their full geometry
+//   --impostor-distance D  distance beyond which buildings are impostors
+//   --no-draw-sorting  issue draws in submission order instead of by state
+//   --no-state-cache   issue every GL state change, even redundant ones
+//   --no-front-to-back sort draws by state only, not roughly front to back
+//   --overdraw         start in the overdraw view (also measured by --bench)
+//   --gpu-culling      indirect mode culls and selects levels in a compute shader
+//   --hiz              GPU culling also tests the previous frame's depth pyramid
+//   --verify-gpu-culling  check every GPU-culled frame against the CPU
+//   --no-instanced-props  draw each traffic light part separately
+//   --light-grid       stress scene with a traffic light at every intersection
+//   --occluders N      number of nearest buildings used as occluders
+//   --occlusion-threads N  occlusion rasterizer threads (default one per core)
+//   --mesh-report      print vertex cache statistics (ACMR) per mesh
+//   --vertex-format F  vertex buffer format: float, half or snorm16
+int benchFrames = 0;
+
+void parseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--bench") == 0)
+        {
+            benchFrames = 200;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                benchFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc)
+        {
+            gridSize = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--buildings") == 0 && i + 1 < argc)
+        {
+            maxBuildings = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            ++i;
+            if (strcmp(argv[i], "per-object") == 0)
+                staticRenderMode = RENDER_PER_OBJECT;
+            else if (strcmp(argv[i], "batched") == 0)
+                staticRenderMode = RENDER_BATCHED;
+            else if (strcmp(argv[i], "instanced") == 0)
+                staticRenderMode = RENDER_INSTANCED;
+            else if (strcmp(argv[i], "indirect") == 0)
+                staticRenderMode = RENDER_INDIRECT;
+            else
+                std::cerr << "Unknown mode: " << argv[i] << std::endl;
+        }
+        else if (strcmp(argv[i], "--view") == 0 && i + 1 < argc)
+        {
+            viewMode = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-culling") == 0)
+        {
+            frustumCulling = false;
+        }
+        else if (strcmp(argv[i], "--no-spatial-index") == 0)
+        {
+            spatialCulling = false;
+        }
+        else if (strcmp(argv[i], "--occlusion") == 0 && i + 1 < argc)
+        {
+            ++i;
+            if (strcmp(argv[i], "off") == 0)
+                occlusionMode = OCCLUSION_OFF;
+            else if (strcmp(argv[i], "software") == 0)
+                occlusionMode = OCCLUSION_SOFTWARE;
+            else if (strcmp(argv[i], "queries") == 0)
+                occlusionMode = OCCLUSION_QUERIES;
+            else
+                std::cerr << "Unknown occlusion mode: " << argv[i] << std::endl;
+        }
+        else if (strcmp(argv[i], "--pvs") == 0)
+        {
+            pvsCulling = true;
+        }
+        else if (strcmp(argv[i], "--pvs-file") == 0 && i + 1 < argc)
+        {
+            pvsFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--verify-pvs") == 0)
+        {
+            verifyPvs = true;
+        }
+        else if (strcmp(argv[i], "--no-lod") == 0)
+        {
+            lodEnabled = false;
+        }
+        else if (strcmp(argv[i], "--lod-bias") == 0 && i + 1 < argc)
+        {
+            lodBias = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-lod-generation") == 0)
+        {
+            lodGeneration = false;
+        }
+        else if (strcmp(argv[i], "--lod-cache") == 0 && i + 1 < argc)
+        {
+            lodCacheFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-impostors") == 0)
+        {
+            impostorsEnabled = false;
+        }
+        else if (strcmp(argv[i], "--impostor-distance") == 0 && i + 1 < argc)
+        {
+            impostorDistance = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-draw-sorting") == 0)
+        {
+            drawSorting = false;
+        }
+        else if (strcmp(argv[i], "--no-state-cache") == 0)
+        {
+            glStateCache = false;
+        }
+        else if (strcmp(argv[i], "--no-front-to-back") == 0)
+        {
+            frontToBack = false;
+        }
+        else if (strcmp(argv[i], "--overdraw") == 0)
+        {
+            overdrawMode = true;
+        }
+        else if (strcmp(argv[i], "--gpu-culling") == 0)
+        {
+            gpuCulling = true;
+        }
+        else if (strcmp(argv[i], "--hiz") == 0)
+        {
+            gpuCulling = true;
+            hizCulling = true;
+        }
+        else if (strcmp(argv[i], "--verify-gpu-culling") == 0)
+        {
+            verifyGpuCulling = true;
+        }
+        else if (strcmp(argv[i], "--no-instanced-props") == 0)
+        {
+            instancedProps = false;
+        }
+        else if (strcmp(argv[i], "--light-grid") == 0)
+        {
+            lightGrid = true;
+        }
+        else if (strcmp(argv[i], "--occluders") == 0 && i + 1 < argc)
+        {
+            occluderCount = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--occlusion-threads") == 0 && i + 1 < argc)
+        {
+            occlusionThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--vertex-format") == 0 && i + 1 < argc)
+        {
+            ++i;
+            if (strcmp(argv[i], "float") == 0)
+                vertexFormat = VERTEX_FLOAT;
+            else if (strcmp(argv[i], "half") == 0)
+                vertexFormat = VERTEX_HALF;
+            else if (strcmp(argv[i], "snorm16") == 0)
+                vertexFormat = VERTEX_SNORM16;
+            else
+                std::cerr << "Unknown vertex format: " << argv[i] << std::endl;
+        }
+        else if (strcmp(argv[i], "--mesh-report") == 0)
+        {
+            meshReport = true;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     glutInit(&argc, argv);
+    parseArgs(argc, argv);
     // Set up display mode: double buffering, RGBA, depth buffer
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
     glutInitWindowSize(800, 600);
@@ -21,10 +230,14 @@ int main(int argc, char **argv)
 
     init();
 
+    if (benchFrames > 0)
+        startBench(benchFrames);
+
     // Register callbacks
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
     glutSpecialFunc(special);
+    glutMouseFunc(mouse);
     glutSpecialUpFunc(keyUpSpecial); // For key release events
     glutReshapeFunc(reshape);
     glutIdleFunc(idle);
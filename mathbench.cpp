@@ -0,0 +1,180 @@
+// Microbenchmark of the vec4 and mat4 kernels of include/mat.h against the
+// plain C++ versions they replaced, which are copied below. Built with
+// "make mathbench"; prints nanoseconds per call and how many results differ
+// in any bit from the plain versions.
+
+#include "Angel.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Calls per kernel and timing, over arrays that stay in the L1 cache; the
+// best of Repeats timings is kept
+const int Count = 256;
+const int Rounds = 4000;
+const int Repeats = 7;
+
+// The plain versions, inline like the ones in the headers
+inline mat4 plainMultiply(const mat4 &a, const mat4 &b)
+{
+    mat4 c(0.0);
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            for (int k = 0; k < 4; ++k)
+                c[i][j] += a[i][k] * b[k][j];
+        }
+    }
+    return c;
+}
+
+inline vec4 plainTransform(const mat4 &m, const vec4 &v)
+{
+    return vec4(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3] * v.w,
+                m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3] * v.w,
+                m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3] * v.w,
+                m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3] * v.w);
+}
+
+inline mat4 plainTranspose(const mat4 &a)
+{
+    return mat4(a[0][0], a[1][0], a[2][0], a[3][0],
+                a[0][1], a[1][1], a[2][1], a[3][1],
+                a[0][2], a[1][2], a[2][2], a[3][2],
+                a[0][3], a[1][3], a[2][3], a[3][3]);
+}
+
+inline mat4 plainLookAt(const vec4 &eye, const vec4 &at, const vec4 &up)
+{
+    vec4 d = vec4(eye.x - at.x, eye.y - at.y, eye.z - at.z, eye.w - at.w);
+    GLfloat r = GLfloat(1.0) / length(d);
+    vec4 n = vec4(r * d.x, r * d.y, r * d.z, r * d.w);
+    vec4 u = vec4(normalize(cross(up, n)), 0.0);
+    vec4 v = vec4(normalize(cross(n, u)), 0.0);
+    vec4 t = vec4(0.0, 0.0, 0.0, 1.0);
+    return plainMultiply(mat4(u, v, n, t), Translate(-eye.x, -eye.y, -eye.z));
+}
+
+inline mat4 plainPerspective(const GLfloat fovy, const GLfloat aspect, const GLfloat zNear, const GLfloat zFar)
+{
+    GLfloat top = tan(fovy * DegreesToRadians / 2) * zNear;
+    GLfloat right = top * aspect;
+
+    mat4 c;
+    c[0][0] = zNear / right;
+    c[1][1] = zNear / top;
+    c[2][2] = -(zFar + zNear) / (zFar - zNear);
+    c[2][3] = -2.0 * zFar * zNear / (zFar - zNear);
+    c[3][2] = -1.0;
+    c[3][3] = 0.0;
+    return c;
+}
+
+static float randomFloat()
+{
+    return 2.0f * rand() / RAND_MAX - 1.0f;
+}
+
+static vec4 randomVec4()
+{
+    return vec4(randomFloat(), randomFloat(), randomFloat(), randomFloat());
+}
+
+static mat4 randomMat4()
+{
+    return mat4(randomVec4(), randomVec4(), randomVec4(), randomVec4());
+}
+
+// Floats of two results that differ in any bit
+static int differences(const GLfloat *a, const GLfloat *b, int count)
+{
+    int different = 0;
+    for (int i = 0; i < count; ++i)
+        different += memcmp(&a[i], &b[i], sizeof(GLfloat)) != 0;
+    return different;
+}
+
+// Time Rounds passes of kernel over the inputs, after one untimed pass to
+// warm the caches and the clock; kernel writes output i
+template <typename Kernel>
+static double nanosecondsPerCall(Kernel kernel)
+{
+    for (int i = 0; i < Count; ++i)
+        kernel(i);
+
+    double best = 0.0;
+    for (int repeat = 0; repeat < Repeats; ++repeat)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < Rounds; ++round)
+        {
+            for (int i = 0; i < Count; ++i)
+                kernel(i);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (repeat == 0 || seconds < best)
+            best = seconds;
+    }
+    return 1e9 * best / (double(Rounds) * Count);
+}
+
+static void report(const char *name, double plain, double simd, int different, int total)
+{
+    printf("%-12s %8.2f ns plain  %8.2f ns  %5.2fx  %d of %d floats differ\n",
+           name, plain, simd, plain / simd, different, total);
+}
+
+int main()
+{
+#if defined(ANGEL_AVX)
+    printf("Kernels: SSE, AVX for mat4 products\n");
+#elif defined(ANGEL_SSE)
+    printf("Kernels: SSE\n");
+#elif defined(ANGEL_NEON)
+    printf("Kernels: NEON\n");
+#else
+    printf("Kernels: plain C++ (ANGEL_NO_SIMD or no SIMD target)\n");
+#endif
+
+    std::vector<mat4> a(Count), b(Count), plainMatrices(Count), simdMatrices(Count);
+    std::vector<vec4> v(Count), plainVectors(Count), simdVectors(Count);
+    srand(1);
+    for (int i = 0; i < Count; ++i)
+    {
+        a[i] = randomMat4();
+        b[i] = randomMat4();
+        v[i] = randomVec4();
+    }
+
+    // mat4 * mat4, as in Translate * RotateY * Scale
+    double plain = nanosecondsPerCall([&](int i) { plainMatrices[i] = plainMultiply(a[i], b[i]); });
+    double simd = nanosecondsPerCall([&](int i) { simdMatrices[i] = a[i] * b[i]; });
+    report("mat4 * mat4", plain, simd, differences(plainMatrices[0], simdMatrices[0], 16 * Count), 16 * Count);
+
+    // mat4 * vec4, as in the world boxes and the occlusion rasterizer
+    plain = nanosecondsPerCall([&](int i) { plainVectors[i] = plainTransform(a[i], v[i]); });
+    simd = nanosecondsPerCall([&](int i) { simdVectors[i] = a[i] * v[i]; });
+    report("mat4 * vec4", plain, simd, differences(plainVectors[0], simdVectors[0], 4 * Count), 4 * Count);
+
+    plain = nanosecondsPerCall([&](int i) { plainMatrices[i] = plainTranspose(a[i]); });
+    simd = nanosecondsPerCall([&](int i) { simdMatrices[i] = transpose(a[i]); });
+    report("transpose", plain, simd, differences(plainMatrices[0], simdMatrices[0], 16 * Count), 16 * Count);
+
+    // Eyes from the random vectors, w = 1 like the camera's, each looking at
+    // the next
+    std::vector<vec4> eyes(Count + 1);
+    for (int i = 0; i <= Count; ++i)
+        eyes[i] = vec4(v[i % Count].x * 50.0f, v[i % Count].y * 50.0f, v[i % Count].z * 50.0f, 1.0);
+    vec4 up(0.0, 1.0, 0.0, 0.0);
+    plain = nanosecondsPerCall([&](int i) { plainMatrices[i] = plainLookAt(eyes[i], eyes[i + 1], up); });
+    simd = nanosecondsPerCall([&](int i) { simdMatrices[i] = LookAt(eyes[i], eyes[i + 1], up); });
+    report("LookAt", plain, simd, differences(plainMatrices[0], simdMatrices[0], 16 * Count), 16 * Count);
+
+    plain = nanosecondsPerCall([&](int i) { plainMatrices[i] = plainPerspective(30.0f + v[i].x, 1.5f, 0.1f, 1000.0f); });
+    simd = nanosecondsPerCall([&](int i) { simdMatrices[i] = Perspective(30.0f + v[i].x, 1.5f, 0.1f, 1000.0f); });
+    report("Perspective", plain, simd, differences(plainMatrices[0], simdMatrices[0], 16 * Count), 16 * Count);
+
+    return EXIT_SUCCESS;
+}
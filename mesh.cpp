@@ -0,0 +1,583 @@
+#include "Angel.h"
+#include "mesh.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+bool meshReport = false;
+VertexFormat vertexFormat = VERTEX_SNORM16;
+long vertexBufferBytes = 0;
+
+// Accumulated statistics for every mesh built under the same name
+struct MeshStats
+{
+    std::string name;
+    int meshes;
+    long flatVertices;   // Vertices before welding (one per triangle corner)
+    long uniqueVertices; // Vertices after welding
+    long triangles;
+    double acmrIndexed;   // Welded, original triangle order
+    double acmrOptimized; // After the cache and overdraw passes
+};
+
+static std::vector<MeshStats> meshStats;
+
+//----------------------------------------------------------------------------
+//
+//  Welding
+//
+
+// A vertex is unique by its exact position and color bits
+struct VertexKey
+{
+    point4 point;
+    color4 color;
+
+    bool operator==(const VertexKey &other) const
+    {
+        return memcmp(this, &other, sizeof(VertexKey)) == 0;
+    }
+};
+
+struct VertexKeyHash
+{
+    size_t operator()(const VertexKey &key) const
+    {
+        // FNV-1a over the raw bytes
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&key);
+        size_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(VertexKey); ++i)
+        {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+};
+
+void weldVertices(Object &obj)
+{
+    std::unordered_map<VertexKey, GLuint, VertexKeyHash> lookup;
+    std::vector<point4> points;
+    std::vector<color4> colors;
+
+    obj.indices.resize(obj.points.size());
+    for (size_t i = 0; i < obj.points.size(); ++i)
+    {
+        VertexKey key;
+        key.point = obj.points[i];
+        key.color = obj.colors[i];
+
+        auto found = lookup.find(key);
+        if (found == lookup.end())
+        {
+            found = lookup.insert(std::make_pair(key, GLuint(points.size()))).first;
+            points.push_back(obj.points[i]);
+            colors.push_back(obj.colors[i]);
+        }
+        obj.indices[i] = found->second;
+    }
+
+    obj.points.swap(points);
+    obj.colors.swap(colors);
+}
+
+//----------------------------------------------------------------------------
+//
+//  Cache simulation
+//
+
+// Simulated FIFO cache: a vertex is a hit while fewer than cacheSize misses
+// happened since it was loaded. Returns the number of misses for one vertex.
+static int touchVertex(GLuint v, std::vector<unsigned> &timeStamps, unsigned &time, int cacheSize)
+{
+    if (time - timeStamps[v] > unsigned(cacheSize))
+    {
+        timeStamps[v] = time++;
+        return 1;
+    }
+    return 0;
+}
+
+float computeACMR(const std::vector<GLuint> &indices, int numVertices, int cacheSize)
+{
+    if (indices.empty())
+        return 0.0f;
+
+    std::vector<unsigned> timeStamps(numVertices, 0);
+    unsigned time = cacheSize + 1;
+    int misses = 0;
+
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        misses += touchVertex(indices[i], timeStamps, time, cacheSize);
+    }
+
+    return float(misses) / (indices.size() / 3);
+}
+
+//----------------------------------------------------------------------------
+//
+//  Vertex cache optimization (Tipsify, Sander et al. 2007)
+//
+//  Triangles are emitted as fans around a vertex; the next fan vertex is a
+//  recently used one that will still be in the cache. When the walk runs
+//  out of candidates a new cluster starts, which the overdraw pass reorders.
+//
+
+// Returns a vertex with remaining triangles after a dead end, or -1 when done
+static int skipDeadEnd(const std::vector<int> &live, std::vector<GLuint> &deadEnds, int &cursor)
+{
+    // Recently emitted vertices are likely still in the cache
+    while (!deadEnds.empty())
+    {
+        GLuint v = deadEnds.back();
+        deadEnds.pop_back();
+        if (live[v] > 0)
+            return v;
+    }
+
+    // Otherwise scan forward in input order
+    while (cursor < int(live.size()))
+    {
+        if (live[cursor] > 0)
+            return cursor;
+        ++cursor;
+    }
+
+    return -1;
+}
+
+void optimizeVertexCache(std::vector<GLuint> &indices, int numVertices, std::vector<int> &clusters)
+{
+    clusters.clear();
+    int numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return;
+
+    // Vertex -> triangle adjacency in one flat array
+    std::vector<int> live(numVertices, 0);
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        live[indices[i]]++;
+    }
+
+    std::vector<int> offsets(numVertices + 1, 0);
+    for (int v = 0; v < numVertices; ++v)
+    {
+        offsets[v + 1] = offsets[v] + live[v];
+    }
+
+    std::vector<int> adjacency(indices.size());
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int t = 0; t < numTriangles; ++t)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            adjacency[fill[indices[3 * t + c]]++] = t;
+        }
+    }
+
+    std::vector<unsigned> timeStamps(numVertices, 0);
+    std::vector<char> emitted(numTriangles, 0);
+    std::vector<GLuint> deadEnds;
+    std::vector<GLuint> candidates;
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+
+    unsigned time = VertexCacheSize + 1;
+    int cursor = 0;
+    int fan = indices[0];
+
+    clusters.push_back(0);
+    while (fan >= 0)
+    {
+        // Emit every remaining triangle around the fan vertex
+        candidates.clear();
+        for (int a = offsets[fan]; a < offsets[fan + 1]; ++a)
+        {
+            int t = adjacency[a];
+            if (emitted[t])
+                continue;
+
+            for (int c = 0; c < 3; ++c)
+            {
+                GLuint v = indices[3 * t + c];
+                result.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                touchVertex(v, timeStamps, time, VertexCacheSize);
+            }
+            emitted[t] = 1;
+        }
+
+        // Pick the candidate that stays in the cache the longest
+        int next = -1;
+        int bestPriority = -1;
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            GLuint v = candidates[i];
+            if (live[v] <= 0)
+                continue;
+
+            int priority = 0;
+            int age = time - timeStamps[v];
+            if (age + 2 * live[v] <= VertexCacheSize)
+                priority = age;
+
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+
+        if (next < 0)
+        {
+            next = skipDeadEnd(live, deadEnds, cursor);
+            if (next >= 0)
+                clusters.push_back(result.size() / 3);
+        }
+        fan = next;
+    }
+
+    indices.swap(result);
+}
+
+//----------------------------------------------------------------------------
+//
+//  Overdraw optimization
+//
+//  Clusters are split further wherever the running ACMR is already good,
+//  then sorted so that outward-facing clusters far from the mesh center
+//  draw first and occlude the rest (Sander et al. 2007).
+//
+
+// Split hard clusters at soft boundaries that keep ACMR within threshold
+static void splitClusters(const std::vector<GLuint> &indices, int numVertices,
+                          const std::vector<int> &clusters, float threshold,
+                          std::vector<int> &result)
+{
+    int numTriangles = indices.size() / 3;
+    std::vector<unsigned> timeStamps(numVertices, 0);
+    unsigned time = 0;
+
+    result.clear();
+    for (int c = 0; c < int(clusters.size()); ++c)
+    {
+        int start = clusters[c];
+        int end = (c + 1 < int(clusters.size())) ? clusters[c + 1] : numTriangles;
+
+        // ACMR of the whole cluster
+        time += VertexCacheSize + 1;
+        int clusterMisses = 0;
+        for (int t = start; t < end; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+                clusterMisses += touchVertex(indices[3 * t + k], timeStamps, time, VertexCacheSize);
+        }
+        float clusterThreshold = threshold * float(clusterMisses) / (end - start);
+
+        result.push_back(start);
+
+        // Start a new cluster whenever the running ACMR is good enough
+        time += VertexCacheSize + 1;
+        int runningMisses = 0;
+        int runningTriangles = 0;
+        for (int t = start; t < end; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+                runningMisses += touchVertex(indices[3 * t + k], timeStamps, time, VertexCacheSize);
+            runningTriangles++;
+
+            if (float(runningMisses) / runningTriangles <= clusterThreshold)
+            {
+                result.push_back(t + 1);
+                time += VertexCacheSize + 1;
+                runningMisses = 0;
+                runningTriangles = 0;
+            }
+        }
+
+        // The tail after the last split is usually poor, merge it back
+        if (result.back() != start)
+            result.pop_back();
+    }
+}
+
+void optimizeOverdraw(std::vector<GLuint> &indices, const std::vector<point4> &points,
+                      const std::vector<int> &clusters, float threshold)
+{
+    int numTriangles = indices.size() / 3;
+    if (numTriangles == 0 || clusters.empty())
+        return;
+
+    std::vector<int> softClusters;
+    splitClusters(indices, points.size(), clusters, threshold, softClusters);
+    if (softClusters.size() < 2)
+        return;
+
+    // Mesh centroid
+    vec3 meshCenter(0.0, 0.0, 0.0);
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        meshCenter += vec3(points[i].x, points[i].y, points[i].z);
+    }
+    meshCenter /= float(points.size());
+
+    // Sort key per cluster: how far its area-weighted center lies along its normal
+    std::vector<std::pair<float, int>> order(softClusters.size());
+    for (int c = 0; c < int(softClusters.size()); ++c)
+    {
+        int start = softClusters[c];
+        int end = (c + 1 < int(softClusters.size())) ? softClusters[c + 1] : numTriangles;
+
+        vec3 center(0.0, 0.0, 0.0);
+        vec3 normal(0.0, 0.0, 0.0);
+        float area = 0.0f;
+        for (int t = start; t < end; ++t)
+        {
+            vec3 p0(points[indices[3 * t]].x, points[indices[3 * t]].y, points[indices[3 * t]].z);
+            vec3 p1(points[indices[3 * t + 1]].x, points[indices[3 * t + 1]].y, points[indices[3 * t + 1]].z);
+            vec3 p2(points[indices[3 * t + 2]].x, points[indices[3 * t + 2]].y, points[indices[3 * t + 2]].z);
+
+            vec3 n = cross(p1 - p0, p2 - p0);
+            float a = length(n);
+            center += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+
+        float key = 0.0f;
+        float normalLength = length(normal);
+        if (area > 0.0f && normalLength > 0.0f)
+            key = dot(center / area - meshCenter, normal / normalLength);
+
+        order[c] = std::make_pair(-key, int(c)); // Largest key first
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        int c = order[i].second;
+        int start = softClusters[c];
+        int end = (c + 1 < int(softClusters.size())) ? softClusters[c + 1] : numTriangles;
+        result.insert(result.end(), indices.begin() + 3 * start, indices.begin() + 3 * end);
+    }
+
+    indices.swap(result);
+}
+
+//----------------------------------------------------------------------------
+//
+//  Vertex fetch optimization: store vertices in the order they are first used
+//
+
+void optimizeVertexFetch(Object &obj)
+{
+    std::vector<int> remap(obj.points.size(), -1);
+    std::vector<point4> points;
+    std::vector<color4> colors;
+    points.reserve(obj.points.size());
+    colors.reserve(obj.colors.size());
+
+    for (size_t i = 0; i < obj.indices.size(); ++i)
+    {
+        GLuint v = obj.indices[i];
+        if (remap[v] < 0)
+        {
+            remap[v] = points.size();
+            points.push_back(obj.points[v]);
+            colors.push_back(obj.colors[v]);
+        }
+        obj.indices[i] = remap[v];
+    }
+
+    obj.points.swap(points);
+    obj.colors.swap(colors);
+}
+
+//----------------------------------------------------------------------------
+//
+//  Vertex formats
+//
+
+static const VertexLayout vertexLayouts[] = {
+    {"float", 32, GL_FLOAT, GL_FALSE, 16, GL_FLOAT, GL_FALSE},
+    {"half", 12, GL_HALF_FLOAT, GL_FALSE, 8, GL_UNSIGNED_BYTE, GL_TRUE},
+    {"snorm16", 12, GL_SHORT, GL_TRUE, 8, GL_UNSIGNED_BYTE, GL_TRUE}};
+
+const VertexLayout &getVertexLayout(VertexFormat format)
+{
+    return vertexLayouts[format];
+}
+
+// IEEE 754 half precision, rounded to nearest even
+static GLushort floatToHalf(float value)
+{
+    GLuint bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    GLuint sign = (bits >> 16) & 0x8000;
+    GLuint magnitude = bits & 0x7fffffff;
+
+    if (magnitude >= 0x7f800000) // Inf or NaN
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    if (magnitude >= 0x477ff000) // Too large, clamp to infinity
+        return sign | 0x7c00;
+    if (magnitude < 0x38800000) // Denormal or zero
+    {
+        if (magnitude < 0x33000000)
+            return sign;
+        GLuint mantissa = (magnitude & 0x007fffff) | 0x00800000;
+        int shift = 126 - (magnitude >> 23);
+        GLuint half = mantissa >> shift;
+        GLuint rest = mantissa & ((1u << shift) - 1);
+        GLuint halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    // Rebias the exponent and round the mantissa
+    magnitude -= 0x38000000;
+    GLuint half = magnitude >> 13;
+    GLuint rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+static GLubyte floatToUnorm8(float value)
+{
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    return GLubyte(value * 255.0f + 0.5f);
+}
+
+static GLshort floatToSnorm16(float value)
+{
+    value = std::min(std::max(value, -1.0f), 1.0f);
+    return GLshort(value >= 0.0f ? value * 32767.0f + 0.5f : value * 32767.0f - 0.5f);
+}
+
+void encodeVertices(const Object &obj, VertexFormat format, std::vector<unsigned char> &data,
+                    vec3 &positionScale, vec3 &positionOffset)
+{
+    const VertexLayout &layout = getVertexLayout(format);
+    data.assign(obj.points.size() * layout.stride, 0);
+
+    positionScale = vec3(1.0, 1.0, 1.0);
+    positionOffset = vec3(0.0, 0.0, 0.0);
+
+    if (format == VERTEX_SNORM16)
+    {
+        // Map the bounding box onto [-1, 1]
+        positionOffset = (obj.boundsMin + obj.boundsMax) * 0.5f;
+        positionScale = (obj.boundsMax - obj.boundsMin) * 0.5f;
+        for (int k = 0; k < 3; ++k)
+        {
+            if (positionScale[k] <= 0.0f)
+                positionScale[k] = 1.0f; // Flat along this axis
+        }
+    }
+
+    for (size_t i = 0; i < obj.points.size(); ++i)
+    {
+        unsigned char *vertex = &data[i * layout.stride];
+        const point4 &p = obj.points[i];
+        const color4 &c = obj.colors[i];
+
+        if (format == VERTEX_FLOAT)
+        {
+            memcpy(vertex, &p, sizeof(point4));
+            memcpy(vertex + layout.colorOffset, &c, sizeof(color4));
+            continue;
+        }
+
+        GLushort position[4];
+        for (int k = 0; k < 3; ++k)
+        {
+            if (format == VERTEX_HALF)
+                position[k] = floatToHalf(p[k]);
+            else
+                position[k] = GLushort(floatToSnorm16((p[k] - positionOffset[k]) / positionScale[k]));
+        }
+        position[3] = 0; // w is always 1 and set in the shader
+        memcpy(vertex, position, sizeof(position));
+
+        GLubyte color[4] = {floatToUnorm8(c.x), floatToUnorm8(c.y), floatToUnorm8(c.z), floatToUnorm8(c.w)};
+        memcpy(vertex + layout.colorOffset, color, sizeof(color));
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void buildMesh(Object &obj, const char *name)
+{
+    long flatVertices = obj.points.size();
+
+    weldVertices(obj);
+    float acmrIndexed = computeACMR(obj.indices, obj.points.size(), VertexCacheSize);
+
+    // Small meshes are sometimes already in a better order than the fan walk
+    // finds; keep the input then, as a single cluster
+    std::vector<GLuint> inputOrder = obj.indices;
+    std::vector<int> clusters;
+    optimizeVertexCache(obj.indices, obj.points.size(), clusters);
+    if (computeACMR(obj.indices, obj.points.size(), VertexCacheSize) > acmrIndexed)
+    {
+        obj.indices.swap(inputOrder);
+        clusters.assign(1, 0);
+    }
+
+    optimizeOverdraw(obj.indices, obj.points, clusters, 1.05f);
+    optimizeVertexFetch(obj);
+
+    float acmrOptimized = computeACMR(obj.indices, obj.points.size(), VertexCacheSize);
+
+    // Accumulate statistics per mesh name
+    MeshStats *stats = NULL;
+    for (size_t i = 0; i < meshStats.size(); ++i)
+    {
+        if (meshStats[i].name == name)
+            stats = &meshStats[i];
+    }
+    if (stats == NULL)
+    {
+        MeshStats fresh = {name, 0, 0, 0, 0, 0.0, 0.0};
+        meshStats.push_back(fresh);
+        stats = &meshStats.back();
+    }
+
+    long triangles = obj.indices.size() / 3;
+    stats->meshes++;
+    stats->flatVertices += flatVertices;
+    stats->uniqueVertices += obj.points.size();
+    stats->triangles += triangles;
+    stats->acmrIndexed += acmrIndexed * triangles;
+    stats->acmrOptimized += acmrOptimized * triangles;
+}
+
+void printMeshReport()
+{
+    printf("[mesh] vertex format %s, %d bytes/vertex, %ld bytes of vertex data\n",
+           getVertexLayout(vertexFormat).name, getVertexLayout(vertexFormat).stride, vertexBufferBytes);
+    // Unindexed, the ACMR is always 3 (one vertex per corner), so only the
+    // measured ones are printed: as welded, and after reordering
+    printf("[mesh] %-16s %6s %10s %10s %10s %17s\n", "", "", "", "", "", "ACMR");
+    printf("[mesh] %-16s %6s %10s %10s %10s %8s %8s\n",
+           "name", "meshes", "triangles", "flat vtx", "unique vtx", "indexed", "optim.");
+    for (size_t i = 0; i < meshStats.size(); ++i)
+    {
+        const MeshStats &stats = meshStats[i];
+        double triangles = stats.triangles > 0 ? double(stats.triangles) : 1.0;
+        printf("[mesh] %-16s %6d %10ld %10ld %10ld %8.3f %8.3f\n",
+               stats.name.c_str(), stats.meshes, stats.triangles,
+               stats.flatVertices, stats.uniqueVertices,
+               stats.acmrIndexed / triangles,
+               stats.acmrOptimized / triangles);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "objects.h"
+#include <vector>
+
+// FIFO post-transform cache size assumed by the optimizer and the ACMR report
+const int VertexCacheSize = 16;
+
+// Print the per-mesh ACMR report at startup (--mesh-report)
+extern bool meshReport;
+
+// Interleaved vertex formats for Object buffers
+enum VertexFormat
+{
+    VERTEX_FLOAT,  // float4 position + float4 color, 32 bytes
+    VERTEX_HALF,   // half4 position + RGBA8 color, 12 bytes
+    VERTEX_SNORM16 // 16-bit normalized position in the mesh bounds + RGBA8 color, 12 bytes
+};
+
+// Attribute setup for one vertex format
+struct VertexLayout
+{
+    const char *name;
+    int stride;
+    GLenum positionType;
+    GLboolean positionNormalized;
+    size_t colorOffset;
+    GLenum colorType;
+    GLboolean colorNormalized;
+};
+
+extern VertexFormat vertexFormat; // Selected with --vertex-format
+extern long vertexBufferBytes;    // Total size of uploaded vertex data
+
+const VertexLayout &getVertexLayout(VertexFormat format);
+
+// Pack an object's vertices into the interleaved format. Positions are
+// reconstructed in the shader as stored * positionScale + positionOffset.
+// The object's bounds must be up to date.
+void encodeVertices(const Object &obj, VertexFormat format, std::vector<unsigned char> &data,
+                    vec3 &positionScale, vec3 &positionOffset);
+
+// Turn an object's flat triangle list into unique vertices plus an index list
+// optimized for the vertex cache and overdraw. Statistics are recorded under name.
+void buildMesh(Object &obj, const char *name);
+
+// Index list helpers
+void weldVertices(Object &obj);
+void optimizeVertexCache(std::vector<GLuint> &indices, int numVertices, std::vector<int> &clusters);
+void optimizeOverdraw(std::vector<GLuint> &indices, const std::vector<point4> &points,
+                      const std::vector<int> &clusters, float threshold);
+void optimizeVertexFetch(Object &obj);
+
+// Average cache miss ratio: transformed vertices per triangle (3.0 without reuse)
+float computeACMR(const std::vector<GLuint> &indices, int numVertices, int cacheSize);
+
+void printMeshReport();
+
+#endif
@@ -2,12 +2,28 @@
 #include "Angel.h"
 #include "display.h"
 #include "globals.h"
+#include "mesh.h"
+#include "culling.h"
+#include "spatial.h"
+#include "lod.h"
+#include "glstate.h"
+#include "transforms.h"
+#include "arena.h"
+#include "registry.h"
+#include "scene.h"
+#include "world.h"
+#include "stats.h"
+#include <algorithm>
+#include <cstring>
 // Shader variables
 GLuint program;
-GLuint ModelView, Projection;
+GLuint Model, ModelIndex, Instanced, InstancedProps;
+GLuint LightState, LampSlot;
+GLuint PositionScale, PositionOffset;
 GLuint vao[NumObjects];
 GLuint buffer[NumObjects];
 GLuint vPosition, vColor;
+GLuint vInstance, vInstanceColor;
 
 // Transformation matrices
 mat4 model_view;
@@ -19,14 +35,35 @@ const float lightBoxHeight = 1.5f;
 const float connectorPoleHeight = 3.0f;
 const float connectorPoleWidth = 0.1f;
 
+// Levels of detail: wheel slices per level, and the screen sizes (pixels)
+// below which the coarser levels are used
+const int NumWheelLods = 3;
+const int WheelSlices[NumWheelLods] = {20, 8, 4};
+const float WheelLodSizes[NumWheelLods - 1] = {48.0f, 16.0f};
+const float BuildingFlatRoofSize = 24.0f; // Pyramid roof replaced by a flat top
+const float LampCutoffSize = 2.0f;        // Lamps not drawn at all
+
+// Wheel positions relative to the car body
+const int NumWheels = 4;
+const vec3 WheelOffsets[NumWheels] = {
+    vec3(-1.0, 0.0, 0.8),  // Front left
+    vec3(1.0, 0.0, 0.8),   // Front right
+    vec3(-1.0, 0.0, -0.8), // Back left
+    vec3(1.0, 0.0, -0.8)   // Back right
+};
+
 // External variables for objects
 std::vector<TrafficLight> trafficLights;
 Object carBody;
 Object carWheel;
-std::vector<mat4> wheelTransforms;
-std::vector<Object> buildings;
+SceneNode carNode = -1;
+std::vector<SceneNode> wheelNodes;
+std::vector<BuildingInstance> buildingInstances;
+Object buildingMesh;
+GLuint buildingInstanceBuffer;
 Object ground;
 Object roads;
+Object staticBatch;
 
 // Car color
 color4 carBodyColor = color4(0.0, 0.0, 1.0, 1.0); // Blue
@@ -41,9 +78,10 @@ color4 groundColor = color4(0.3, 0.7, 0.3, 1.0); // Green
 // Road color
 color4 roadColor = color4(0.2, 0.2, 0.2, 1.0); // Dark gray
 
-// Grid parameters
-const int gridSize = 10;
-const float blockSize = 10.0f;
+// Grid parameters (grid size and building cap can be raised from the command line)
+int gridSize = 10;
+int maxBuildings = 70;
+bool lightGrid = false;
 const float roadWidth = 2.0f;
 
 // Car body geometry
@@ -90,6 +128,98 @@ GLubyte carBodyIndices[] = {
     7, 6, 13,
     13, 12, 7};
 
+// Upload an object to the GL. Flat triangle lists are first welded into unique
+// vertices with an optimized index list; objects that already carry indices
+// (the static batch) are uploaded as they are.
+void uploadObject(Object &obj, const char *name)
+{
+    if (obj.indices.empty())
+        buildMesh(obj, name);
+
+    obj.numVertices = obj.points.size();
+    obj.numIndices = obj.indices.size();
+    computeBounds(obj);
+
+    // Interleaved vertices in the selected compact format
+    std::vector<unsigned char> data;
+    vec3 positionScale, positionOffset;
+    encodeVertices(obj, vertexFormat, data, positionScale, positionOffset);
+
+    // Followed by the indices, 16-bit whenever they fit
+    long indexStart = (data.size() + 3) / 4 * 4;
+    GLenum indexType;
+    if (obj.numVertices <= 65536)
+    {
+        std::vector<GLushort> shortIndices(obj.indices.begin(), obj.indices.end());
+        data.resize(indexStart + shortIndices.size() * sizeof(GLushort));
+        memcpy(&data[indexStart], &shortIndices[0], shortIndices.size() * sizeof(GLushort));
+        indexType = GL_UNSIGNED_SHORT;
+    }
+    else
+    {
+        data.resize(indexStart + obj.indices.size() * sizeof(GLuint));
+        memcpy(&data[indexStart], &obj.indices[0], obj.indices.size() * sizeof(GLuint));
+        indexType = GL_UNSIGNED_INT;
+    }
+
+    // Uploaded unless an identical mesh already was
+    obj.mesh = registerMesh(data, indexStart, indexType, positionScale, positionOffset);
+}
+
+// Wheel cylinder with the given number of slices
+static void buildWheel(Object &wheel, int slices)
+{
+    float radius = 0.4f;
+    float width = 0.2f;
+    std::vector<point4> wheelVertices;
+    std::vector<color4> wheelColors;
+
+    // Generate vertices for the wheel
+    for (int i = 0; i < slices; ++i)
+    {
+        float theta = (2.0f * M_PI * i) / slices;
+        float nextTheta = (2.0f * M_PI * (i + 1)) / slices;
+
+        // Side face
+        wheelVertices.push_back(point4(radius * cos(theta), width, radius * sin(theta), 1.0));
+        wheelVertices.push_back(point4(radius * cos(theta), -width, radius * sin(theta), 1.0));
+        wheelVertices.push_back(point4(radius * cos(nextTheta), -width, radius * sin(nextTheta), 1.0));
+
+        wheelVertices.push_back(point4(radius * cos(theta), width, radius * sin(theta), 1.0));
+        wheelVertices.push_back(point4(radius * cos(nextTheta), -width, radius * sin(nextTheta), 1.0));
+        wheelVertices.push_back(point4(radius * cos(nextTheta), width, radius * sin(nextTheta), 1.0));
+
+        // Top face
+        wheelVertices.push_back(point4(0.0, width, 0.0, 1.0));
+        wheelVertices.push_back(point4(radius * cos(nextTheta), width, radius * sin(nextTheta), 1.0));
+        wheelVertices.push_back(point4(radius * cos(theta), width, radius * sin(theta), 1.0));
+
+        // Bottom face
+        wheelVertices.push_back(point4(0.0, -width, 0.0, 1.0));
+        wheelVertices.push_back(point4(radius * cos(theta), -width, radius * sin(theta), 1.0));
+        wheelVertices.push_back(point4(radius * cos(nextTheta), -width, radius * sin(nextTheta), 1.0));
+
+        // Add colors for the side faces
+        for (int j = 0; j < 6; ++j)
+        {
+            if (i == 0) // Mark the first segment
+                wheelColors.push_back(markerColor);
+            else
+                wheelColors.push_back(wheelColor);
+        }
+
+        // Add colors for the top and bottom faces
+        for (int j = 0; j < 6; ++j)
+        {
+            wheelColors.push_back(wheelColor);
+        }
+    }
+
+    wheel.points = wheelVertices;
+    wheel.colors = wheelColors;
+    wheel.numVertices = wheelVertices.size();
+}
+
 // Function definitions
 void createCar()
 {
@@ -107,124 +237,130 @@ void createCar()
         }
         carBody.numVertices = numVertices;
 
-        // Create VAO and buffer for the car body
-        glGenVertexArrays(1, &carBody.vao);
-        glGenBuffers(1, &carBody.buffer);
-
-        glBindVertexArray(carBody.vao);
-        glBindBuffer(GL_ARRAY_BUFFER, carBody.buffer);
-        glBufferData(GL_ARRAY_BUFFER, carBody.points.size() * sizeof(point4) + carBody.colors.size() * sizeof(color4), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, carBody.points.size() * sizeof(point4), &carBody.points[0]);
-        glBufferSubData(GL_ARRAY_BUFFER, carBody.points.size() * sizeof(point4), carBody.colors.size() * sizeof(color4), &carBody.colors[0]);
-
-        // Set up vertex arrays
-        glEnableVertexAttribArray(vPosition);
-        glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-        glEnableVertexAttribArray(vColor);
-        glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(carBody.points.size() * sizeof(point4)));
+        // Weld, optimize and upload
+        uploadObject(carBody, "car body");
     }
 
-    // Wheels
+    // Wheels, with coarser cylinders for when they are small on screen
     {
-        // Define wheel geometry (cylinder)
-        const int NumWheelSlices = 20;
-        float radius = 0.4f;
-        float width = 0.2f;
-        std::vector<point4> wheelVertices;
-        std::vector<color4> wheelColors;
-
-        // Generate vertices for the wheel
-        for (int i = 0; i < NumWheelSlices; ++i)
-        {
-            float theta = (2.0f * M_PI * i) / NumWheelSlices;
-            float nextTheta = (2.0f * M_PI * (i + 1)) / NumWheelSlices;
-
-            // Side face
-            wheelVertices.push_back(point4(radius * cos(theta), width, radius * sin(theta), 1.0));
-            wheelVertices.push_back(point4(radius * cos(theta), -width, radius * sin(theta), 1.0));
-            wheelVertices.push_back(point4(radius * cos(nextTheta), -width, radius * sin(nextTheta), 1.0));
-
-            wheelVertices.push_back(point4(radius * cos(theta), width, radius * sin(theta), 1.0));
-            wheelVertices.push_back(point4(radius * cos(nextTheta), -width, radius * sin(nextTheta), 1.0));
-            wheelVertices.push_back(point4(radius * cos(nextTheta), width, radius * sin(nextTheta), 1.0));
-
-            // Top face
-            wheelVertices.push_back(point4(0.0, width, 0.0, 1.0));
-            wheelVertices.push_back(point4(radius * cos(nextTheta), width, radius * sin(nextTheta), 1.0));
-            wheelVertices.push_back(point4(radius * cos(theta), width, radius * sin(theta), 1.0));
+        buildWheel(carWheel, WheelSlices[0]);
+        uploadObject(carWheel, "wheel");
 
-            // Bottom face
-            wheelVertices.push_back(point4(0.0, -width, 0.0, 1.0));
-            wheelVertices.push_back(point4(radius * cos(theta), -width, radius * sin(theta), 1.0));
-            wheelVertices.push_back(point4(radius * cos(nextTheta), -width, radius * sin(nextTheta), 1.0));
-
-            // Add colors for the side faces
-            for (int j = 0; j < 6; ++j)
-            {
-                if (i == 0) // Mark the first segment
-                    wheelColors.push_back(markerColor);
-                else
-                    wheelColors.push_back(wheelColor);
-            }
-
-            // Add colors for the top and bottom faces
-            for (int j = 0; j < 6; ++j)
-            {
-                wheelColors.push_back(wheelColor);
-            }
+        for (int level = 1; level < NumWheelLods; ++level)
+        {
+            Object coarse;
+            buildWheel(coarse, WheelSlices[level]);
+            uploadObject(coarse, "wheel (coarse)");
+            addLod(carWheel, coarse, WheelLodSizes[level - 1]);
         }
 
-        int numVertices = wheelVertices.size();
+    }
 
-        // Assign data to carWheel object
-        carWheel.points = wheelVertices;
-        carWheel.colors = wheelColors;
-        carWheel.numVertices = numVertices;
+    // The car node and its wheels, moved by updateCarNodes()
+    carNode = addSceneNode(-1, vec3(0.0, 0.0, 0.0));
+    for (int i = 0; i < NumWheels; ++i)
+        wheelNodes.push_back(addSceneNode(carNode, WheelOffsets[i]));
+    updateCarNodes();
+}
 
-        // Create VAO and buffer for the wheel
-        glGenVertexArrays(1, &carWheel.vao);
-        glGenBuffers(1, &carWheel.buffer);
+void updateCarNodes()
+{
+    setSceneTransform(carNode, carPosition + vec3(0.0, 0.5, 0.0), vec3(0.0, carRotation + 90.0, 0.0), vec3(0.6, 0.6, 0.6));
+    for (size_t i = 0; i < wheelNodes.size(); ++i)
+        setSceneTransform(wheelNodes[i], WheelOffsets[i], vec3(90.0, -wheelRotation, 0.0));
+}
 
-        glBindVertexArray(carWheel.vao);
-        glBindBuffer(GL_ARRAY_BUFFER, carWheel.buffer);
-        glBufferData(GL_ARRAY_BUFFER, carWheel.points.size() * sizeof(point4) + carWheel.colors.size() * sizeof(color4), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, carWheel.points.size() * sizeof(point4), &carWheel.points[0]);
-        glBufferSubData(GL_ARRAY_BUFFER, carWheel.points.size() * sizeof(point4), carWheel.colors.size() * sizeof(color4), &carWheel.colors[0]);
+// Unit building: a cube base of height 1 with a pyramid roof on top
+
+point4 buildingVertices[] = {
+    // Cube base
+    point4(-buildingSize, 0.0, buildingSize, 1.0),  // 0
+    point4(buildingSize, 0.0, buildingSize, 1.0),   // 1
+    point4(buildingSize, 1.0, buildingSize, 1.0),   // 2
+    point4(-buildingSize, 1.0, buildingSize, 1.0),  // 3
+    point4(-buildingSize, 0.0, -buildingSize, 1.0), // 4
+    point4(buildingSize, 0.0, -buildingSize, 1.0),  // 5
+    point4(buildingSize, 1.0, -buildingSize, 1.0),  // 6
+    point4(-buildingSize, 1.0, -buildingSize, 1.0), // 7
+    // Pyramid top
+    point4(0.0, 1.0 + buildingRoofHeight, 0.0, 1.0) // 8
+};
 
-        // Set up vertex arrays
-        glEnableVertexAttribArray(vPosition);
-        glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+// Indices for drawing the building using triangles
+GLubyte buildingIndices[] = {
+    // Cube base
+    0, 1, 2,
+    2, 3, 0,
+    1, 5, 6,
+    6, 2, 1,
+    5, 4, 7,
+    7, 6, 5,
+    4, 0, 3,
+    3, 7, 4,
+    // Top pyramid
+    3, 2, 8,
+    2, 6, 8,
+    6, 7, 8,
+    7, 3, 8};
+
+// Far building: the same walls with a flat top instead of the pyramid
+GLubyte buildingFlatIndices[] = {
+    // Cube base
+    0, 1, 2,
+    2, 3, 0,
+    1, 5, 6,
+    6, 2, 1,
+    5, 4, 7,
+    7, 6, 5,
+    4, 0, 3,
+    3, 7, 4,
+    // Flat top
+    3, 2, 6,
+    6, 7, 3};
 
-        glEnableVertexAttribArray(vColor);
-        glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(carWheel.points.size() * sizeof(point4)));
+// Stretch a unit building vertex to the given height (same rule as vshader.glsl)
+point4 scaleBuildingVertex(point4 p, float height)
+{
+    float base = std::min(p.y, 1.0f);
+    p.y = base * height + (p.y - base);
+    return p;
+}
 
-        // Wheel positions relative to the car body
-        wheelTransforms.resize(4);
-        wheelTransforms[0] = Translate(-1.0, 0.0, 0.8);  // Front left
-        wheelTransforms[1] = Translate(1.0, 0.0, 0.8);   // Front right
-        wheelTransforms[2] = Translate(-1.0, 0.0, -0.8); // Back left
-        wheelTransforms[3] = Translate(1.0, 0.0, -0.8);  // Back right
+// Building object of one instance, scaled to its height
+static void buildBuildingLevel(Object &building, const GLubyte *indices, int numVertices, const BuildingInstance &instance)
+{
+    building.points.resize(numVertices);
+    building.colors.resize(numVertices);
+    for (int k = 0; k < numVertices; ++k)
+    {
+        building.points[k] = scaleBuildingVertex(buildingVertices[indices[k]], instance.position.w);
+        building.colors[k] = instance.color;
     }
+    building.numVertices = numVertices;
+}
+
+void buildBuilding(Object &building, const BuildingInstance &instance)
+{
+    buildBuildingLevel(building, buildingIndices, sizeof(buildingIndices) / sizeof(GLubyte), instance);
 }
 
 void createBuildings()
 {
     // Create buildings in the blocks between roads
-    float halfGrid = gridSize / 2.0f;
     int buildingCount = 0;
 
-    for (int i = -gridSize; i <= gridSize; ++i)
+    buildingInstances.clear();
+    for (int i = -gridSize; i <= gridSize && buildingCount < maxBuildings; ++i)
     {
-        for (int j = -gridSize; j <= gridSize; ++j)
+        for (int j = -gridSize; j <= gridSize && buildingCount < maxBuildings; ++j)
         {
             // Skip roads
             if (i % 2 == 0 || j % 2 == 0)
                 continue;
 
-            Object building;
+            BuildingInstance instance;
             // Random color for building
-            color4 buildingColor = color4(
+            instance.color = color4(
                 static_cast<float>(rand()) / RAND_MAX,
                 static_cast<float>(rand()) / RAND_MAX,
                 static_cast<float>(rand()) / RAND_MAX,
@@ -233,83 +369,118 @@ void createBuildings()
             // Random height between 2 and 5 units
             float height = 2.0f + static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / (5.0f - 2.0f)));
 
-            // Building base size
-            float size = 1.5f;
-
-            // Define shape for the building
-            point4 vertices[] = {
-                // Cube base
-                point4(-size, 0.0, size, 1.0),     // 0
-                point4(size, 0.0, size, 1.0),      // 1
-                point4(size, height, size, 1.0),   // 2
-                point4(-size, height, size, 1.0),  // 3
-                point4(-size, 0.0, -size, 1.0),    // 4
-                point4(size, 0.0, -size, 1.0),     // 5
-                point4(size, height, -size, 1.0),  // 6
-                point4(-size, height, -size, 1.0), // 7
-                // Pyramid top
-                point4(0.0, height + 2.0, 0.0, 1.0) // 8
-            };
-
-            // Indices for drawing the building using triangles
-            GLubyte indices[] = {
-                // Cube base
-                0, 1, 2,
-                2, 3, 0,
-                1, 5, 6,
-                6, 2, 1,
-                5, 4, 7,
-                7, 6, 5,
-                4, 0, 3,
-                3, 7, 4,
-                // Top pyramid
-                3, 2, 8,
-                2, 6, 8,
-                6, 7, 8,
-                7, 3, 8};
-
-            int numVertices = sizeof(indices) / sizeof(GLubyte);
-
-            // Assign data to building object
-            building.points.resize(numVertices);
-            building.colors.resize(numVertices);
-            for (int k = 0; k < numVertices; ++k)
-            {
-                building.points[k] = vertices[indices[k]];
-                building.colors[k] = buildingColor;
-            }
-            building.numVertices = numVertices;
-
-            // Create VAO and buffer for the building
-            glGenVertexArrays(1, &building.vao);
-            glGenBuffers(1, &building.buffer);
-
-            glBindVertexArray(building.vao);
-            glBindBuffer(GL_ARRAY_BUFFER, building.buffer);
-            glBufferData(GL_ARRAY_BUFFER, building.points.size() * sizeof(point4) + building.colors.size() * sizeof(color4), NULL, GL_STATIC_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, building.points.size() * sizeof(point4), &building.points[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, building.points.size() * sizeof(point4), building.colors.size() * sizeof(color4), &building.colors[0]);
-
-            // Set up vertex arrays
-            glEnableVertexAttribArray(vPosition);
-            glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-            glEnableVertexAttribArray(vColor);
-            glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(building.points.size() * sizeof(point4)));
-
             // Set building position
             float x = i * (blockSize / 2.0f);
             float z = j * (blockSize / 2.0f);
 
-            building.modelMatrix = Translate(x, 0.0, z);
+            instance.position = vec4(x, 0.0, z, height);
 
-            buildings.push_back(building);
+            buildingInstances.push_back(instance);
             buildingCount++;
-
-            if (buildingCount >= 70)
-                return;
         }
     }
+
+    // Shared unit mesh for instanced drawing
+    int numVertices = sizeof(buildingIndices) / sizeof(GLubyte);
+
+    buildingMesh.points.resize(numVertices);
+    buildingMesh.colors.resize(numVertices);
+    for (int k = 0; k < numVertices; ++k)
+    {
+        buildingMesh.points[k] = buildingVertices[buildingIndices[k]];
+        buildingMesh.colors[k] = color4(1.0, 1.0, 1.0, 1.0); // Replaced by the instance color
+    }
+    buildingMesh.numVertices = numVertices;
+
+    // Weld, optimize and upload
+    uploadObject(buildingMesh, "building (unit)");
+
+    // Spatial index over the buildings; the instanced draw covers all of
+    // them, so it is culled by the root box
+    buildCityIndex();
+    if (!cityIndex.nodes.empty())
+    {
+        buildingMesh.boundsMin = cityIndex.nodes[0].center - cityIndex.nodes[0].extent;
+        buildingMesh.boundsMax = cityIndex.nodes[0].center + cityIndex.nodes[0].extent;
+    }
+
+    // Per-instance attributes, advanced once per building, in a vertex
+    // array of its own over the arena block; the instance attributes are
+    // unused by any other draw of the mesh
+    Mesh &unitMesh = meshes[buildingMesh.mesh];
+    unitMesh.vao = createArenaVertexArray(unitMesh.range.block);
+    glGenBuffers(1, &buildingInstanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buildingInstanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, buildingInstances.size() * sizeof(BuildingInstance),
+                 buildingInstances.empty() ? NULL : &buildingInstances[0], GL_STATIC_DRAW);
+    frameStats.bytesUploaded += buildingInstances.size() * sizeof(BuildingInstance);
+
+    glEnableVertexAttribArray(vInstance);
+    glVertexAttribPointer(vInstance, 4, GL_FLOAT, GL_FALSE, sizeof(BuildingInstance), BUFFER_OFFSET(0));
+    glVertexAttribDivisor(vInstance, 1);
+
+    glEnableVertexAttribArray(vInstanceColor);
+    glVertexAttribPointer(vInstanceColor, 4, GL_FLOAT, GL_FALSE, sizeof(BuildingInstance), BUFFER_OFFSET(sizeof(vec4)));
+    glVertexAttribDivisor(vInstanceColor, 1);
+}
+
+// Append an indexed object to the static batch, transforming its vertices
+// into world space
+static void appendToBatch(const Object &obj, const mat4 &modelMatrix)
+{
+    GLuint base = staticBatch.points.size();
+    for (size_t k = 0; k < obj.points.size(); ++k)
+    {
+        staticBatch.points.push_back(modelMatrix * obj.points[k]);
+        staticBatch.colors.push_back(obj.colors[k]);
+    }
+    for (size_t k = 0; k < obj.indices.size(); ++k)
+    {
+        staticBatch.indices.push_back(base + obj.indices[k]);
+    }
+}
+
+// Create one object per building in the world store (world.h), and the
+// static batch of ground, roads and buildings merged in world space; only
+// needed when buildings are not drawn instanced
+void createBuildingObjects()
+{
+    if (staticBatch.mesh >= 0)
+        return;
+
+    // Ground and roads are already in world space
+    appendToBatch(ground, mat4());
+    appendToBatch(roads, mat4());
+
+    for (const auto &instance : buildingInstances)
+    {
+        Object building;
+        buildBuilding(building, instance);
+
+        // Weld, optimize and upload
+        uploadObject(building, "building");
+
+        // Flat-roofed version for far away
+        Object flat;
+        buildBuildingLevel(flat, buildingFlatIndices, sizeof(buildingFlatIndices) / sizeof(GLubyte), instance);
+        uploadObject(flat, "building (flat roof)");
+        addLod(building, flat, BuildingFlatRoofSize);
+
+        // Set building position
+        building.modelMatrix = Translate(instance.position.x, instance.position.y, instance.position.z);
+        makeStatic(building);
+
+        // Pre-transformed into the batch while its geometry is still here;
+        // the store keeps only what drawing needs
+        appendToBatch(building, building.modelMatrix);
+        addBuilding(building);
+    }
+
+    // Upload the merged mesh, already indexed
+    staticBatch.modelMatrix = mat4(); // Identity, vertices are in world space
+    uploadObject(staticBatch, "static batch");
+    makeStatic(staticBatch);
+    releaseGeometry(staticBatch);
 }
 
 void createGround()
@@ -337,22 +508,9 @@ void createGround()
     ground.colors.assign(groundColors, groundColors + 6);
     ground.numVertices = 6;
 
-    // Create VAO and buffer for the ground
-    glGenVertexArrays(1, &ground.vao);
-    glGenBuffers(1, &ground.buffer);
-
-    glBindVertexArray(ground.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, ground.buffer);
-    glBufferData(GL_ARRAY_BUFFER, ground.points.size() * sizeof(point4) + ground.colors.size() * sizeof(color4), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, ground.points.size() * sizeof(point4), &ground.points[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, ground.points.size() * sizeof(point4), ground.colors.size() * sizeof(color4), &ground.colors[0]);
-
-    // Set up vertex arrays
-    glEnableVertexAttribArray(vPosition);
-    glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-    glEnableVertexAttribArray(vColor);
-    glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(ground.points.size() * sizeof(point4)));
+    // Weld, optimize and upload
+    uploadObject(ground, "ground");
+    makeStatic(ground);
 }
 
 // Create the roads
@@ -406,22 +564,9 @@ void createRoads()
     roads.colors = roadColors;
     roads.numVertices = numVertices;
 
-    // Create VAO and buffer for the roads
-    glGenVertexArrays(1, &roads.vao);
-    glGenBuffers(1, &roads.buffer);
-
-    glBindVertexArray(roads.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, roads.buffer);
-    glBufferData(GL_ARRAY_BUFFER, roads.points.size() * sizeof(point4) + roads.colors.size() * sizeof(color4), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, roads.points.size() * sizeof(point4), &roads.points[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, roads.points.size() * sizeof(point4), roads.colors.size() * sizeof(color4), &roads.colors[0]);
-
-    // Set up vertex arrays
-    glEnableVertexAttribArray(vPosition);
-    glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-    glEnableVertexAttribArray(vColor);
-    glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(roads.points.size() * sizeof(point4)));
+    // Weld, optimize and upload
+    uploadObject(roads, "roads");
+    makeStatic(roads);
 }
 
 // Create the traffic lights
@@ -453,218 +598,196 @@ void createTrafficLights()
 
     int numCubeVerticesWithoutFrontFace = sizeof(cubeIndicesWithoutFrontFace) / sizeof(GLubyte);
 
-    // Create 5 traffic lights
-    for (int i = 0; i < 5; ++i)
+    // The parts are built and uploaded once; every light copies them
+    TrafficLight parts;
+
+    // Create the main pole (base)
     {
-        TrafficLight tl;
-        tl.state = RED;
-        tl.stateTime = 0.0f;
+        parts.base.points.resize(numCubeVerticesWithoutFrontFace);
+        parts.base.colors.resize(numCubeVerticesWithoutFrontFace);
+        for (int j = 0; j < numCubeVerticesWithoutFrontFace; ++j)
+        {
+            point4 p = cubeVertices[cubeIndicesWithoutFrontFace[j]];
+            p.y *= poleHeight; // Scale to poleHeight
+            parts.base.points[j] = p;
+            parts.base.colors[j] = color4(0.8f, 0.2f, 0.2f, 1.0f); // Dark gray
+        }
+        parts.base.numVertices = numCubeVerticesWithoutFrontFace;
 
-        // Position the traffic light at some intersection
-        int gridX = -2 + i * 2; // Adjusted to place them near the center
-        int gridZ = 0;          // Place them along the z=0 line
+        // Weld, optimize and upload
+        uploadObject(parts.base, "light pole");
+    }
 
-        float x = gridX * (blockSize / 2.0f) + roadWidth;
-        float z = gridZ * (blockSize / 2.0f) + roadWidth;
+    // Create the light box
+    {
+        parts.lightBox.points.resize(numCubeVerticesWithoutFrontFace);
+        parts.lightBox.colors.resize(numCubeVerticesWithoutFrontFace);
+        for (int j = 0; j < numCubeVerticesWithoutFrontFace; ++j)
+        {
+            point4 p = cubeVertices[cubeIndicesWithoutFrontFace[j]];
+            p.y *= lightBoxHeight; // Scale to lightBoxHeight
+            p.y += poleHeight;     // Position on top of pole
+            p.x *= 0.5f;           // Make box thinner
+            p.z *= 0.5f;           // Reduce depth
+            parts.lightBox.points[j] = p;
+            parts.lightBox.colors[j] = color4(0.1f, 0.1f, 0.1f, 1.0f); // Darker gray
+        }
+        parts.lightBox.numVertices = numCubeVerticesWithoutFrontFace;
 
-        tl.modelMatrix = Translate(x, poleHeight + 1, z) * RotateZ(90.0f);
+        // Weld, optimize and upload
+        uploadObject(parts.lightBox, "light box");
+    }
+
+    // Create the connector pole
+    {
+        // Define cube vertices for the connector pole (similar to the main pole)
+        point4 connectorVertices[] = {
+            point4(-connectorPoleWidth, 0.0, connectorPoleWidth, 1.0),  // 0
+            point4(connectorPoleWidth, 0.0, connectorPoleWidth, 1.0),   // 1
+            point4(connectorPoleWidth, 1.0, connectorPoleWidth, 1.0),   // 2
+            point4(-connectorPoleWidth, 1.0, connectorPoleWidth, 1.0),  // 3
+            point4(-connectorPoleWidth, 0.0, -connectorPoleWidth, 1.0), // 4
+            point4(connectorPoleWidth, 0.0, -connectorPoleWidth, 1.0),  // 5
+            point4(connectorPoleWidth, 1.0, -connectorPoleWidth, 1.0),  // 6
+            point4(-connectorPoleWidth, 1.0, -connectorPoleWidth, 1.0)  // 7
+        };
+
+        GLubyte connectorIndicesWithoutFrontFace[] = {
+            // Right face
+            1, 5, 6, 6, 2, 1,
+            // Back face
+            5, 4, 7, 7, 6, 5,
+            // Left face
+            4, 0, 3, 3, 7, 4,
+            // Top face
+            3, 2, 6, 6, 7, 3,
+            // Bottom face
+            4, 5, 1, 1, 0, 4};
 
-        // Create the main pole (base)
+        int numConnectorVertices = sizeof(connectorIndicesWithoutFrontFace) / sizeof(GLubyte);
+
+        // Assign data to connectorPole object
+        parts.connectorPole.points.resize(numConnectorVertices);
+        parts.connectorPole.colors.resize(numConnectorVertices);
+        for (int j = 0; j < numConnectorVertices; ++j)
         {
-            tl.base.points.resize(numCubeVerticesWithoutFrontFace);
-            tl.base.colors.resize(numCubeVerticesWithoutFrontFace);
-            for (int j = 0; j < numCubeVerticesWithoutFrontFace; ++j)
-            {
-                point4 p = cubeVertices[cubeIndicesWithoutFrontFace[j]];
-                p.y *= poleHeight; // Scale to poleHeight
-                tl.base.points[j] = p;
-                tl.base.colors[j] = color4(0.8f, 0.2f, 0.2f, 1.0f); // Dark gray
-            }
-            tl.base.numVertices = numCubeVerticesWithoutFrontFace;
-
-            // Create VAO and buffer for the pole
-            glGenVertexArrays(1, &tl.base.vao);
-            glGenBuffers(1, &tl.base.buffer);
-
-            glBindVertexArray(tl.base.vao);
-            glBindBuffer(GL_ARRAY_BUFFER, tl.base.buffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         tl.base.points.size() * sizeof(point4) + tl.base.colors.size() * sizeof(color4),
-                         NULL, GL_STATIC_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, tl.base.points.size() * sizeof(point4), &tl.base.points[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, tl.base.points.size() * sizeof(point4),
-                            tl.base.colors.size() * sizeof(color4), &tl.base.colors[0]);
-
-            // Set up vertex arrays
-            glEnableVertexAttribArray(vPosition);
-            glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-            glEnableVertexAttribArray(vColor);
-            glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0,
-                                  BUFFER_OFFSET(tl.base.points.size() * sizeof(point4)));
+            point4 p = connectorVertices[connectorIndicesWithoutFrontFace[j]];
+            p.y *= connectorPoleHeight; // Scale to connectorPoleHeight
+            parts.connectorPole.points[j] = p;
+            parts.connectorPole.colors[j] = color4(0.8f, 0.2f, 0.2f, 1.0f); // Dark gray color
         }
+        parts.connectorPole.numVertices = numConnectorVertices;
+
+        // Weld, optimize and upload
+        uploadObject(parts.connectorPole, "connector pole");
+    }
+
+    // Create the lights; each lamp stores its lit color and the shader
+    // dims it unless the light state matches its slot (see vshader.glsl)
+    color4 lampColors[3] = {
+        color4(1.0, 0.0, 0.0, 1.0), // Red
+        color4(0.0, 1.0, 0.0, 1.0), // Green
+        color4(1.0, 1.0, 0.0, 1.0)  // Yellow
+    };
+
+    for (int k = 0; k < 3; ++k)
+    {
+        // Create small squares representing the lights
+        point4 lightVertices[] = {
+            point4(-0.15f, -0.25f, 0.051f, 1.0),
+            point4(0.15f, -0.25f, 0.051f, 1.0),
+            point4(0.15f, 0.25f, 0.051f, 1.0),
+            point4(-0.15f, 0.25f, 0.051f, 1.0)};
+
+        GLubyte lightIndices[] = {0, 1, 2, 2, 3, 0};
+
+        int numLightVertices = 6;
 
-        // Create the light box
+        parts.lights[k].points.resize(numLightVertices);
+        parts.lights[k].colors.resize(numLightVertices);
+        for (int j = 0; j < numLightVertices; ++j)
         {
-            tl.lightBox.points.resize(numCubeVerticesWithoutFrontFace);
-            tl.lightBox.colors.resize(numCubeVerticesWithoutFrontFace);
-            for (int j = 0; j < numCubeVerticesWithoutFrontFace; ++j)
-            {
-                point4 p = cubeVertices[cubeIndicesWithoutFrontFace[j]];
-                p.y *= lightBoxHeight; // Scale to lightBoxHeight
-                p.y += poleHeight;     // Position on top of pole
-                p.x *= 0.5f;           // Make box thinner
-                p.z *= 0.5f;           // Reduce depth
-                tl.lightBox.points[j] = p;
-                tl.lightBox.colors[j] = color4(0.1f, 0.1f, 0.1f, 1.0f); // Darker gray
-            }
-            tl.lightBox.numVertices = numCubeVerticesWithoutFrontFace;
-
-            // Create VAO and buffer for the light box
-            glGenVertexArrays(1, &tl.lightBox.vao);
-            glGenBuffers(1, &tl.lightBox.buffer);
-
-            glBindVertexArray(tl.lightBox.vao);
-            glBindBuffer(GL_ARRAY_BUFFER, tl.lightBox.buffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         tl.lightBox.points.size() * sizeof(point4) + tl.lightBox.colors.size() * sizeof(color4),
-                         NULL, GL_STATIC_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, tl.lightBox.points.size() * sizeof(point4), &tl.lightBox.points[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, tl.lightBox.points.size() * sizeof(point4),
-                            tl.lightBox.colors.size() * sizeof(color4), &tl.lightBox.colors[0]);
-
-            // Set up vertex arrays
-            glEnableVertexAttribArray(vPosition);
-            glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-            glEnableVertexAttribArray(vColor);
-            glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0,
-                                  BUFFER_OFFSET(tl.lightBox.points.size() * sizeof(point4)));
+            point4 p = lightVertices[lightIndices[j]];
+
+            // Position the lights inside the light box
+            float boxStartY = poleHeight;          // Bottom of the light box
+            float boxHeight = lightBoxHeight;      // Height of the light box
+            float lightSpacing = boxHeight / 3.0f; // Space for each light
+
+            // Center each light within its allocated space
+            p.y += boxStartY + lightSpacing * (2 - k) + lightSpacing / 2.0f - boxHeight / 2.0f;
+
+            parts.lights[k].points[j] = p;
+            parts.lights[k].colors[j] = lampColors[k];
         }
+        parts.lights[k].numVertices = numLightVertices;
+
+        // Weld, optimize and upload
+        uploadObject(parts.lights[k], "lamp");
+        addLodCutoff(parts.lights[k], LampCutoffSize);
+    }
 
-        // Create the connector pole
+    // One light near the center of five intersections, or with --light-grid
+    // one at every intersection of the road grid
+    std::vector<vec2> positions;
+    if (lightGrid)
+    {
+        for (int i = -gridSize; i <= gridSize; i += 2)
         {
-            // Define cube vertices for the connector pole (similar to the main pole)
-            point4 connectorVertices[] = {
-                point4(-connectorPoleWidth, 0.0, connectorPoleWidth, 1.0),  // 0
-                point4(connectorPoleWidth, 0.0, connectorPoleWidth, 1.0),   // 1
-                point4(connectorPoleWidth, 1.0, connectorPoleWidth, 1.0),   // 2
-                point4(-connectorPoleWidth, 1.0, connectorPoleWidth, 1.0),  // 3
-                point4(-connectorPoleWidth, 0.0, -connectorPoleWidth, 1.0), // 4
-                point4(connectorPoleWidth, 0.0, -connectorPoleWidth, 1.0),  // 5
-                point4(connectorPoleWidth, 1.0, -connectorPoleWidth, 1.0),  // 6
-                point4(-connectorPoleWidth, 1.0, -connectorPoleWidth, 1.0)  // 7
-            };
-
-            GLubyte connectorIndicesWithoutFrontFace[] = {
-                // Right face
-                1, 5, 6, 6, 2, 1,
-                // Back face
-                5, 4, 7, 7, 6, 5,
-                // Left face
-                4, 0, 3, 3, 7, 4,
-                // Top face
-                3, 2, 6, 6, 7, 3,
-                // Bottom face
-                4, 5, 1, 1, 0, 4};
-
-            int numConnectorVertices = sizeof(connectorIndicesWithoutFrontFace) / sizeof(GLubyte);
-
-            // Assign data to connectorPole object
-            tl.connectorPole.points.resize(numConnectorVertices);
-            tl.connectorPole.colors.resize(numConnectorVertices);
-            for (int j = 0; j < numConnectorVertices; ++j)
-            {
-                point4 p = connectorVertices[connectorIndicesWithoutFrontFace[j]];
-                p.y *= connectorPoleHeight; // Scale to connectorPoleHeight
-                tl.connectorPole.points[j] = p;
-                tl.connectorPole.colors[j] = color4(0.8f, 0.2f, 0.2f, 1.0f); // Dark gray color
-            }
-            tl.connectorPole.numVertices = numConnectorVertices;
-
-            // Create VAO and buffer for the connector pole
-            glGenVertexArrays(1, &tl.connectorPole.vao);
-            glGenBuffers(1, &tl.connectorPole.buffer);
-
-            glBindVertexArray(tl.connectorPole.vao);
-            glBindBuffer(GL_ARRAY_BUFFER, tl.connectorPole.buffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         tl.connectorPole.points.size() * sizeof(point4) + tl.connectorPole.colors.size() * sizeof(color4),
-                         NULL, GL_STATIC_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, tl.connectorPole.points.size() * sizeof(point4), &tl.connectorPole.points[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, tl.connectorPole.points.size() * sizeof(point4),
-                            tl.connectorPole.colors.size() * sizeof(color4), &tl.connectorPole.colors[0]);
-
-            // Set up vertex arrays
-            glEnableVertexAttribArray(vPosition);
-            glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-            glEnableVertexAttribArray(vColor);
-            glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0,
-                                  BUFFER_OFFSET(tl.connectorPole.points.size() * sizeof(point4)));
-
-            // Position the connector pole
-            tl.connectorPole.modelMatrix = RotateZ(-90.0f) * Translate(0.0f, -connectorPoleHeight, 0.0f);
+            for (int j = -gridSize; j <= gridSize; j += 2)
+                positions.push_back(vec2(i * (blockSize / 2.0f) + roadWidth, j * (blockSize / 2.0f) + roadWidth));
         }
-
-        // Create the lights
-        for (int k = 0; k < 3; ++k)
+    }
+    else
+    {
+        for (int i = 0; i < 5; ++i)
         {
-            // Create small squares representing the lights
-            point4 lightVertices[] = {
-                point4(-0.15f, -0.25f, 0.051f, 1.0),
-                point4(0.15f, -0.25f, 0.051f, 1.0),
-                point4(0.15f, 0.25f, 0.051f, 1.0),
-                point4(-0.15f, 0.25f, 0.051f, 1.0)};
-
-            GLubyte lightIndices[] = {0, 1, 2, 2, 3, 0};
-
-            int numLightVertices = 6;
-
-            tl.lights[k].points.resize(numLightVertices);
-            tl.lights[k].colors.resize(numLightVertices);
-            for (int j = 0; j < numLightVertices; ++j)
-            {
-                point4 p = lightVertices[lightIndices[j]];
-
-                // Position the lights inside the light box
-                float boxStartY = poleHeight;          // Bottom of the light box
-                float boxHeight = lightBoxHeight;      // Height of the light box
-                float lightSpacing = boxHeight / 3.0f; // Space for each light
-
-                // Center each light within its allocated space
-                p.y += boxStartY + lightSpacing * (2 - k) + lightSpacing / 2.0f - boxHeight / 2.0f;
-
-                tl.lights[k].points[j] = p;
-                tl.lights[k].colors[j] = color4(0.1f, 0.1f, 0.1f, 1.0f); // Start with off color
-            }
-            tl.lights[k].numVertices = numLightVertices;
-
-            // Create VAO and buffer for the light
-            glGenVertexArrays(1, &tl.lights[k].vao);
-            glGenBuffers(1, &tl.lights[k].buffer);
-
-            glBindVertexArray(tl.lights[k].vao);
-            glBindBuffer(GL_ARRAY_BUFFER, tl.lights[k].buffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         tl.lights[k].points.size() * sizeof(point4) + tl.lights[k].colors.size() * sizeof(color4),
-                         NULL, GL_DYNAMIC_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, tl.lights[k].points.size() * sizeof(point4), &tl.lights[k].points[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, tl.lights[k].points.size() * sizeof(point4),
-                            tl.lights[k].colors.size() * sizeof(color4), &tl.lights[k].colors[0]);
-
-            // Set up vertex arrays
-            glEnableVertexAttribArray(vPosition);
-            glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-            glEnableVertexAttribArray(vColor);
-            glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0,
-                                  BUFFER_OFFSET(tl.lights[k].points.size() * sizeof(point4)));
+            int gridX = -2 + i * 2; // Adjusted to place them near the center
+            int gridZ = 0;          // Place them along the z=0 line
+            positions.push_back(vec2(gridX * (blockSize / 2.0f) + roadWidth, gridZ * (blockSize / 2.0f) + roadWidth));
         }
+    }
+
+    // A node per light with the connector pole under it; they never move,
+    // so their world matrices are computed once
+    trafficLights.reserve(positions.size());
+    for (const auto &position : positions)
+    {
+        TrafficLight tl = parts;
+        tl.state = RED;
+        tl.stateTime = 0.0f;
+        tl.node = addSceneNode(-1, vec3(position.x, poleHeight + 1, position.y), vec3(0.0, 0.0, 90.0));
+        tl.connectorNode = addSceneNode(tl.node, vec3(-connectorPoleHeight, 0.0, 0.0), vec3(0.0, 0.0, -90.0));
 
         // Add the traffic light to the vector
         trafficLights.push_back(tl);
     }
+    updateScene();
+
+    // World matrices of the parts
+    for (auto &tl : trafficLights)
+    {
+        tl.base.modelMatrix = sceneWorld(tl.node);
+        tl.lightBox.modelMatrix = sceneWorld(tl.node);
+        tl.connectorPole.modelMatrix = sceneWorld(tl.connectorNode);
+        for (int k = 0; k < 3; ++k)
+            tl.lights[k].modelMatrix = sceneWorld(tl.node);
+    }
+
+    // Stored once on the GPU, each part's matrices in one run of slots in
+    // light order, so an instanced draw of the part (props.h) finds the
+    // matrix of instance i at the first slot plus i
+    for (auto &tl : trafficLights)
+        makeStatic(tl.base);
+    for (auto &tl : trafficLights)
+        makeStatic(tl.lightBox);
+    for (auto &tl : trafficLights)
+        makeStatic(tl.connectorPole);
+    for (int k = 0; k < 3; ++k)
+    {
+        for (auto &tl : trafficLights)
+            makeStatic(tl.lights[k]);
+    }
 }
 
 bool checkCollision(Angel::vec3 newPosition)
@@ -691,7 +814,7 @@ bool checkCollision(Angel::vec3 newPosition)
     for (const auto &tl : trafficLights)
     {
         // Extract the position of the traffic light
-        vec4 tlPosition = tl.modelMatrix * vec4(0.0, 0.0, 0.0, 1.0);
+        vec4 tlPosition = sceneWorld(tl.node) * vec4(0.0, 0.0, 0.0, 1.0);
         float poleX = tlPosition.x;
         float poleZ = tlPosition.z;
 
@@ -2,6 +2,8 @@
 #define OBJECTS_H
 
 #include "Angel.h"
+#include "registry.h"
+#include "scene.h"
 #include <vector>
 
 // Define constants
@@ -14,15 +16,34 @@ typedef Angel::vec4 point4;
 // Structures for objects
 struct Object
 {
-    std::vector<point4> points;
+    std::vector<point4> points;   // Unique vertices once uploaded
     std::vector<color4> colors;
-    GLuint vao;
-    GLuint buffer;
+    std::vector<GLuint> indices;  // Triangle list into points/colors
+    MeshHandle mesh = -1;    // Uploaded geometry, shared with identical objects (registry.h)
     int numVertices;
+    int numIndices;
+    vec3 boundsMin;          // Local-space bounding box, used for culling
+    vec3 boundsMax;
     Angel::mat4 modelMatrix; // For individual object transformations
+    int matrixSlot = -1;     // Static world matrix on the GPU (transforms.h), -1 if it moves
+    int drawRecord = -1;     // First draw record of indirect mode (indirect.h), one per level
+
+    // Coarser meshes, finest first (see lod.h). lodSizes[i] is the screen
+    // size in pixels below which lods[i] is drawn; one extra size hides
+    // the object below it.
+    std::vector<Object> lods;
+    std::vector<float> lodSizes;
+    int lodLevel = 0; // Chosen level, 0 = this mesh
 };
 
-// Enum for traffic light states
+// Per-instance data for the instanced building renderer
+struct BuildingInstance
+{
+    vec4 position; // x, y, z translation, w = building height
+    color4 color;
+};
+
+// Enum for traffic light states (the value is also the index of the lit lamp)
 enum TrafficLightState
 {
     RED,
@@ -38,7 +59,8 @@ struct TrafficLight
     Object lights[3];     // The three lights (Red, Green, Yellow)
     Object connectorPole; // The connector pole connecting to the ground
     TrafficLightState state;
-    mat4 modelMatrix; // For positioning
+    SceneNode node;          // Positions the light (scene.h)
+    SceneNode connectorNode; // Connector pole, under node
     float stateTime;  // Time since last state change
 };
 
@@ -46,18 +68,42 @@ struct TrafficLight
 extern std::vector<TrafficLight> trafficLights;
 extern Object carBody;
 extern Object carWheel;
-extern std::vector<mat4> wheelTransforms;
-extern std::vector<Object> buildings;
+extern SceneNode carNode;
+extern std::vector<SceneNode> wheelNodes; // Under carNode
+extern std::vector<BuildingInstance> buildingInstances;
+extern Object buildingMesh;            // Unit building drawn once per instance
+extern GLuint buildingInstanceBuffer; // BuildingInstance array
 extern Object ground;
 extern Object roads;
+extern Object staticBatch; // Ground, roads and buildings merged in world space
+
+// Grid parameters
+extern int gridSize;
+extern int maxBuildings;
+extern bool lightGrid; // A traffic light at every intersection (--light-grid)
+const float blockSize = 10.0f; // Grid cells are half a block wide
+
+// Building footprint half-size and roof height above the walls
+const float buildingSize = 1.5f;
+const float buildingRoofHeight = 2.0f;
+
+// Weld and optimize an object's geometry and register it with the mesh registry
+void uploadObject(Object &obj, const char *name);
+
+// Fill an object with the geometry of one building, not uploaded yet
+void buildBuilding(Object &building, const BuildingInstance &instance);
 
 // Function prototypes for object creation
 void createCar();
 void createBuildings();
+void createBuildingObjects();
 void createGround();
 void createRoads();
 void createTrafficLights();
 
+// Move the car and wheel nodes to the current driving state
+void updateCarNodes();
+
 // Collision detection function
 bool checkCollision(Angel::vec3 newPosition);
 
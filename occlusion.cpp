@@ -0,0 +1,418 @@
+#include "Angel.h"
+#include "occlusion.h"
+#include "objects.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+OcclusionMode occlusionMode = OCCLUSION_SOFTWARE;
+int occluderCount = 32;
+int occlusionThreads = 0;
+
+const int TilesX = OcclusionWidth / OcclusionTileSize;
+const int TilesY = OcclusionHeight / OcclusionTileSize;
+const int TilePixels = OcclusionTileSize * OcclusionTileSize;
+
+// Occluders are shrunk slightly so that they never cover more than the
+// building they stand for, even after vertex quantization
+const float OccluderInset = 0.01f;
+
+// Depth in [0, 1], stored tile by tile so each worker owns whole cache lines.
+// Every pixel holds the farthest depth of the nearest occluder covering it.
+alignas(16) static float depthBuffer[TilesX * TilesY * TilePixels];
+static float tileMaxDepth[TilesX * TilesY]; // Hierarchical level for the tests
+
+// Job shared with the workers
+struct OccluderBox
+{
+    vec3 lo;
+    vec3 hi;
+};
+static mat4 jobViewProjection;
+static std::vector<OccluderBox> jobOccluders;
+static std::vector<std::pair<float, int>> sortedCandidates;
+
+// Worker pool; each worker owns a band of tile rows
+static std::vector<std::thread> workers;
+static std::mutex workerMutex;
+static std::condition_variable workerWake;
+static std::condition_variable workerDone;
+static long jobGeneration = 0;
+static int jobsPending = 0;
+static bool workersQuit = false;
+static bool jobActive = false;
+static double jobMilliseconds = 0.0; // Summed over workers
+
+static inline float *tileAt(int tileX, int tileY)
+{
+    return depthBuffer + (tileY * TilesX + tileX) * TilePixels;
+}
+
+struct ScreenVertex
+{
+    float x, y, z; // Pixels and depth in [0, 1]
+};
+
+// Clip a polygon in clip space against the near plane (z >= -w)
+static int clipNear(const vec4 *in, int count, vec4 *out)
+{
+    int outCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const vec4 &a = in[i];
+        const vec4 &b = in[(i + 1) % count];
+        float da = a.z + a.w;
+        float db = b.z + b.w;
+        if (da >= 0.0f)
+            out[outCount++] = a;
+        if ((da >= 0.0f) != (db >= 0.0f))
+            out[outCount++] = a + (b - a) * (da / (da - db));
+    }
+    return outCount;
+}
+
+// Draw one convex polygon into the rows [rowBegin, rowEnd). Only pixels
+// entirely inside the polygon are written, with the farthest depth the
+// polygon reaches inside the pixel, so the buffer never claims more
+// occlusion than the real geometry gives.
+static void rasterizePolygon(const ScreenVertex *v, int count, int rowBegin, int rowEnd)
+{
+    // Counter-clockwise polygons face the camera
+    float area = 0.0f;
+    for (int i = 0; i < count; ++i)
+    {
+        const ScreenVertex &a = v[i];
+        const ScreenVertex &b = v[(i + 1) % count];
+        area += a.x * b.y - b.x * a.y;
+    }
+    if (area <= 1e-6f)
+        return;
+
+    // Depth plane from the largest triangle fan entry
+    int best = 1;
+    float bestArea = 0.0f;
+    for (int i = 1; i + 1 < count; ++i)
+    {
+        float a = (v[i].x - v[0].x) * (v[i + 1].y - v[0].y) - (v[i + 1].x - v[0].x) * (v[i].y - v[0].y);
+        if (a > bestArea)
+        {
+            bestArea = a;
+            best = i;
+        }
+    }
+    if (bestArea <= 1e-6f)
+        return;
+    const ScreenVertex &p0 = v[0];
+    const ScreenVertex &p1 = v[best];
+    const ScreenVertex &p2 = v[best + 1];
+    float dzdx = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / bestArea;
+    float dzdy = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / bestArea;
+    float zBias = 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+
+    // Edge functions, non-negative inside; each is offset so that it tests
+    // the pixel corner farthest inside the edge
+    const int MaxEdges = 8;
+    float edgeA[MaxEdges], edgeB[MaxEdges], edgeC[MaxEdges];
+    float minX = v[0].x, maxX = v[0].x, minY = v[0].y, maxY = v[0].y;
+    for (int i = 0; i < count; ++i)
+    {
+        const ScreenVertex &a = v[i];
+        const ScreenVertex &b = v[(i + 1) % count];
+        edgeA[i] = a.y - b.y;
+        edgeB[i] = b.x - a.x;
+        edgeC[i] = a.x * b.y - b.x * a.y - 0.5f * (std::fabs(edgeA[i]) + std::fabs(edgeB[i]));
+        minX = std::min(minX, a.x);
+        maxX = std::max(maxX, a.x);
+        minY = std::min(minY, a.y);
+        maxY = std::max(maxY, a.y);
+    }
+
+    int x0 = std::max(0, int(std::floor(minX)));
+    int x1 = std::min(OcclusionWidth, int(std::ceil(maxX)));
+    int y0 = std::max(rowBegin, int(std::floor(minY)));
+    int y1 = std::min(rowEnd, int(std::ceil(maxY)));
+    if (x0 >= x1 || y0 >= y1)
+        return;
+    x0 &= ~3; // Four pixels at a time
+
+    for (int y = y0; y < y1; ++y)
+    {
+        float py = y + 0.5f;
+        float *row = tileAt(0, y / OcclusionTileSize) + (y % OcclusionTileSize) * OcclusionTileSize;
+        float rowDepth = p0.z + dzdy * (py - p0.y) + zBias;
+
+        for (int x = x0; x < x1; x += 4)
+        {
+            float *pixels = row + (x / OcclusionTileSize) * TilePixels + (x % OcclusionTileSize);
+            float px = x + 0.5f;
+#if defined(__SSE2__)
+            __m128 vx = _mm_add_ps(_mm_set1_ps(px), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int i = 0; i < count; ++i)
+            {
+                __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[i]), vx), _mm_set1_ps(edgeB[i] * py + edgeC[i]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(e, _mm_setzero_ps()));
+            }
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+            __m128 z = _mm_add_ps(_mm_set1_ps(rowDepth - dzdx * p0.x), _mm_mul_ps(_mm_set1_ps(dzdx), vx));
+            __m128 stored = _mm_load_ps(pixels);
+            __m128 nearer = _mm_min_ps(stored, z);
+            _mm_store_ps(pixels, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+#else
+            for (int k = 0; k < 4; ++k)
+            {
+                float sx = px + k;
+                bool inside = true;
+                for (int i = 0; i < count && inside; ++i)
+                    inside = edgeA[i] * sx + edgeB[i] * py + edgeC[i] >= 0.0f;
+                if (inside)
+                    pixels[k] = std::min(pixels[k], rowDepth + dzdx * (sx - p0.x));
+            }
+#endif
+        }
+    }
+}
+
+// Box faces as corner indices (bit 0: x, bit 1: y, bit 2: z), counter-clockwise from outside
+static const int boxFaces[6][4] = {
+    {0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+
+static void rasterizeBox(const mat4 &viewProjection, const OccluderBox &box, int rowBegin, int rowEnd)
+{
+    vec4 corners[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        vec4 p((i & 1) ? box.hi.x : box.lo.x, (i & 2) ? box.hi.y : box.lo.y, (i & 4) ? box.hi.z : box.lo.z, 1.0f);
+        corners[i] = viewProjection * p;
+    }
+
+    for (int f = 0; f < 6; ++f)
+    {
+        vec4 face[4];
+        for (int k = 0; k < 4; ++k)
+            face[k] = corners[boxFaces[f][k]];
+
+        vec4 clipped[8];
+        int count = clipNear(face, 4, clipped);
+        if (count < 3)
+            continue;
+
+        ScreenVertex screen[8];
+        for (int k = 0; k < count; ++k)
+        {
+            float invW = 1.0f / clipped[k].w;
+            screen[k].x = (clipped[k].x * invW * 0.5f + 0.5f) * OcclusionWidth;
+            screen[k].y = (clipped[k].y * invW * 0.5f + 0.5f) * OcclusionHeight;
+            screen[k].z = clipped[k].z * invW * 0.5f + 0.5f;
+        }
+        rasterizePolygon(screen, count, rowBegin, rowEnd);
+    }
+}
+
+// Clear, rasterize and reduce one band of tile rows
+static void rasterizeBand(int tileRowBegin, int tileRowEnd)
+{
+    std::fill(tileAt(0, tileRowBegin), tileAt(0, tileRowEnd), 1.0f);
+
+    int rowBegin = tileRowBegin * OcclusionTileSize;
+    int rowEnd = tileRowEnd * OcclusionTileSize;
+    for (const auto &box : jobOccluders)
+        rasterizeBox(jobViewProjection, box, rowBegin, rowEnd);
+
+    for (int ty = tileRowBegin; ty < tileRowEnd; ++ty)
+    {
+        for (int tx = 0; tx < TilesX; ++tx)
+        {
+            const float *tile = tileAt(tx, ty);
+            tileMaxDepth[ty * TilesX + tx] = *std::max_element(tile, tile + TilePixels);
+        }
+    }
+}
+
+static void workerLoop(int worker, int workerCount)
+{
+    int tileRowBegin = TilesY * worker / workerCount;
+    int tileRowEnd = TilesY * (worker + 1) / workerCount;
+    long seenGeneration = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(workerMutex);
+            workerWake.wait(lock, [&]
+                            { return workersQuit || jobGeneration != seenGeneration; });
+            if (workersQuit)
+                return;
+            seenGeneration = jobGeneration;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        rasterizeBand(tileRowBegin, tileRowEnd);
+        double ms = 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(workerMutex);
+        jobMilliseconds += ms;
+        if (--jobsPending == 0)
+            workerDone.notify_one();
+    }
+}
+
+static void stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        workersQuit = true;
+    }
+    workerWake.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+static void startWorkers()
+{
+    int count = occlusionThreads;
+    if (count <= 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+    count = std::min(count, TilesY);
+
+    for (int i = 0; i < count; ++i)
+        workers.push_back(std::thread(workerLoop, i, count));
+
+    // Threads must be joined before the process exits
+    atexit(stopWorkers);
+}
+
+// World-space box of a building's walls, used as its occluder
+static OccluderBox occluderBox(int index)
+{
+    const vec4 &position = buildingInstances[index].position;
+    OccluderBox box;
+    box.lo = vec3(position.x - buildingSize + OccluderInset, position.y, position.z - buildingSize + OccluderInset);
+    box.hi = vec3(position.x + buildingSize - OccluderInset, position.y + position.w - OccluderInset, position.z + buildingSize - OccluderInset);
+    return box;
+}
+
+void beginOcclusion(const mat4 &viewProjection, const vec4 &eye, const std::vector<int> &candidates)
+{
+    if (workers.empty())
+        startWorkers();
+
+    // The nearest buildings hide the most
+    sortedCandidates.clear();
+    for (int index : candidates)
+    {
+        const vec4 &position = buildingInstances[index].position;
+        float dx = position.x - eye.x;
+        float dz = position.z - eye.z;
+        sortedCandidates.push_back(std::make_pair(dx * dx + dz * dz, index));
+    }
+    size_t count = std::min(sortedCandidates.size(), size_t(std::max(occluderCount, 0)));
+    std::partial_sort(sortedCandidates.begin(), sortedCandidates.begin() + count, sortedCandidates.end());
+
+    std::lock_guard<std::mutex> lock(workerMutex);
+    jobViewProjection = viewProjection;
+    jobOccluders.clear();
+    for (size_t i = 0; i < count; ++i)
+        jobOccluders.push_back(occluderBox(sortedCandidates[i].second));
+    frameStats.occluders += count;
+
+    jobMilliseconds = 0.0;
+    jobsPending = workers.size();
+    jobGeneration++;
+    jobActive = true;
+    workerWake.notify_all();
+}
+
+void endOcclusion()
+{
+    std::unique_lock<std::mutex> lock(workerMutex);
+    workerDone.wait(lock, []
+                    { return jobsPending == 0; });
+    if (jobActive)
+        frameStats.occlusionMilliseconds += jobMilliseconds;
+    jobActive = false;
+}
+
+bool isBoxOccluded(const vec3 &center, const vec3 &extent)
+{
+    // Screen rectangle and nearest depth of the box
+    float minX = OcclusionWidth, maxX = 0.0f, minY = OcclusionHeight, maxY = 0.0f, minZ = 1.0f;
+    for (int i = 0; i < 8; ++i)
+    {
+        vec4 p(center.x + ((i & 1) ? extent.x : -extent.x),
+               center.y + ((i & 2) ? extent.y : -extent.y),
+               center.z + ((i & 4) ? extent.z : -extent.z), 1.0f);
+        vec4 clip = jobViewProjection * p;
+
+        // Boxes reaching the near plane are always visible
+        if (clip.z < -clip.w)
+            return false;
+
+        float invW = 1.0f / clip.w;
+        float x = (clip.x * invW * 0.5f + 0.5f) * OcclusionWidth;
+        float y = (clip.y * invW * 0.5f + 0.5f) * OcclusionHeight;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, clip.z * invW * 0.5f + 0.5f);
+    }
+
+    // Every pixel the box touches
+    int x0 = std::max(0, int(std::floor(minX)));
+    int x1 = std::min(OcclusionWidth, int(std::ceil(maxX)));
+    int y0 = std::max(0, int(std::floor(minY)));
+    int y1 = std::min(OcclusionHeight, int(std::ceil(maxY)));
+    if (x0 >= x1 || y0 >= y1)
+        return false;
+
+    for (int ty = y0 / OcclusionTileSize; ty <= (y1 - 1) / OcclusionTileSize; ++ty)
+    {
+        for (int tx = x0 / OcclusionTileSize; tx <= (x1 - 1) / OcclusionTileSize; ++tx)
+        {
+            // The whole tile is nearer than the box
+            if (tileMaxDepth[ty * TilesX + tx] < minZ)
+                continue;
+
+            const float *tile = tileAt(tx, ty);
+            int px0 = std::max(x0, tx * OcclusionTileSize), px1 = std::min(x1, (tx + 1) * OcclusionTileSize);
+            int py0 = std::max(y0, ty * OcclusionTileSize), py1 = std::min(y1, (ty + 1) * OcclusionTileSize);
+            for (int y = py0; y < py1; ++y)
+            {
+                for (int x = px0; x < px1; ++x)
+                {
+                    if (tile[(y % OcclusionTileSize) * OcclusionTileSize + x % OcclusionTileSize] >= minZ)
+                        return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool isBuildingOccluded(int index)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Whole building, roof included
+    const vec4 &position = buildingInstances[index].position;
+    float height = position.w + buildingRoofHeight;
+    vec3 center(position.x, position.y + height * 0.5f, position.z);
+    vec3 extent(buildingSize, height * 0.5f, buildingSize);
+    bool occluded = isBoxOccluded(center, extent);
+
+    frameStats.occlusionTests++;
+    if (occluded)
+        frameStats.occludedObjects++;
+    frameStats.occlusionMilliseconds += 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return occluded;
+}
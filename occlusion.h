@@ -0,0 +1,40 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "Angel.h"
+#include <vector>
+
+// Software occlusion culling: the walls of the nearest buildings are drawn
+// into a small depth buffer on worker threads, and the bounding boxes of the
+// other buildings are tested against it before they are drawn.
+
+// Occlusion culling of buildings in per-object mode
+enum OcclusionMode
+{
+    OCCLUSION_OFF,
+    OCCLUSION_SOFTWARE, // CPU depth buffer of the nearest buildings
+    OCCLUSION_QUERIES   // GPU occlusion queries per block (queries.cpp)
+};
+extern OcclusionMode occlusionMode; // Cycled with 'o'
+extern int occluderCount;           // Nearest buildings used as occluders
+extern int occlusionThreads;        // Worker threads, 0 picks one per core
+
+// Depth buffer size, in 8x8 tiles
+const int OcclusionTileSize = 8;
+const int OcclusionWidth = 256;
+const int OcclusionHeight = 192;
+
+// Pick occluders among the candidate buildings (indices into
+// buildingInstances) and start rasterizing them in the background
+void beginOcclusion(const mat4 &viewProjection, const vec4 &eye, const std::vector<int> &candidates);
+
+// Wait for the depth buffer; must be called before testing
+void endOcclusion();
+
+// True if a world-space box is hidden behind the occluders
+bool isBoxOccluded(const vec3 &center, const vec3 &extent);
+
+// Same, for a building of buildingInstances
+bool isBuildingOccluded(int index);
+
+#endif
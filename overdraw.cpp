@@ -0,0 +1,111 @@
+#include "Angel.h"
+#include "overdraw.h"
+#include "glstate.h"
+#include "stats.h"
+#include <vector>
+
+bool overdrawMode = false;
+
+extern GLuint program;
+
+// Frames between two overdraw reports on the console
+const int OverdrawReportInterval = 30;
+
+static GLuint overdrawProgram = 0;
+static GLuint emptyVao = 0;
+static GLuint targetFbo = 0;
+static GLuint targetTexture = 0;
+static GLuint targetDepth = 0;
+static int targetWidth = 0, targetHeight = 0;
+static GLint previousFramebuffer = 0;
+static std::vector<GLfloat> counts;
+static int reportFrame = 0;
+
+// Float color target and depth buffer the size of the viewport
+static void createTarget(int width, int height)
+{
+    if (targetFbo == 0)
+    {
+        glGenFramebuffers(1, &targetFbo);
+        glGenTextures(1, &targetTexture);
+        glGenRenderbuffers(1, &targetDepth);
+
+        overdrawProgram = InitShader("voverdraw.glsl", "foverdraw.glsl");
+        glUseProgram(overdrawProgram);
+        glUniform1i(glGetUniformLocation(overdrawProgram, "uOverdraw"), 0);
+        glUseProgram(program);
+        glGenVertexArrays(1, &emptyVao);
+        resetGLState();
+    }
+
+    glBindTexture(GL_TEXTURE_2D, targetTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindRenderbuffer(GL_RENDERBUFFER, targetDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, targetDepth);
+
+    targetWidth = width;
+    targetHeight = height;
+    counts.resize(4 * width * height);
+}
+
+void beginOverdraw()
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+
+    if (viewport[2] != targetWidth || viewport[3] != targetHeight)
+        createTarget(viewport[2], viewport[3]);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+
+    GLfloat clearColor[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+    // Every opaque fragment has alpha 1: alpha counts them, color is dropped
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_ZERO, GL_ONE, GL_ONE, GL_ONE);
+}
+
+void endOverdraw()
+{
+    glDisable(GL_BLEND);
+
+    // Average over all pixels, and over the pixels drawn at least once
+    glReadPixels(0, 0, targetWidth, targetHeight, GL_RGBA, GL_FLOAT, &counts[0]);
+    double total = 0.0;
+    long covered = 0;
+    for (size_t i = 3; i < counts.size(); i += 4)
+    {
+        total += counts[i];
+        covered += counts[i] > 0.0f;
+    }
+    frameStats.overdraw = total / (targetWidth * targetHeight);
+    frameStats.overdrawCovered = covered > 0 ? total / covered : 0.0;
+
+    if (!benchMode && ++reportFrame >= OverdrawReportInterval)
+    {
+        printf("Overdraw: %.2f per pixel, %.2f per covered pixel\n", frameStats.overdraw, frameStats.overdrawCovered);
+        reportFrame = 0;
+    }
+
+    // Heat map over the whole frame
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glDisable(GL_DEPTH_TEST);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, targetTexture);
+    useProgram(overdrawProgram);
+    bindVertexArray(emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    countGLCall();
+    useProgram(program);
+    glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,20 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include "Angel.h"
+
+// Overdraw measurement: the frame is rendered into an offscreen float target
+// with additive blending, so that every fragment passing the depth test adds
+// one to its pixel. The counts are read back and averaged, and shown on
+// screen as a heat map (black 0, blue 1, green 2, yellow 3, red 4 or more).
+
+extern bool overdrawMode; // Toggled with 'v'
+
+// Redirect drawing into the counting target; call after the frame is cleared
+void beginOverdraw();
+
+// Read back the counts into frameStats, restore the framebuffer and draw the
+// heat map over the frame
+void endOverdraw();
+
+#endif
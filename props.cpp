@@ -0,0 +1,127 @@
+#include "Angel.h"
+#include "props.h"
+#include "objects.h"
+#include "display.h"
+#include "globals.h"
+#include "ring.h"
+#include "glstate.h"
+#include <algorithm>
+#include <vector>
+
+bool instancedProps = true;
+
+extern GLuint program;
+
+// Parts in the order of their matrix runs: base, light box, connector pole,
+// then the lamps
+const int PropParts = 6;
+
+// One draw per part: the part's mesh, the world box of all its instances
+// and the slot of the first light's matrix
+static Object props[PropParts];
+static GLuint stateTexture = 0;
+static GLint stateBase = -1; // Location of uLightStateBase
+static bool stateRangeSupported = false;
+static std::vector<GLubyte> states;
+
+static const Object &part(const TrafficLight &tl, int index)
+{
+    switch (index)
+    {
+    case 0:
+        return tl.base;
+    case 1:
+        return tl.lightBox;
+    case 2:
+        return tl.connectorPole;
+    default:
+        return tl.lights[index - 3];
+    }
+}
+
+// Grow a world box by an object's local bounds under its world matrix
+static void addWorldBounds(const Object &obj, vec3 &lo, vec3 &hi)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        vec4 corner((i & 1) ? obj.boundsMax.x : obj.boundsMin.x,
+                    (i & 2) ? obj.boundsMax.y : obj.boundsMin.y,
+                    (i & 4) ? obj.boundsMax.z : obj.boundsMin.z, 1.0);
+        vec4 world = obj.modelMatrix * corner;
+        for (int k = 0; k < 3; ++k)
+        {
+            lo[k] = std::min(lo[k], world[k]);
+            hi[k] = std::max(hi[k], world[k]);
+        }
+    }
+}
+
+void createProps()
+{
+    if (trafficLights.empty())
+        return;
+
+    for (int p = 0; p < PropParts; ++p)
+    {
+        const Object &first = part(trafficLights[0], p);
+        Object &prop = props[p];
+        prop.mesh = first.mesh;
+        prop.numVertices = first.numVertices;
+        prop.numIndices = first.numIndices;
+        prop.matrixSlot = first.matrixSlot;
+        prop.modelMatrix = mat4(); // The bounds are already in world space
+
+        vec3 lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+        for (const auto &tl : trafficLights)
+            addWorldBounds(part(tl, p), lo, hi);
+        prop.boundsMin = lo;
+        prop.boundsMax = hi;
+    }
+
+    // One byte per light, read as an unsigned integer in the shader; the
+    // texture views the ring buffer, attached when the states are written
+    glGenTextures(1, &stateTexture);
+    stateRangeSupported = glewIsSupported("GL_VERSION_4_3") || glewIsSupported("GL_ARB_texture_buffer_range");
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "uLightStates"), LightStatesUnit);
+    stateBase = glGetUniformLocation(program, "uLightStateBase");
+    glUniform1i(stateBase, 0);
+    states.resize(trafficLights.size());
+}
+
+bool isInstancedPropsActive()
+{
+    return instancedProps && staticRenderMode != RENDER_INDIRECT && !trafficLights.empty();
+}
+
+// Write the light states to the ring, which only keeps them for the frame,
+// and point the texture at them: at the range itself where texture buffer
+// ranges are supported, otherwise at the whole ring with the offset of the
+// states as the base texel
+static void uploadLightStates()
+{
+    for (size_t i = 0; i < trafficLights.size(); ++i)
+        states[i] = GLubyte(trafficLights[i].state);
+    GLintptr offset = writeRing(&states[0], states.size());
+
+    glActiveTexture(GL_TEXTURE0 + LightStatesUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, stateTexture);
+    if (stateRangeSupported)
+        glTexBufferRange(GL_TEXTURE_BUFFER, GL_R8UI, ringBuffer(), offset, states.size());
+    else
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R8UI, ringBuffer());
+    glActiveTexture(GL_TEXTURE0);
+
+    useProgram(program);
+    setUniform1i(stateBase, stateRangeSupported ? 0 : GLint(offset));
+}
+
+void drawProps()
+{
+    uploadLightStates();
+
+    int count = trafficLights.size();
+    for (int p = 0; p < PropParts; ++p)
+        drawObjectInstanced(props[p], count, p >= 3 ? p - 3 : -1);
+}
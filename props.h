@@ -0,0 +1,28 @@
+#ifndef PROPS_H
+#define PROPS_H
+
+#include "Angel.h"
+
+// Instanced props: every traffic light part (pole, light box, connector and
+// the three lamps) is drawn for all lights with one instanced draw. Instance
+// i takes its world matrix from the static matrix buffer at the part's first
+// slot plus i (createTrafficLights() stores them in that order) and, for the
+// lamps, the state of light i from a texture buffer over the ring buffer,
+// one byte per light written each frame. The work per frame is six draws,
+// however many lights there are; the draws are culled as a whole, not light
+// by light.
+
+extern bool instancedProps; // Off with --no-instanced-props, toggled with 'k'
+
+const int LightStatesUnit = 3; // Texture unit of the light state buffer
+
+// Build the per-part draws; called from init() after the traffic lights
+void createProps();
+
+// True while display() should leave the traffic lights to drawProps()
+bool isInstancedPropsActive();
+
+// Record the instanced draws of all traffic lights
+void drawProps();
+
+#endif
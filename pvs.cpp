@@ -0,0 +1,611 @@
+#include "Angel.h"
+#include "pvs.h"
+#include "objects.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <tuple>
+
+bool pvsCulling = false;
+const char *pvsFile = "city.pvs";
+bool verifyPvs = false;
+
+// One set per grid cell and eye offset, cells row by row from
+// (-gridSize, -gridSize); only road cells are filled
+static std::vector<std::vector<int>> pvsSets;
+static std::atomic<bool> pvsReady(false);
+
+// Build started by startPVSBuild(), stopped if the process exits first
+static std::thread *pvsThread = NULL;
+static std::atomic<bool> pvsCancelled(false);
+
+// Bump when the sampling below changes, to invalidate cached files
+const int PvsVersion = 2;
+
+// Camera offsets from the car for the street-level views. The car only turns
+// in steps of 90 degrees, so each view has four possible offsets; each
+// offset gets its own set.
+struct EyeOffset
+{
+    float dx, dz, y;
+    float spread; // Half size of the area the eye covers within the cell
+};
+static const EyeOffset eyeOffsets[] = {
+    {0.0f, 0.0f, 2.0f, 3.0f}, // Driver view, 0.5 behind the car center
+    {5.0f, 0.0f, 3.0f, 2.5f}, // Default view behind the car, side view
+    {-5.0f, 0.0f, 3.0f, 2.5f},
+    {0.0f, 5.0f, 3.0f, 2.5f},
+    {0.0f, -5.0f, 3.0f, 2.5f}};
+const int NumEyeOffsets = sizeof(eyeOffsets) / sizeof(EyeOffset);
+const int EyeSamplesPerAxis = 7;
+
+// Eye points per axis of the dense sampling that --verify-pvs checks the
+// sets against
+const int VerifySamplesPerAxis = 11;
+
+// Walls are lowered slightly so that they only block what the real mesh does
+const float BlockerInset = 0.01f;
+
+static int cellsPerRow()
+{
+    return 2 * gridSize + 1;
+}
+
+static bool isRoadCell(int gridX, int gridZ)
+{
+    return gridX % 2 == 0 || gridZ % 2 == 0;
+}
+
+// Hash of everything the sets depend on
+static unsigned int cityHash()
+{
+    unsigned int hash = 2166136261u;
+    auto mix = [&hash](const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 16777619u;
+    };
+    mix(&PvsVersion, sizeof(PvsVersion));
+    mix(&gridSize, sizeof(gridSize));
+    for (const auto &instance : buildingInstances)
+        mix(&instance.position, sizeof(instance.position));
+    return hash;
+}
+
+// The city is 2.5D: every building is a prism standing on the ground. Seen
+// from one eye point, a building hides whatever lies behind it, in the
+// directions it covers, below the slope from the eye over its walls. Each eye
+// keeps that slope per azimuth bin (a horizon), filled front to back.
+const int AzimuthBins = 2048;
+
+struct Prism
+{
+    float nearDistance, farDistance; // Horizontal, from the eye
+    float lo, hi;                    // Azimuth range in bins, lo <= hi
+    bool containsEye;
+};
+
+// A footprint of half size halfSize around the building's position
+static Prism measurePrism(const vec3 &eye, const vec4 &position, float halfSize)
+{
+    Prism prism;
+    float dx = std::max(std::fabs(position.x - eye.x) - halfSize, 0.0f);
+    float dz = std::max(std::fabs(position.z - eye.z) - halfSize, 0.0f);
+    prism.nearDistance = std::sqrt(dx * dx + dz * dz);
+    prism.containsEye = prism.nearDistance == 0.0f;
+
+    // Corner angles around the direction of the center, which never wrap
+    // since the eye is outside the footprint
+    float centerAngle = std::atan2(position.z - eye.z, position.x - eye.x);
+    float minAngle = 0.0f, maxAngle = 0.0f;
+    prism.farDistance = 0.0f;
+    for (int i = 0; i < 4; ++i)
+    {
+        float cx = position.x + ((i & 1) ? halfSize : -halfSize) - eye.x;
+        float cz = position.z + ((i & 2) ? halfSize : -halfSize) - eye.z;
+        prism.farDistance = std::max(prism.farDistance, std::sqrt(cx * cx + cz * cz));
+
+        float delta = std::atan2(cz, cx) - centerAngle;
+        if (delta > M_PI)
+            delta -= 2.0f * M_PI;
+        else if (delta < -M_PI)
+            delta += 2.0f * M_PI;
+        minAngle = std::min(minAngle, delta);
+        maxAngle = std::max(maxAngle, delta);
+    }
+
+    float binsPerRadian = AzimuthBins / (2.0f * M_PI);
+    prism.lo = (centerAngle + minAngle + M_PI) * binsPerRadian;
+    prism.hi = (centerAngle + maxAngle + M_PI) * binsPerRadian;
+    return prism;
+}
+
+static inline int wrapBin(int bin)
+{
+    return ((bin % AzimuthBins) + AzimuthBins) % AzimuthBins;
+}
+
+// Direction of each bin edge
+static float binCos[AzimuthBins + 1], binSin[AzimuthBins + 1];
+
+static void initBinDirections()
+{
+    for (int bin = 0; bin <= AzimuthBins; ++bin)
+    {
+        float angle = 2.0f * M_PI * bin / AzimuthBins - M_PI;
+        binCos[bin] = std::cos(angle);
+        binSin[bin] = std::sin(angle);
+    }
+}
+
+// Horizontal distance at which a ray from the eye enters a footprint
+static float entryDistance(const vec3 &eye, const vec4 &position, float halfSize, float c, float s)
+{
+    float t = 0.0f;
+    if (c != 0.0f)
+        t = std::max(t, (position.x - (c > 0.0f ? halfSize : -halfSize) - eye.x) / c);
+    if (s != 0.0f)
+        t = std::max(t, (position.z - (s > 0.0f ? halfSize : -halfSize) - eye.z) / s);
+    return t;
+}
+
+// Slope of a point r above the eye at horizontal distance between near and far
+static inline float maxSlope(float rise, float nearDistance, float farDistance)
+{
+    return rise > 0.0f ? rise / nearDistance : rise / farDistance;
+}
+
+// Work arrays of one thread
+struct EyeScratch
+{
+    std::vector<Prism> targets, occluders;
+    std::vector<int> byNear, byFar;
+    std::vector<float> horizon;
+    std::vector<char> wanted;      // Bins covered by buildings not in the set yet
+    std::vector<int> wantedBefore; // Wanted bins below each bin
+
+    EyeScratch(int count)
+        : targets(count), occluders(count), horizon(AzimuthBins), wanted(AzimuthBins), wantedBefore(AzimuthBins + 1)
+    {
+        byNear.reserve(count);
+        byFar.reserve(count);
+    }
+
+    // Whether any of the bins first to last - 1, wrapped, is wanted
+    bool anyWanted(int first, int last) const
+    {
+        if (last - first >= AzimuthBins)
+            return true;
+        if (last <= first)
+            return false;
+        int begin = wrapBin(first);
+        int end = begin + last - first;
+        if (end <= AzimuthBins)
+            return wantedBefore[end] > wantedBefore[begin];
+        return wantedBefore[AzimuthBins] > wantedBefore[begin] || wantedBefore[end - AzimuthBins] > 0;
+    }
+};
+
+// Add to the set every building seen from one eye point, or from any point
+// within margin of it on each horizontal axis. A clear ray from an eye moved
+// by d, moved back by d, starts at this eye, misses every occluder shrunk by
+// margin and ends in the target grown by margin.
+// Buildings already in the set are skipped, and the horizon is only filled
+// in the bins that the others cover, the only ones read, by the buildings
+// nearer than the farthest of them.
+static void markVisibleFrom(const vec3 &eye, float margin, EyeScratch &scratch, std::vector<char> &visible)
+{
+    std::vector<Prism> &targets = scratch.targets;
+    std::vector<Prism> &occluders = scratch.occluders;
+    std::vector<int> &byNear = scratch.byNear;
+    std::vector<int> &byFar = scratch.byFar;
+    std::vector<float> &horizon = scratch.horizon;
+    std::vector<char> &wanted = scratch.wanted;
+    float occluderSize = buildingSize - margin;
+
+    int count = buildingInstances.size();
+    byNear.clear();
+    std::fill(wanted.begin(), wanted.end(), false);
+    float farthestTarget = 0.0f;
+    for (int k = 0; k < count; ++k)
+    {
+        if (visible[k])
+            continue;
+        targets[k] = measurePrism(eye, buildingInstances[k].position, buildingSize + margin);
+        byNear.push_back(k);
+        farthestTarget = std::max(farthestTarget, targets[k].nearDistance);
+        for (int bin = int(std::floor(targets[k].lo)); bin <= int(std::floor(targets[k].hi)); ++bin)
+            wanted[wrapBin(bin)] = true;
+    }
+    if (byNear.empty())
+        return;
+    for (int bin = 0; bin < AzimuthBins; ++bin)
+        scratch.wantedBefore[bin + 1] = scratch.wantedBefore[bin] + wanted[bin];
+
+    // A footprint's farthest corner is no nearer than its center
+    byFar.clear();
+    for (int k = 0; k < count; ++k)
+    {
+        const vec4 &position = buildingInstances[k].position;
+        float cx = position.x - eye.x, cz = position.z - eye.z;
+        if (cx * cx + cz * cz > farthestTarget * farthestTarget)
+            continue;
+
+        occluders[k] = measurePrism(eye, position, occluderSize);
+        const Prism &o = occluders[k];
+        if (!o.containsEye && o.farDistance <= farthestTarget &&
+            scratch.anyWanted(int(std::ceil(o.lo)), int(std::floor(o.hi))))
+            byFar.push_back(k);
+    }
+    std::sort(byNear.begin(), byNear.end(), [&targets](int a, int b)
+              { return targets[a].nearDistance < targets[b].nearDistance; });
+    std::sort(byFar.begin(), byFar.end(), [&occluders](int a, int b)
+              { return occluders[a].farDistance < occluders[b].farDistance; });
+    std::fill(horizon.begin(), horizon.end(), -FLT_MAX);
+
+    int nextOccluder = 0;
+    for (int target : byNear)
+    {
+        const Prism &t = targets[target];
+
+        // Only buildings entirely nearer than the target can hide it
+        while (nextOccluder < int(byFar.size()) && occluders[byFar[nextOccluder]].farDistance <= t.nearDistance)
+        {
+            int index = byFar[nextOccluder++];
+            const Prism &o = occluders[index];
+
+            // Every ray of a bin entirely inside the prism enters the walls
+            // no farther than at the bin edges, so it is blocked below the
+            // slope to the top of the walls there
+            const vec4 &position = buildingInstances[index].position;
+            float rise = position.y + position.w - BlockerInset - eye.y;
+            for (int bin = int(std::ceil(o.lo)); bin < int(std::floor(o.hi)); ++bin)
+            {
+                int b = wrapBin(bin);
+                if (!wanted[b])
+                    continue;
+                float slope = rise / o.nearDistance;
+                if (rise > 0.0f)
+                {
+                    float entry = std::max(entryDistance(eye, position, occluderSize, binCos[b], binSin[b]),
+                                           entryDistance(eye, position, occluderSize, binCos[b + 1], binSin[b + 1]));
+                    slope = rise / std::min(entry, o.farDistance);
+                }
+                horizon[b] = std::max(horizon[b], slope);
+            }
+        }
+
+        if (visible[target])
+            continue;
+        if (t.containsEye)
+        {
+            visible[target] = true;
+            continue;
+        }
+
+        // Highest slope to any point of the building: the top of the walls
+        // at the nearest point, or the roof, which rises as it moves away.
+        // The apex lies at least buildingSize inside the grown footprint.
+        const vec4 &position = buildingInstances[target].position;
+        float wallRise = position.y + position.w - eye.y;
+        float slope = std::max(maxSlope(wallRise, t.nearDistance, t.farDistance),
+                               maxSlope(wallRise + buildingRoofHeight, t.nearDistance + buildingSize, t.farDistance));
+        for (int bin = int(std::floor(t.lo)); bin <= int(std::floor(t.hi)); ++bin)
+        {
+            if (slope > horizon[wrapBin(bin)])
+            {
+                visible[target] = true;
+                break;
+            }
+        }
+    }
+}
+
+// Center of the area the eye covers for the car in a cell
+static vec3 eyeCenter(int gridX, int gridZ, const EyeOffset &offset)
+{
+    float cellSize = blockSize / 2.0f;
+    return vec3(gridX * cellSize + offset.dx, offset.y, gridZ * cellSize + offset.dz);
+}
+
+// The buildings seen from a grid of samples x samples eye points spread
+// over where the car can be in the cell. When conservative, each point also
+// covers the eyes up to halfway to its neighbours, so the set holds
+// everything seen from anywhere in the cell.
+static void computeSet(const vec3 &center, const EyeOffset &offset, int samples, bool conservative,
+                       EyeScratch &scratch, std::vector<int> &set)
+{
+    int count = buildingInstances.size();
+    std::vector<char> visible(count, false);
+
+    float margin = conservative ? offset.spread / (samples - 1) : 0.0f;
+    for (int i = 0; i < samples; ++i)
+    {
+        for (int j = 0; j < samples; ++j)
+        {
+            float s = 2.0f * i / (samples - 1) - 1.0f;
+            float t = 2.0f * j / (samples - 1) - 1.0f;
+            vec3 eye(center.x + s * offset.spread, center.y, center.z + t * offset.spread);
+            markVisibleFrom(eye, margin, scratch, visible);
+        }
+    }
+
+    for (int k = 0; k < count; ++k)
+    {
+        if (visible[k])
+            set.push_back(k);
+    }
+}
+
+// Run work(job, scratch) for jobs 0 to jobCount - 1 on worker threads, which
+// take the next job from a shared counter until done or cancelled
+template <typename Work>
+static void runOnWorkers(int jobCount, Work work)
+{
+    initBinDirections();
+
+    std::atomic<int> nextJob(0);
+    auto worker = [&]()
+    {
+        EyeScratch scratch(buildingInstances.size());
+        for (int job = nextJob++; job < jobCount && !pvsCancelled; job = nextJob++)
+            work(job, scratch);
+    };
+
+    int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; ++i)
+        threads.push_back(std::thread(worker));
+    for (auto &thread : threads)
+        thread.join();
+}
+
+// Run cellWork(gridX, gridZ, cell, scratch) for every road cell
+template <typename CellWork>
+static void forEachRoadCell(CellWork cellWork)
+{
+    runOnWorkers(cellsPerRow() * cellsPerRow(), [&](int cell, EyeScratch &scratch)
+                 {
+                     int gridX = cell / cellsPerRow() - gridSize;
+                     int gridZ = cell % cellsPerRow() - gridSize;
+                     if (isRoadCell(gridX, gridZ))
+                         cellWork(gridX, gridZ, cell, scratch);
+                 });
+}
+
+// Sets whose eyes cover the same area are computed once: the side views of
+// a cell look from the center of the next cell but one, which is where the
+// opposite side view of that cell looks from too
+static void computePVS()
+{
+    std::map<std::tuple<float, float, float, float>, int> areaIndex;
+    std::vector<int> areaOf(pvsSets.size(), -1);
+    std::vector<int> areaSet; // First set of each area
+    for (int cell = 0; cell < cellsPerRow() * cellsPerRow(); ++cell)
+    {
+        if (!isRoadCell(cell / cellsPerRow() - gridSize, cell % cellsPerRow() - gridSize))
+            continue;
+        for (int e = 0; e < NumEyeOffsets; ++e)
+        {
+            vec3 center = eyeCenter(cell / cellsPerRow() - gridSize, cell % cellsPerRow() - gridSize, eyeOffsets[e]);
+            auto key = std::make_tuple(center.x, center.z, center.y, eyeOffsets[e].spread);
+            auto found = areaIndex.find(key);
+            if (found == areaIndex.end())
+            {
+                found = areaIndex.insert(std::make_pair(key, int(areaSet.size()))).first;
+                areaSet.push_back(cell * NumEyeOffsets + e);
+            }
+            areaOf[cell * NumEyeOffsets + e] = found->second;
+        }
+    }
+
+    runOnWorkers(areaSet.size(), [&](int area, EyeScratch &scratch)
+                 {
+                     int set = areaSet[area];
+                     int cell = set / NumEyeOffsets;
+                     const EyeOffset &offset = eyeOffsets[set % NumEyeOffsets];
+                     computeSet(eyeCenter(cell / cellsPerRow() - gridSize, cell % cellsPerRow() - gridSize, offset),
+                                offset, EyeSamplesPerAxis, true, scratch, pvsSets[set]);
+                 });
+
+    for (size_t set = 0; set < pvsSets.size(); ++set)
+    {
+        if (areaOf[set] >= 0 && areaSet[areaOf[set]] != int(set))
+            pvsSets[set] = pvsSets[areaSet[areaOf[set]]];
+    }
+}
+
+// Compare every set with the buildings seen from dense eye points, and
+// report the sets that miss any
+static void checkPVS()
+{
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<int> incompleteSets(0), missingBuildings(0);
+    forEachRoadCell([&](int gridX, int gridZ, int cell, EyeScratch &scratch)
+                    {
+                        for (int e = 0; e < NumEyeOffsets; ++e)
+                        {
+                            std::vector<int> dense;
+                            computeSet(eyeCenter(gridX, gridZ, eyeOffsets[e]), eyeOffsets[e], VerifySamplesPerAxis,
+                                       false, scratch, dense);
+                            const std::vector<int> &set = pvsSets[cell * NumEyeOffsets + e];
+                            int missing = 0;
+                            for (int k : dense)
+                                missing += !std::binary_search(set.begin(), set.end(), k);
+                            if (missing > 0)
+                            {
+                                incompleteSets++;
+                                missingBuildings += missing;
+                            }
+                        }
+                    });
+    if (pvsCancelled)
+        return;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int roadCells = 0;
+    for (int cell = 0; cell < cellsPerRow() * cellsPerRow(); ++cell)
+        roadCells += isRoadCell(cell / cellsPerRow() - gridSize, cell % cellsPerRow() - gridSize);
+    printf("PVS check against %dx%d eye points: %d of %d sets miss buildings (%d in all), %.2f s\n",
+           VerifySamplesPerAxis, VerifySamplesPerAxis, int(incompleteSets), roadCells * NumEyeOffsets,
+           int(missingBuildings), seconds);
+}
+
+static bool loadPVS(unsigned int hash)
+{
+    FILE *fp = fopen(pvsFile, "rb");
+    if (fp == NULL)
+        return false;
+
+    char magic[4];
+    unsigned int fileHash = 0;
+    int cellCount = 0;
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "PVS1", 4) == 0 &&
+              fread(&fileHash, sizeof(fileHash), 1, fp) == 1 && fileHash == hash &&
+              fread(&cellCount, sizeof(cellCount), 1, fp) == 1 && cellCount == int(pvsSets.size());
+
+    for (int cell = 0; ok && cell < cellCount; ++cell)
+    {
+        int count = 0;
+        ok = fread(&count, sizeof(count), 1, fp) == 1 && count >= 0 && count <= int(buildingInstances.size());
+        if (ok && count > 0)
+        {
+            pvsSets[cell].resize(count);
+            ok = fread(&pvsSets[cell][0], sizeof(int), count, fp) == size_t(count);
+        }
+    }
+    fclose(fp);
+
+    if (!ok)
+    {
+        for (auto &set : pvsSets)
+            set.clear();
+    }
+    return ok;
+}
+
+static void savePVS(unsigned int hash)
+{
+    FILE *fp = fopen(pvsFile, "wb");
+    if (fp == NULL)
+    {
+        std::cerr << "Cannot write PVS file " << pvsFile << std::endl;
+        return;
+    }
+
+    int cellCount = pvsSets.size();
+    fwrite("PVS1", 1, 4, fp);
+    fwrite(&hash, sizeof(hash), 1, fp);
+    fwrite(&cellCount, sizeof(cellCount), 1, fp);
+    for (const auto &set : pvsSets)
+    {
+        int count = set.size();
+        fwrite(&count, sizeof(count), 1, fp);
+        if (count > 0)
+            fwrite(&set[0], sizeof(int), count, fp);
+    }
+    fclose(fp);
+}
+
+static void loadOrComputePVS()
+{
+    pvsSets.assign(cellsPerRow() * cellsPerRow() * NumEyeOffsets, std::vector<int>());
+    unsigned int hash = cityHash();
+
+    auto start = std::chrono::steady_clock::now();
+    bool loaded = loadPVS(hash);
+    if (!loaded)
+    {
+        computePVS();
+        if (pvsCancelled)
+            return;
+        savePVS(hash);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    long total = 0;
+    int roadCells = 0;
+    for (int cell = 0; cell < cellsPerRow() * cellsPerRow(); ++cell)
+    {
+        for (int e = 0; e < NumEyeOffsets; ++e)
+            total += pvsSets[cell * NumEyeOffsets + e].size();
+        roadCells += isRoadCell(cell / cellsPerRow() - gridSize, cell % cellsPerRow() - gridSize);
+    }
+    int sets = roadCells * NumEyeOffsets;
+    printf("PVS %s %s: %d road cells, %.1f of %d buildings per set, %.2f s\n",
+           loaded ? "loaded from" : "built and saved to", pvsFile, roadCells,
+           sets > 0 ? double(total) / sets : 0.0, int(buildingInstances.size()), seconds);
+    if (verifyPvs)
+        checkPVS();
+
+    pvsReady = true;
+}
+
+static void stopPVSBuild()
+{
+    pvsCancelled = true;
+    if (pvsThread->joinable())
+        pvsThread->join();
+}
+
+void buildPVS()
+{
+    if (pvsThread != NULL)
+    {
+        if (pvsThread->joinable())
+            pvsThread->join();
+        return;
+    }
+    if (!pvsReady)
+        loadOrComputePVS();
+}
+
+void startPVSBuild()
+{
+    if (pvsReady || pvsThread != NULL)
+        return;
+
+    pvsThread = new std::thread(loadOrComputePVS);
+
+    // The thread must be joined before the process exits
+    atexit(stopPVSBuild);
+}
+
+bool isPVSReady()
+{
+    return pvsReady;
+}
+
+const std::vector<int> *lookupPVS(const vec3 &carPosition, const vec4 &eye)
+{
+    if (!pvsReady)
+        return NULL;
+
+    // Same cell rounding as checkCollision()
+    float cellSize = blockSize / 2.0f;
+    int gridX = static_cast<int>(round(carPosition.x / cellSize));
+    int gridZ = static_cast<int>(round(carPosition.z / cellSize));
+    if (gridX < -gridSize || gridX > gridSize || gridZ < -gridSize || gridZ > gridSize || !isRoadCell(gridX, gridZ))
+        return NULL;
+
+    // The set whose eye offset matches the camera; other cameras, like the
+    // overhead view, have none
+    for (int e = 0; e < NumEyeOffsets; ++e)
+    {
+        const EyeOffset &offset = eyeOffsets[e];
+        if (std::fabs(eye.x - carPosition.x - offset.dx) <= offset.spread - 2.5f + 0.01f &&
+            std::fabs(eye.z - carPosition.z - offset.dz) <= offset.spread - 2.5f + 0.01f &&
+            std::fabs(eye.y - carPosition.y - offset.y) <= 0.01f)
+        {
+            int cell = (gridX + gridSize) * cellsPerRow() + (gridZ + gridSize);
+            return &pvsSets[cell * NumEyeOffsets + e];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include "Angel.h"
+#include <vector>
+
+// Potentially visible sets: for every road cell, the buildings that can be
+// seen from the street-level cameras (F1, F3, F4) while the car is in that
+// cell, one set per camera offset. Built once on worker threads and cached
+// on disk; toggling them on at run time builds them in the background.
+
+extern bool pvsCulling;      // Toggled with 'p', enabled at start with --pvs
+extern const char *pvsFile;  // Cache file, set with --pvs-file
+extern bool verifyPvs;       // Check the sets against dense eye sampling (--verify-pvs)
+
+// Load the sets from pvsFile, or compute and save them if the file is
+// missing or was built for another city; returns once they are ready
+void buildPVS();
+
+// Load or compute the sets on a background thread; until they are ready,
+// lookupPVS() finds none and the frame is drawn without them
+void startPVSBuild();
+bool isPVSReady();
+
+// The set of the car's cell for the camera at eye, or NULL when there is
+// none for that camera
+const std::vector<int> *lookupPVS(const vec3 &carPosition, const vec4 &eye);
+
+#endif
@@ -0,0 +1,253 @@
+#include "Angel.h"
+#include "queries.h"
+#include "objects.h"
+#include "display.h"
+#include "spatial.h"
+#include "culling.h"
+#include "stats.h"
+#include "lod.h"
+#include "drawlist.h"
+#include "glstate.h"
+#include "arena.h"
+#include "registry.h"
+#include "world.h"
+#include <algorithm>
+
+int visibleQueryInterval = 4;
+
+extern GLuint program;
+extern GLuint Model, ModelIndex, PositionScale, PositionOffset, Instanced, InstancedProps, LampSlot;
+
+// Query state of one quadtree node; only leaves are queried
+struct BlockQuery
+{
+    GLuint query;
+    bool visible;    // Result of the last query that completed
+    bool pending;    // Issued, result not read yet
+    int lastQueried; // Frame of the last query
+};
+
+static std::vector<BlockQuery> blockQueries;
+static Object queryBox; // Unit cube drawn for the queries of hidden blocks
+static int queryFrame = 0;
+
+static std::vector<int> leaves;
+static std::vector<std::pair<float, int>> sortedLeaves;
+static std::vector<int> leafBuildings;
+
+// A block this close to the eye may be cut by the near plane, which would
+// hide its box from the query
+const float QueryNearMargin = 1.0f;
+
+static void createBlockQueries()
+{
+    if (queryBox.numVertices == 0)
+    {
+        // Unit cube centered on the origin
+        static const int faces[6][4] = {
+            {0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+        for (int f = 0; f < 6; ++f)
+        {
+            const int triangles[6] = {0, 1, 2, 0, 2, 3};
+            for (int k = 0; k < 6; ++k)
+            {
+                int corner = faces[f][triangles[k]];
+                queryBox.points.push_back(point4((corner & 1) ? 0.5 : -0.5, (corner & 2) ? 0.5 : -0.5, (corner & 4) ? 0.5 : -0.5, 1.0));
+                queryBox.colors.push_back(color4(1.0, 1.0, 1.0, 1.0));
+            }
+        }
+        queryBox.numVertices = queryBox.points.size();
+        uploadObject(queryBox, "occlusion box");
+        flushArena(); // Drawn later this frame
+    }
+
+    for (auto &block : blockQueries)
+        glDeleteQueries(1, &block.query);
+
+    // Blocks start visible; their first queries are spread over the interval
+    blockQueries.resize(cityIndex.nodes.size());
+    for (size_t i = 0; i < blockQueries.size(); ++i)
+    {
+        glGenQueries(1, &blockQueries[i].query);
+        blockQueries[i].visible = true;
+        blockQueries[i].pending = false;
+        blockQueries[i].lastQueried = queryFrame - int(i % std::max(visibleQueryInterval, 1));
+    }
+}
+
+// Read a query result if the GPU has it, without waiting; the buildings of a
+// block whose query found no samples count as occluded
+static void readBlockQuery(BlockQuery &block, const QuadNode &node)
+{
+    if (!block.pending)
+        return;
+
+    GLuint available = 0;
+    glGetQueryObjectuiv(block.query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    GLuint samples = 0;
+    glGetQueryObjectuiv(block.query, GL_QUERY_RESULT, &samples);
+    block.visible = samples > 0;
+    block.pending = false;
+    if (!block.visible)
+        frameStats.occludedObjects += node.itemCount;
+}
+
+// Draw the buildings of a leaf that are inside the frustum; they are
+// submitted right away, so that a query around the call covers them
+static void drawBlock(const QuadNode &node)
+{
+    for (int i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+    {
+        const SpatialItem &item = cityIndex.items[i];
+        if (frustumCulling)
+        {
+            frameStats.boxTests++;
+            if (!isBoxVisible(worldFrustum, item.center, item.extent))
+            {
+                frameStats.culledObjects++;
+                continue;
+            }
+        }
+
+        drawBuilding(item.id);
+    }
+    submitDrawList();
+}
+
+static void drawBlockBox(const QuadNode &node)
+{
+    mat4 model = Translate(node.center) * Scale(node.extent * 2.0f);
+    useProgram(program);
+    const Mesh &mesh = meshes[queryBox.mesh];
+    bindVertexArray(mesh.vao);
+    setUniform1i(ModelIndex, -1);
+    setUniformMatrix4(Model, model);
+    setUniform3f(PositionScale, mesh.positionScale);
+    setUniform3f(PositionOffset, mesh.positionOffset);
+    setUniform1i(Instanced, GL_FALSE);
+    setUniform1i(InstancedProps, GL_FALSE);
+    setUniform1i(LampSlot, -1);
+
+    glDrawElementsBaseVertex(GL_TRIANGLES, queryBox.numIndices, mesh.indexType, BUFFER_OFFSET(mesh.indexOffset),
+                             mesh.baseVertex);
+    countGLCall();
+    frameStats.drawCalls++;
+    frameStats.triangles += queryBox.numIndices / 3;
+}
+
+void drawBuildingsWithQueries(const vec4 &eye)
+{
+    if (blockQueries.size() != cityIndex.nodes.size())
+        createBlockQueries();
+    queryFrame++;
+
+    leaves.clear();
+    if (frustumCulling)
+    {
+        queryFrustumLeaves(cityIndex, worldFrustum, leaves);
+    }
+    else
+    {
+        for (size_t i = 0; i < cityIndex.nodes.size(); ++i)
+        {
+            if (cityIndex.nodes[i].firstChild < 0)
+                leaves.push_back(i);
+        }
+    }
+
+    // Front to back, so that near blocks are drawn before far ones are queried
+    sortedLeaves.clear();
+    int leafItems = 0;
+    for (int leaf : leaves)
+    {
+        vec3 d = cityIndex.nodes[leaf].center - vec3(eye.x, eye.y, eye.z);
+        sortedLeaves.push_back(std::make_pair(dot(d, d), leaf));
+        leafItems += cityIndex.nodes[leaf].itemCount;
+        readBlockQuery(blockQueries[leaf], cityIndex.nodes[leaf]);
+    }
+    std::sort(sortedLeaves.begin(), sortedLeaves.end());
+    frameStats.culledObjects += buildings.size() - leafItems;
+
+    // Levels of detail of every building that may be drawn
+    leafBuildings.clear();
+    for (int leaf : leaves)
+    {
+        const QuadNode &node = cityIndex.nodes[leaf];
+        for (int i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+            leafBuildings.push_back(cityIndex.items[i].id);
+    }
+    selectLods(buildings, leafBuildings);
+    frameStats.occlusionTests += leafItems;
+
+    // Blocks visible last frame are drawn; every few frames their own
+    // geometry is drawn inside a query to find out if they became hidden
+    for (const auto &entry : sortedLeaves)
+    {
+        const QuadNode &node = cityIndex.nodes[entry.second];
+        BlockQuery &block = blockQueries[entry.second];
+        if (!block.visible)
+            continue;
+
+        bool query = !block.pending && queryFrame - block.lastQueried >= visibleQueryInterval;
+        if (query)
+            glBeginQuery(GL_SAMPLES_PASSED, block.query);
+
+        drawBlock(node);
+
+        if (query)
+        {
+            glEndQuery(GL_SAMPLES_PASSED);
+            block.pending = true;
+            block.lastQueried = queryFrame;
+            frameStats.occlusionQueries++;
+        }
+    }
+
+    // Blocks hidden last frame are queried with their bounding box, and their
+    // buildings are drawn only if the GPU finds some of the box visible. A
+    // block whose box query is still in flight is not queried again, which
+    // would discard that result; its buildings are drawn on the pending query
+    for (const auto &entry : sortedLeaves)
+    {
+        const QuadNode &node = cityIndex.nodes[entry.second];
+        BlockQuery &block = blockQueries[entry.second];
+        if (block.visible)
+            continue;
+
+        // Boxes around the eye cannot be queried reliably
+        vec3 d = vec3(eye.x, eye.y, eye.z) - node.center;
+        if (std::fabs(d.x) < node.extent.x + QueryNearMargin &&
+            std::fabs(d.y) < node.extent.y + QueryNearMargin &&
+            std::fabs(d.z) < node.extent.z + QueryNearMargin)
+        {
+            block.visible = true;
+            block.pending = false;
+            drawBlock(node);
+            continue;
+        }
+
+        if (!block.pending)
+        {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDepthMask(GL_FALSE);
+            glBeginQuery(GL_SAMPLES_PASSED, block.query);
+            drawBlockBox(node);
+            glEndQuery(GL_SAMPLES_PASSED);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthMask(GL_TRUE);
+
+            block.pending = true;
+            block.lastQueried = queryFrame;
+            frameStats.occlusionQueries++;
+        }
+
+        // The GPU waits for the query, the CPU does not; a query from an
+        // earlier frame is already done by the time the GPU gets here
+        glBeginConditionalRender(block.query, GL_QUERY_WAIT);
+        drawBlock(node);
+        glEndConditionalRender();
+    }
+}
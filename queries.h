@@ -0,0 +1,20 @@
+#ifndef QUERIES_H
+#define QUERIES_H
+
+#include "Angel.h"
+
+// Hardware occlusion queries per quadtree leaf (a block of buildings), with
+// temporal coherence in the style of CHC++:
+//  - blocks visible last frame are drawn, and re-queried with their own
+//    geometry every few frames;
+//  - blocks hidden last frame draw their bounding box as a query and their
+//    buildings under conditional rendering on that query; while the query is
+//    in flight, no new one is issued and the buildings are drawn on it.
+// Results are only read once available, so the CPU never waits on the GPU.
+
+extern int visibleQueryInterval; // Frames between queries of a visible block
+
+// Draw the buildings of per-object mode using the queries
+void drawBuildingsWithQueries(const vec4 &eye);
+
+#endif
@@ -0,0 +1,149 @@
+#include "Angel.h"
+#include "registry.h"
+#include "mesh.h"
+#include <unordered_map>
+
+std::vector<Mesh> meshes;
+
+static std::unordered_map<uint64_t, MeshHandle> handlesByHash;
+static std::vector<MeshHandle> freeHandles; // Released slots, reused first
+
+// Totals since startup, for printRegistryStats()
+static long registrations = 0;
+static long uploads = 0;
+static long bytesUploaded = 0;
+static long bytesShared = 0;
+
+// FNV-1a over the encoded contents and how to draw them
+static uint64_t contentHash(const std::vector<unsigned char> &data, long indexStart, GLenum indexType,
+                            const vec3 &positionScale, const vec3 &positionOffset)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *bytes, size_t size)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(bytes);
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ p[i]) * 1099511628211ull;
+    };
+    add(&data[0], data.size());
+    add(&indexStart, sizeof(indexStart));
+    add(&indexType, sizeof(indexType));
+    add(&positionScale, sizeof(positionScale));
+    add(&positionOffset, sizeof(positionOffset));
+    return hash;
+}
+
+static bool isEqual(const vec3 &a, const vec3 &b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Whether a registered mesh has exactly these contents, not just their hash
+static bool isSameMesh(const Mesh &mesh, const std::vector<unsigned char> &data, long indexStart, GLenum indexType,
+                       const vec3 &positionScale, const vec3 &positionOffset)
+{
+    return mesh.indexOffset - mesh.range.offset == indexStart && mesh.indexType == indexType &&
+           isEqual(mesh.positionScale, positionScale) && isEqual(mesh.positionOffset, positionOffset) &&
+           arenaContains(mesh.range, &data[0], data.size());
+}
+
+MeshHandle registerMesh(const std::vector<unsigned char> &data, long indexStart, GLenum indexType,
+                        const vec3 &positionScale, const vec3 &positionOffset)
+{
+    // An empty range has no block, so nothing could draw it
+    if (indexStart <= 0 || long(data.size()) <= indexStart)
+    {
+        std::cerr << "Cannot register a mesh without vertices or indices" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    registrations++;
+    uint64_t hash = contentHash(data, indexStart, indexType, positionScale, positionOffset);
+    // Shared only when the contents match too, so a hash collision uploads
+    // a mesh of its own rather than drawing the other one
+    auto found = handlesByHash.find(hash);
+    if (found != handlesByHash.end() &&
+        isSameMesh(meshes[found->second], data, indexStart, indexType, positionScale, positionOffset))
+    {
+        meshes[found->second].references++;
+        bytesShared += data.size();
+        return found->second;
+    }
+
+    // One arena range starting at a whole vertex, so the draws address the
+    // vertices with a base vertex into the block's vertex array
+    long stride = getVertexLayout(vertexFormat).stride;
+    Mesh mesh;
+    mesh.range = allocateArena(&data[0], data.size(), stride);
+    mesh.vao = arenaVertexArray(mesh.range.block);
+    mesh.baseVertex = mesh.range.offset / stride;
+    mesh.indexOffset = mesh.range.offset + indexStart;
+    mesh.indexType = indexType;
+    mesh.numIndices = (data.size() - indexStart) / (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+    mesh.positionScale = positionScale;
+    mesh.positionOffset = positionOffset;
+    mesh.hash = hash;
+    mesh.references = 1;
+    uploads++;
+    bytesUploaded += data.size();
+    vertexBufferBytes += indexStart;
+
+    MeshHandle handle;
+    if (!freeHandles.empty())
+    {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+        meshes[handle] = mesh;
+    }
+    else
+    {
+        handle = meshes.size();
+        meshes.push_back(mesh);
+    }
+    if (found == handlesByHash.end())
+        handlesByHash[hash] = handle;
+    return handle;
+}
+
+void readMesh(MeshHandle handle, std::vector<unsigned char> &vertices, std::vector<GLuint> &indices)
+{
+    const Mesh &mesh = meshes[handle];
+    std::vector<unsigned char> data(mesh.range.bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, arenaBuffer(mesh.range.block));
+    glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.range.offset, data.size(), &data[0]);
+
+    long indexStart = mesh.indexOffset - mesh.range.offset;
+    vertices.assign(data.begin(), data.begin() + indexStart);
+    indices.resize(mesh.numIndices);
+    for (int i = 0; i < mesh.numIndices; ++i)
+    {
+        if (mesh.indexType == GL_UNSIGNED_SHORT)
+            indices[i] = reinterpret_cast<const GLushort *>(&data[indexStart])[i];
+        else
+            indices[i] = reinterpret_cast<const GLuint *>(&data[indexStart])[i];
+    }
+}
+
+void releaseMesh(MeshHandle &handle)
+{
+    if (handle < 0)
+        return;
+
+    Mesh &mesh = meshes[handle];
+    if (--mesh.references == 0)
+    {
+        freeArena(mesh.range);
+        auto found = handlesByHash.find(mesh.hash);
+        if (found != handlesByHash.end() && found->second == handle)
+            handlesByHash.erase(found);
+        freeHandles.push_back(handle);
+    }
+    handle = -1;
+}
+
+void printRegistryStats()
+{
+    printf("Mesh registry: %ld meshes registered, %ld unique uploaded (%d live), %.1f KB uploaded, %.1f KB shared\n",
+           registrations, uploads, int(meshes.size() - freeHandles.size()),
+           bytesUploaded / 1024.0, bytesShared / 1024.0);
+}
@@ -0,0 +1,50 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "Angel.h"
+#include "arena.h"
+#include <cstdint>
+#include <vector>
+
+// Mesh registry: uploadObject() hands the encoded vertices and indices of a
+// mesh to registerMesh(), which hashes them and only uploads contents it has
+// not seen before. Objects keep a handle, so the identical parts of repeated
+// props (the pole, box and lamps of every traffic light, and their generated
+// levels) share one arena range and differ only in their world matrix.
+
+typedef int MeshHandle; // Index into meshes, -1 before upload
+
+// GPU copy of one unique mesh
+struct Mesh
+{
+    GLuint vao;          // Vertex array of the arena block
+    ArenaRange range;    // Encoded vertices, then indices
+    GLint baseVertex;    // Index of the first vertex in the block
+    long indexOffset;    // Byte offset of the first index in the block
+    GLenum indexType;    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    int numIndices;      // Indices drawn
+    vec3 positionScale;  // Dequantization of the stored positions
+    vec3 positionOffset;
+    uint64_t hash;       // Of the contents and the fields above
+    int references;      // Objects holding the handle, 0 once released
+};
+
+extern std::vector<Mesh> meshes;
+
+// Find the mesh with these contents or upload it; indices start at byte
+// indexStart of data. Each call adds a reference.
+MeshHandle registerMesh(const std::vector<unsigned char> &data, long indexStart, GLenum indexType,
+                        const vec3 &positionScale, const vec3 &positionOffset);
+
+// Read a mesh's encoded vertices and its indices back from the arena, for
+// the setup paths that run after the CPU copy was released; flushArena()
+// must have run since it was registered
+void readMesh(MeshHandle handle, std::vector<unsigned char> &vertices, std::vector<GLuint> &indices);
+
+// Drop a reference and set the handle to -1; the last one frees the range
+void releaseMesh(MeshHandle &handle);
+
+// Meshes registered and uploaded, and the bytes the shared ones saved
+void printRegistryStats();
+
+#endif
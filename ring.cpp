@@ -0,0 +1,151 @@
+#include "Angel.h"
+#include "ring.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+// Segment size to start with; grown when a frame writes more
+const long RingInitialSegmentBytes = 256 * 1024;
+
+static GLuint buffer = 0;
+static unsigned char *mapped = NULL; // NULL without persistent mapping
+static long segmentBytes = 0;
+static GLint alignment = 16;
+static int segment = 0;
+static long used = 0;
+static GLsync fences[RingFrames];
+
+// Buffers replaced by a larger one during the frame; still bound by its
+// earlier draws, so deleted at the start of the next (the GL keeps them
+// alive until the GPU is done with them)
+static std::vector<GLuint> retired;
+
+static bool isPersistentSupported()
+{
+    return glewIsSupported("GL_VERSION_4_4") || glewIsSupported("GL_ARB_buffer_storage");
+}
+
+static void allocate(long bytes)
+{
+    segmentBytes = bytes;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (isPersistentSupported())
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, RingFrames * segmentBytes, NULL, flags);
+        mapped = (unsigned char *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, RingFrames * segmentBytes, flags);
+    }
+    else
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, RingFrames * segmentBytes, NULL, GL_STREAM_DRAW);
+        mapped = NULL;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void createRing()
+{
+    // Uniform, storage and texture buffer ranges must start at these multiples
+    GLint uniformAlignment = 0, storageAlignment = 0, textureAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    if (glewIsSupported("GL_VERSION_4_3"))
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    if (glewIsSupported("GL_VERSION_4_3") || glewIsSupported("GL_ARB_texture_buffer_range"))
+        glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &textureAlignment);
+    alignment = std::max(alignment, std::max(uniformAlignment, std::max(storageAlignment, textureAlignment)));
+
+    allocate(RingInitialSegmentBytes);
+    std::cout << "Ring buffer: " << RingFrames << " x " << segmentBytes / 1024 << " KB, "
+              << (mapped != NULL ? "persistently mapped" : "glBufferSubData") << std::endl;
+}
+
+void beginRingFrame()
+{
+    // Everything issued so far may read the segment just used
+    if (used > 0)
+    {
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RingFrames;
+        used = 0;
+    }
+
+    if (!retired.empty())
+    {
+        glDeleteBuffers(retired.size(), &retired[0]);
+        retired.clear();
+    }
+
+    if (fences[segment] == 0)
+        return;
+
+    // Only count a wait when the GPU is actually behind
+    if (glClientWaitSync(fences[segment], 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        frameStats.fenceWaits++;
+        frameStats.fenceWaitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    glDeleteSync(fences[segment]);
+    fences[segment] = 0;
+}
+
+// Move to a buffer with at least twice the segment size. Ranges written
+// this frame stay valid in the old buffer; the new one is not in use, so
+// its fences start clear.
+static void grow(long bytes)
+{
+    retired.push_back(buffer);
+    if (mapped != NULL)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+    for (int i = 0; i < RingFrames; ++i)
+    {
+        if (fences[i] != 0)
+            glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+
+    long size = segmentBytes;
+    while (size < bytes)
+        size *= 2;
+    allocate(2 * size);
+    segment = 0;
+    used = 0;
+    std::cout << "Ring buffer grown to " << RingFrames << " x " << segmentBytes / 1024 << " KB" << std::endl;
+}
+
+GLintptr writeRing(const void *data, long bytes)
+{
+    long offset = (used + alignment - 1) / alignment * alignment;
+    if (offset + bytes > segmentBytes)
+    {
+        grow(bytes);
+        offset = 0;
+    }
+
+    GLintptr position = segment * segmentBytes + offset;
+    if (mapped != NULL)
+    {
+        memcpy(mapped + position, data, bytes);
+    }
+    else
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, position, bytes, data);
+    }
+    used = offset + bytes;
+    frameStats.bytesUploaded += bytes;
+    return position;
+}
+
+GLuint ringBuffer()
+{
+    return buffer;
+}
@@ -0,0 +1,31 @@
+#ifndef RING_H
+#define RING_H
+
+#include "Angel.h"
+
+// Per-frame dynamic data (camera block, traffic light states, indirect
+// commands, impostor instances) goes through one ring buffer split into
+// RingFrames segments, one per frame in flight. With OpenGL 4.4 or
+// ARB_buffer_storage the buffer is immutable and persistently mapped, and
+// writes are plain copies; otherwise they fall back to glBufferSubData. A
+// fence marks the end of each frame's segment, and the CPU only waits when
+// it comes back to a segment the GPU is still reading.
+
+const int RingFrames = 3;
+
+// Create the buffer; called from init() before anything writes to it
+void createRing();
+
+// Fence the segment of the frame just drawn and move on to the next one,
+// waiting for the GPU if it still reads it; called at the start of display()
+void beginRingFrame();
+
+// Copy bytes into the current segment and return their offset in
+// ringBuffer(). Offsets are aligned for uniform, storage and texture buffer
+// ranges. A segment that runs out is replaced by a larger buffer, so the
+// buffer must be bound after each write.
+GLintptr writeRing(const void *data, long bytes);
+
+GLuint ringBuffer();
+
+#endif
@@ -0,0 +1,142 @@
+#include "Angel.h"
+#include "scene.h"
+#include "stats.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Dirty nodes below which the update stays on the calling thread
+const int ParallelSceneNodes = 4096;
+
+static std::vector<SceneNode> parents;
+static std::vector<SceneNode> subtreeEnds; // One past the last node of the subtree
+static std::vector<vec3> translations;
+static std::vector<vec3> rotations;
+static std::vector<vec3> scales;
+static std::vector<mat4> worlds;
+static std::vector<SceneNode> dirtyNodes;
+static std::vector<unsigned char> dirty;
+
+static mat4 localMatrix(SceneNode node)
+{
+    // Zero angles and unit scale are left out rather than multiplied in
+    mat4 local = Translate(translations[node]);
+    const vec3 &r = rotations[node];
+    if (r.x != 0.0f)
+        local = local * RotateX(r.x);
+    if (r.y != 0.0f)
+        local = local * RotateY(r.y);
+    if (r.z != 0.0f)
+        local = local * RotateZ(r.z);
+    const vec3 &s = scales[node];
+    if (s.x != 1.0f || s.y != 1.0f || s.z != 1.0f)
+        local = local * Scale(s);
+    return local;
+}
+
+static void markDirty(SceneNode node)
+{
+    if (!dirty[node])
+    {
+        dirty[node] = 1;
+        dirtyNodes.push_back(node);
+    }
+}
+
+SceneNode addSceneNode(SceneNode parent, const vec3 &translation, const vec3 &rotation, const vec3 &scale)
+{
+    // Another subtree already follows the parent's, so the updates, which
+    // walk subtrees as contiguous ranges, would miss this node
+    SceneNode node = parents.size();
+    if (parent >= 0 && subtreeEnds[parent] != node)
+    {
+        std::cerr << "Scene node " << node << " added outside the subtree of its parent " << parent << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    parents.push_back(parent);
+    subtreeEnds.push_back(node + 1);
+    translations.push_back(translation);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    worlds.push_back(mat4());
+    dirty.push_back(0);
+    markDirty(node);
+
+    // The new node ends the subtree of every ancestor
+    for (SceneNode ancestor = parent; ancestor >= 0; ancestor = parents[ancestor])
+        subtreeEnds[ancestor] = node + 1;
+    return node;
+}
+
+static bool isEqual(const vec3 &a, const vec3 &b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+void setSceneTransform(SceneNode node, const vec3 &translation, const vec3 &rotation, const vec3 &scale)
+{
+    if (isEqual(translations[node], translation) && isEqual(rotations[node], rotation) && isEqual(scales[node], scale))
+        return;
+
+    translations[node] = translation;
+    rotations[node] = rotation;
+    scales[node] = scale;
+    markDirty(node);
+}
+
+// Parents come first, and the parent of the run's root is not dirty
+static void updateRange(SceneNode begin, SceneNode end)
+{
+    for (SceneNode node = begin; node < end; ++node)
+    {
+        SceneNode parent = parents[node];
+        worlds[node] = parent >= 0 ? worlds[parent] * localMatrix(node) : localMatrix(node);
+        dirty[node] = 0;
+    }
+}
+
+void updateScene()
+{
+    if (dirtyNodes.empty())
+        return;
+
+    // Dirty subtrees as disjoint runs; one inside an earlier run is covered
+    std::sort(dirtyNodes.begin(), dirtyNodes.end());
+    std::vector<std::pair<SceneNode, SceneNode>> runs;
+    long count = 0;
+    for (SceneNode node : dirtyNodes)
+    {
+        if (!runs.empty() && node < runs.back().second)
+            continue;
+        runs.push_back(std::make_pair(node, subtreeEnds[node]));
+        count += subtreeEnds[node] - node;
+    }
+    dirtyNodes.clear();
+    frameStats.worldUpdates += count;
+
+    // Runs are independent, so threads take whole runs
+    int threadCount = std::min<int>(runs.size(), std::max(1u, std::thread::hardware_concurrency()));
+    if (count < ParallelSceneNodes || threadCount < 2)
+    {
+        for (const auto &run : runs)
+            updateRange(run.first, run.second);
+        return;
+    }
+
+    auto worker = [&](int first)
+    {
+        for (size_t i = first; i < runs.size(); i += threadCount)
+            updateRange(runs[i].first, runs[i].second);
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t)
+        threads.push_back(std::thread(worker, t));
+    for (auto &thread : threads)
+        thread.join();
+}
+
+const mat4 &sceneWorld(SceneNode node)
+{
+    return worlds[node];
+}
@@ -0,0 +1,34 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "Angel.h"
+
+// Scene graph in flat arrays: a parent index, a local translation, rotation
+// and scale, and a cached world matrix per node. Nodes are stored depth
+// first, so every subtree is one contiguous run that starts at its root.
+// Changing a node's transform marks it dirty; updateScene() recomputes the
+// world matrices of the dirty subtrees only, and spreads them over threads
+// when there are enough of them. Nodes that never move cost nothing per
+// frame.
+
+typedef int SceneNode; // Index of a node, -1 for none
+
+// Add a node under parent (-1 for a root). A child must be added before any
+// node outside its parent's subtree, which keeps subtrees contiguous; the
+// process exits otherwise.
+// rotation holds angles in degrees; the local matrix is
+// Translate(t) * RotateX(r.x) * RotateY(r.y) * RotateZ(r.z) * Scale(s).
+SceneNode addSceneNode(SceneNode parent, const vec3 &translation, const vec3 &rotation = vec3(0.0, 0.0, 0.0),
+                       const vec3 &scale = vec3(1.0, 1.0, 1.0));
+
+// Set a node's local transform; marks it dirty only if it changed
+void setSceneTransform(SceneNode node, const vec3 &translation, const vec3 &rotation = vec3(0.0, 0.0, 0.0),
+                       const vec3 &scale = vec3(1.0, 1.0, 1.0));
+
+// Recompute the world matrices of the dirty subtrees
+void updateScene();
+
+// Cached world matrix, current as of the last updateScene()
+const mat4 &sceneWorld(SceneNode node);
+
+#endif
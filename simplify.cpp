@@ -0,0 +1,479 @@
+#include "Angel.h"
+#include "simplify.h"
+#include "lod.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+bool lodGeneration = true;
+const char *lodCacheFile = "lod.cache";
+
+// Bump when the simplifier or the chain parameters change, to invalidate
+// cached levels
+const int SimplifyVersion = 1;
+
+// Chain parameters: each level aims at half the triangles of the previous
+// one, as long as the error stays within a fraction of the mesh radius
+const int MaxGeneratedLods = 3;
+const int MinSimplifyTriangles = 16;
+const float LodTriangleRatio = 0.5f;
+const float MaxLodErrorRatio = 0.1f;
+
+// A level is used once its error covers less than this many pixels
+const float LodPixelError = 1.0f;
+
+//----------------------------------------------------------------------------
+//
+//  Quadrics
+//
+
+// Symmetric 4x4 matrix, upper triangle row by row
+struct Quadric
+{
+    double a[10];
+};
+
+static void addPlane(Quadric &q, double nx, double ny, double nz, double d, double weight)
+{
+    double p[4] = {nx, ny, nz, d};
+    int k = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = i; j < 4; ++j)
+            q.a[k++] += weight * p[i] * p[j];
+    }
+}
+
+static void addQuadric(Quadric &q, const Quadric &other)
+{
+    for (int k = 0; k < 10; ++k)
+        q.a[k] += other.a[k];
+}
+
+// Sum of squared distances of p to the planes of q
+static double evaluate(const Quadric &q, const point4 &p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    const double *a = q.a;
+    return a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x +
+           a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y +
+           a[7] * z * z + 2.0 * a[8] * z +
+           a[9];
+}
+
+static vec3 triangleNormal(const point4 &a, const point4 &b, const point4 &c)
+{
+    return cross(vec3(b.x - a.x, b.y - a.y, b.z - a.z), vec3(c.x - a.x, c.y - a.y, c.z - a.z));
+}
+
+//----------------------------------------------------------------------------
+//
+//  Edge collapse
+//
+
+// Candidate collapse of vertex from into vertex to
+struct Collapse
+{
+    double cost;
+    GLuint from, to;
+    unsigned fromVersion, toVersion;
+
+    bool operator>(const Collapse &other) const
+    {
+        return cost > other.cost;
+    }
+};
+
+float simplifyMesh(const std::vector<point4> &points, const std::vector<GLuint> &indices,
+                   int targetTriangles, float maxError, std::vector<GLuint> &result)
+{
+    int vertexCount = points.size();
+    int triangleCount = indices.size() / 3;
+    std::vector<GLuint> triangles = indices;
+    std::vector<char> liveTriangle(triangleCount, true);
+
+    // Plane quadrics per vertex, and the triangles around each. Planes are
+    // not weighted by area, so the error stays a distance in mesh units.
+    std::vector<Quadric> quadrics(vertexCount);
+    memset(&quadrics[0], 0, quadrics.size() * sizeof(Quadric));
+    std::vector<std::vector<int>> vertexTriangles(vertexCount);
+    for (int t = 0; t < triangleCount; ++t)
+    {
+        const GLuint *v = &triangles[3 * t];
+        vec3 n = triangleNormal(points[v[0]], points[v[1]], points[v[2]]);
+        double area = length(n);
+        if (area > 0.0)
+        {
+            double nx = n.x / area, ny = n.y / area, nz = n.z / area;
+            double d = -(nx * points[v[0]].x + ny * points[v[0]].y + nz * points[v[0]].z);
+            for (int k = 0; k < 3; ++k)
+                addPlane(quadrics[v[k]], nx, ny, nz, d, 1.0);
+        }
+        for (int k = 0; k < 3; ++k)
+            vertexTriangles[v[k]].push_back(t);
+    }
+
+    // Vertices on an edge that is not shared by exactly two triangles stay
+    // in place: open borders, color seams and non-manifold edges
+    std::map<std::pair<GLuint, GLuint>, int> edgeUses;
+    for (int t = 0; t < triangleCount; ++t)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            GLuint a = triangles[3 * t + k], b = triangles[3 * t + (k + 1) % 3];
+            edgeUses[std::make_pair(std::min(a, b), std::max(a, b))]++;
+        }
+    }
+    std::vector<char> locked(vertexCount, false);
+    for (const auto &edge : edgeUses)
+    {
+        if (edge.second != 2)
+            locked[edge.first.first] = locked[edge.first.second] = true;
+    }
+
+    // Candidates are invalidated by bumping the version of their vertices
+    std::vector<unsigned> versions(vertexCount, 0);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    auto pushCollapse = [&](GLuint from, GLuint to)
+    {
+        if (locked[from])
+            return;
+        Quadric q = quadrics[from];
+        addQuadric(q, quadrics[to]);
+        Collapse c = {std::max(0.0, evaluate(q, points[to])), from, to, versions[from], versions[to]};
+        heap.push(c);
+    };
+    auto pushEdgesOf = [&](GLuint v)
+    {
+        for (int t : vertexTriangles[v])
+        {
+            if (!liveTriangle[t])
+                continue;
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint w = triangles[3 * t + k];
+                if (w != v)
+                {
+                    pushCollapse(v, w);
+                    pushCollapse(w, v);
+                }
+            }
+        }
+    };
+    for (const auto &edge : edgeUses)
+    {
+        pushCollapse(edge.first.first, edge.first.second);
+        pushCollapse(edge.first.second, edge.first.first);
+    }
+
+    int liveCount = triangleCount;
+    double maxCost = double(maxError) * maxError;
+    double largestCost = 0.0;
+    while (liveCount > targetTriangles && !heap.empty())
+    {
+        Collapse c = heap.top();
+        heap.pop();
+        if (c.fromVersion != versions[c.from] || c.toVersion != versions[c.to])
+            continue;
+        if (c.cost > maxCost)
+            break;
+
+        // The edge must still exist, and no remaining triangle may flip or
+        // collapse to a sliver when from moves onto to
+        bool isEdge = false;
+        bool valid = true;
+        for (int t : vertexTriangles[c.from])
+        {
+            if (!liveTriangle[t])
+                continue;
+            GLuint *v = &triangles[3 * t];
+            if (v[0] == c.to || v[1] == c.to || v[2] == c.to)
+            {
+                isEdge = true;
+                continue;
+            }
+
+            point4 moved[3];
+            for (int k = 0; k < 3; ++k)
+                moved[k] = points[v[k] == c.from ? c.to : v[k]];
+            vec3 before = triangleNormal(points[v[0]], points[v[1]], points[v[2]]);
+            vec3 after = triangleNormal(moved[0], moved[1], moved[2]);
+            if (dot(before, after) <= 1e-6f * length(before) * length(before))
+            {
+                valid = false;
+                break;
+            }
+        }
+        if (!isEdge || !valid)
+            continue;
+
+        // Move from onto to; triangles on the edge disappear
+        for (int t : vertexTriangles[c.from])
+        {
+            if (!liveTriangle[t])
+                continue;
+            GLuint *v = &triangles[3 * t];
+            if (v[0] == c.to || v[1] == c.to || v[2] == c.to)
+            {
+                liveTriangle[t] = false;
+                liveCount--;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k)
+            {
+                if (v[k] == c.from)
+                    v[k] = c.to;
+            }
+            vertexTriangles[c.to].push_back(t);
+        }
+        vertexTriangles[c.from].clear();
+        addQuadric(quadrics[c.to], quadrics[c.from]);
+        largestCost = std::max(largestCost, c.cost);
+
+        versions[c.from]++;
+        versions[c.to]++;
+        pushEdgesOf(c.to);
+    }
+
+    result.clear();
+    for (int t = 0; t < triangleCount; ++t)
+    {
+        if (liveTriangle[t])
+            result.insert(result.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+    }
+    return std::sqrt(largestCost);
+}
+
+//----------------------------------------------------------------------------
+//
+//  LOD chains and their cache
+//
+
+// One generated level: indices into the source mesh and its error
+struct GeneratedLod
+{
+    float error;
+    std::vector<GLuint> indices;
+};
+typedef std::vector<GeneratedLod> LodChain;
+
+static float boundingRadius(const Object &obj)
+{
+    return 0.5f * length(obj.boundsMax - obj.boundsMin);
+}
+
+// FNV-1a over the simplifier version and the indexed mesh
+static uint64_t meshHash(const Object &obj)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+    };
+    add(&SimplifyVersion, sizeof(SimplifyVersion));
+    add(&obj.points[0], obj.points.size() * sizeof(point4));
+    add(&obj.colors[0], obj.colors.size() * sizeof(color4));
+    add(&obj.indices[0], obj.indices.size() * sizeof(GLuint));
+    return hash;
+}
+
+static void buildChain(const Object &obj, LodChain &chain)
+{
+    int triangles = obj.indices.size() / 3;
+    float maxError = MaxLodErrorRatio * boundingRadius(obj);
+
+    // Every level starts from the source mesh, so errors do not add up
+    int previous = triangles;
+    for (int level = 1; level <= MaxGeneratedLods; ++level)
+    {
+        int target = int(triangles * std::pow(LodTriangleRatio, float(level)));
+        GeneratedLod lod;
+        lod.error = simplifyMesh(obj.points, obj.indices, target, maxError, lod.indices);
+
+        // Stop once a level no longer saves a tenth of the triangles
+        int count = lod.indices.size() / 3;
+        if (count == 0 || count > previous * 9 / 10)
+            break;
+        previous = count;
+        chain.push_back(lod);
+    }
+}
+
+static void loadLodCache(std::unordered_map<uint64_t, LodChain> &cache)
+{
+    FILE *fp = fopen(lodCacheFile, "rb");
+    if (fp == NULL)
+        return;
+
+    char magic[4];
+    int chainCount = 0;
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "LOD1", 4) == 0 &&
+              fread(&chainCount, sizeof(chainCount), 1, fp) == 1 && chainCount >= 0;
+
+    for (int i = 0; ok && i < chainCount; ++i)
+    {
+        uint64_t hash = 0;
+        int levels = 0;
+        ok = fread(&hash, sizeof(hash), 1, fp) == 1 && fread(&levels, sizeof(levels), 1, fp) == 1 &&
+             levels >= 0 && levels <= MaxGeneratedLods;
+
+        LodChain chain(ok ? levels : 0);
+        for (auto &lod : chain)
+        {
+            int count = 0;
+            ok = ok && fread(&lod.error, sizeof(lod.error), 1, fp) == 1 &&
+                 fread(&count, sizeof(count), 1, fp) == 1 && count > 0 && count % 3 == 0;
+            if (ok)
+            {
+                lod.indices.resize(count);
+                ok = fread(&lod.indices[0], sizeof(GLuint), count, fp) == size_t(count);
+            }
+        }
+        if (ok)
+            cache[hash] = chain;
+    }
+    fclose(fp);
+
+    if (!ok)
+        cache.clear();
+}
+
+static void saveLodCache(const std::unordered_map<uint64_t, LodChain> &cache)
+{
+    FILE *fp = fopen(lodCacheFile, "wb");
+    if (fp == NULL)
+    {
+        std::cerr << "Cannot write LOD cache " << lodCacheFile << std::endl;
+        return;
+    }
+
+    int chainCount = cache.size();
+    fwrite("LOD1", 1, 4, fp);
+    fwrite(&chainCount, sizeof(chainCount), 1, fp);
+    for (const auto &entry : cache)
+    {
+        int levels = entry.second.size();
+        fwrite(&entry.first, sizeof(entry.first), 1, fp);
+        fwrite(&levels, sizeof(levels), 1, fp);
+        for (const auto &lod : entry.second)
+        {
+            int count = lod.indices.size();
+            fwrite(&lod.error, sizeof(lod.error), 1, fp);
+            fwrite(&count, sizeof(count), 1, fp);
+            fwrite(&lod.indices[0], sizeof(GLuint), count, fp);
+        }
+    }
+    fclose(fp);
+}
+
+// Whether every index of a chain is a vertex of the mesh; a stale or damaged
+// cache entry is not
+static bool fitsMesh(const LodChain &chain, const Object &obj)
+{
+    for (const auto &lod : chain)
+    {
+        for (GLuint index : lod.indices)
+        {
+            if (index >= obj.points.size() || index >= obj.colors.size())
+                return false;
+        }
+    }
+    return true;
+}
+
+void generateLods(const std::vector<Object *> &objects)
+{
+    if (!lodGeneration)
+        return;
+
+    // Meshes large enough to simplify, each content simplified once
+    auto start = std::chrono::steady_clock::now();
+    std::unordered_map<uint64_t, LodChain> cache;
+    loadLodCache(cache);
+
+    std::vector<Object *> candidates;
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> missing;
+    std::vector<const Object *> missingMeshes;
+    for (Object *obj : objects)
+    {
+        if (!obj->lods.empty() || int(obj->indices.size() / 3) < MinSimplifyTriangles)
+            continue;
+        uint64_t hash = meshHash(*obj);
+        auto cached = cache.find(hash);
+        if (cached != cache.end() && !fitsMesh(cached->second, *obj))
+        {
+            std::cerr << "LOD cache entry indexes past its mesh, regenerating" << std::endl;
+            cache.erase(cached);
+        }
+        candidates.push_back(obj);
+        hashes.push_back(hash);
+        if (cache.find(hash) == cache.end() &&
+            std::find(missing.begin(), missing.end(), hash) == missing.end())
+        {
+            missing.push_back(hash);
+            missingMeshes.push_back(obj);
+        }
+    }
+    if (candidates.empty())
+        return;
+
+    // Workers take the next mesh from a shared counter
+    std::vector<LodChain> chains(missing.size());
+    std::atomic<int> nextMesh(0);
+    auto worker = [&]()
+    {
+        for (int i = nextMesh++; i < int(missing.size()); i = nextMesh++)
+            buildChain(*missingMeshes[i], chains[i]);
+    };
+    int threadCount = std::min<int>(missing.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; ++i)
+        threads.push_back(std::thread(worker));
+    for (auto &thread : threads)
+        thread.join();
+
+    if (!missing.empty())
+    {
+        for (size_t i = 0; i < missing.size(); ++i)
+            cache[missing[i]] = chains[i];
+        saveLodCache(cache);
+    }
+
+    // Upload each level with the source vertices it still uses; a level is
+    // drawn once its error covers less than LodPixelError pixels
+    int levelCount = 0;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        Object &obj = *candidates[i];
+        float diameter = 2.0f * boundingRadius(obj);
+        for (const auto &lod : cache[hashes[i]])
+        {
+            Object coarse;
+            for (GLuint index : lod.indices)
+            {
+                coarse.points.push_back(obj.points[index]);
+                coarse.colors.push_back(obj.colors[index]);
+            }
+            coarse.numVertices = coarse.points.size();
+            uploadObject(coarse, "generated lod");
+
+            float screenSize = lod.error > 0.0f ? LodPixelError * diameter / lod.error : 1e9f;
+            addLod(obj, coarse, screenSize);
+            levelCount++;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("LOD generation: %d meshes, %d levels, %d meshes simplified, the rest from %s, %.3f s\n",
+           int(candidates.size()), levelCount, int(missing.size()), lodCacheFile, seconds);
+}
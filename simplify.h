@@ -0,0 +1,26 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "objects.h"
+#include <vector>
+
+// Mesh simplification with quadric error metrics (Garland and Heckbert).
+// Edges are collapsed cheapest first into one of their two vertices, so a
+// simplified level only indexes vertices (and colors) of the source mesh.
+
+extern bool lodGeneration;       // Generate levels at startup, off with --no-lod-generation
+extern const char *lodCacheFile; // Generated levels keyed by mesh content (--lod-cache)
+
+// Simplify an indexed triangle list towards targetTriangles, stopping early
+// when the next collapse would move the surface further than maxError.
+// Vertices on open borders (and so on color seams) never move. Returns the
+// largest error of the collapses made.
+float simplifyMesh(const std::vector<point4> &points, const std::vector<GLuint> &indices,
+                   int targetTriangles, float maxError, std::vector<GLuint> &result);
+
+// Build a chain of levels for every object that has none yet, on worker
+// threads, and attach them with addLod(). Meshes found in the cache file
+// are not simplified again.
+void generateLods(const std::vector<Object *> &objects);
+
+#endif
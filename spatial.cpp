@@ -0,0 +1,300 @@
+#include "Angel.h"
+#include "spatial.h"
+#include "objects.h"
+#include "stats.h"
+#include <algorithm>
+#include <cfloat>
+
+QuadTree cityIndex;
+
+// Box around a range of items
+static void boundItems(const SpatialItem *items, int count, vec3 &center, vec3 &extent)
+{
+    vec3 lo = items[0].center - items[0].extent;
+    vec3 hi = items[0].center + items[0].extent;
+    for (int i = 1; i < count; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            lo[c] = std::min(lo[c], items[i].center[c] - items[i].extent[c]);
+            hi[c] = std::max(hi[c], items[i].center[c] + items[i].extent[c]);
+        }
+    }
+    center = (lo + hi) * 0.5f;
+    extent = (hi - lo) * 0.5f;
+}
+
+// Split a node's items into up to four quadrants around the middle of their
+// centers on the ground plane, and recurse into each non-empty quadrant
+static void buildNode(QuadTree &tree, int nodeIndex)
+{
+    SpatialItem *items = &tree.items[0] + tree.nodes[nodeIndex].firstItem;
+    int count = tree.nodes[nodeIndex].itemCount;
+    if (count <= QuadLeafSize)
+        return;
+
+    float minX = items[0].center.x, maxX = minX;
+    float minZ = items[0].center.z, maxZ = minZ;
+    for (int i = 1; i < count; ++i)
+    {
+        minX = std::min(minX, items[i].center.x);
+        maxX = std::max(maxX, items[i].center.x);
+        minZ = std::min(minZ, items[i].center.z);
+        maxZ = std::max(maxZ, items[i].center.z);
+    }
+    float midX = (minX + maxX) * 0.5f;
+    float midZ = (minZ + maxZ) * 0.5f;
+
+    // Quadrant ranges: [0, split[0]), [split[0], split[1]), ...
+    SpatialItem *end = items + count;
+    SpatialItem *splitX = std::partition(items, end, [midX](const SpatialItem &item)
+                                         { return item.center.x < midX; });
+    SpatialItem *split[5] = {items, NULL, splitX, NULL, end};
+    split[1] = std::partition(items, splitX, [midZ](const SpatialItem &item)
+                              { return item.center.z < midZ; });
+    split[3] = std::partition(splitX, end, [midZ](const SpatialItem &item)
+                              { return item.center.z < midZ; });
+
+    // Coincident centers cannot be split further
+    int nonEmpty = 0;
+    for (int q = 0; q < 4; ++q)
+        nonEmpty += split[q + 1] > split[q];
+    if (nonEmpty < 2)
+        return;
+
+    // Children are allocated together so a node only stores the first one
+    int firstChild = tree.nodes.size();
+    for (int q = 0; q < 4; ++q)
+    {
+        int childCount = split[q + 1] - split[q];
+        if (childCount == 0)
+            continue;
+
+        QuadNode child;
+        boundItems(split[q], childCount, child.center, child.extent);
+        child.firstChild = -1;
+        child.childCount = 0;
+        child.firstItem = split[q] - &tree.items[0];
+        child.itemCount = childCount;
+        tree.nodes.push_back(child);
+    }
+    tree.nodes[nodeIndex].firstChild = firstChild;
+    tree.nodes[nodeIndex].childCount = nonEmpty;
+
+    for (int c = 0; c < nonEmpty; ++c)
+        buildNode(tree, firstChild + c);
+}
+
+void buildQuadTree(QuadTree &tree, const std::vector<SpatialItem> &items)
+{
+    tree.items = items;
+    tree.nodes.clear();
+    if (items.empty())
+        return;
+
+    // A full quadtree over n leaves has fewer than n/3 inner nodes
+    tree.nodes.reserve(2 * (items.size() / QuadLeafSize + 1));
+
+    QuadNode root;
+    boundItems(&tree.items[0], tree.items.size(), root.center, root.extent);
+    root.firstChild = -1;
+    root.childCount = 0;
+    root.firstItem = 0;
+    root.itemCount = tree.items.size();
+    tree.nodes.push_back(root);
+
+    buildNode(tree, 0);
+}
+
+void buildCityIndex()
+{
+    std::vector<SpatialItem> items(buildingInstances.size());
+    for (size_t k = 0; k < buildingInstances.size(); ++k)
+    {
+        // Same box as the building's mesh bounds, in world space
+        const vec4 &position = buildingInstances[k].position;
+        float height = position.w + buildingRoofHeight;
+        items[k].center = vec3(position.x, position.y + height * 0.5f, position.z);
+        items[k].extent = vec3(buildingSize, height * 0.5f, buildingSize);
+        items[k].id = k;
+    }
+    buildQuadTree(cityIndex, items);
+}
+
+// Append every item below a node
+static void appendItems(const QuadTree &tree, const QuadNode &node, std::vector<int> &out)
+{
+    for (int i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+        out.push_back(tree.items[i].id);
+}
+
+static void queryFrustumNode(const QuadTree &tree, int nodeIndex, const FrustumPlanes &frustum, std::vector<int> &out)
+{
+    const QuadNode &node = tree.nodes[nodeIndex];
+    frameStats.boxTests++;
+    FrustumTest test = classifyBox(frustum, node.center, node.extent);
+    if (test == FRUSTUM_OUTSIDE)
+        return;
+
+    // The whole block is visible, no need to look further down
+    if (test == FRUSTUM_INSIDE)
+    {
+        appendItems(tree, node, out);
+        return;
+    }
+
+    if (node.firstChild < 0)
+    {
+        for (int i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+        {
+            const SpatialItem &item = tree.items[i];
+            frameStats.boxTests++;
+            if (isBoxVisible(frustum, item.center, item.extent))
+                out.push_back(item.id);
+        }
+        return;
+    }
+
+    for (int c = 0; c < node.childCount; ++c)
+        queryFrustumNode(tree, node.firstChild + c, frustum, out);
+}
+
+void queryFrustum(const QuadTree &tree, const FrustumPlanes &frustum, std::vector<int> &out)
+{
+    if (!tree.nodes.empty())
+        queryFrustumNode(tree, 0, frustum, out);
+}
+
+// Append every leaf below a node
+static void appendLeaves(const QuadTree &tree, int nodeIndex, std::vector<int> &leaves)
+{
+    const QuadNode &node = tree.nodes[nodeIndex];
+    if (node.firstChild < 0)
+    {
+        leaves.push_back(nodeIndex);
+        return;
+    }
+    for (int c = 0; c < node.childCount; ++c)
+        appendLeaves(tree, node.firstChild + c, leaves);
+}
+
+static void queryFrustumLeavesNode(const QuadTree &tree, int nodeIndex, const FrustumPlanes &frustum, std::vector<int> &leaves)
+{
+    const QuadNode &node = tree.nodes[nodeIndex];
+    frameStats.boxTests++;
+    FrustumTest test = classifyBox(frustum, node.center, node.extent);
+    if (test == FRUSTUM_OUTSIDE)
+        return;
+
+    if (test == FRUSTUM_INSIDE || node.firstChild < 0)
+    {
+        appendLeaves(tree, nodeIndex, leaves);
+        return;
+    }
+
+    for (int c = 0; c < node.childCount; ++c)
+        queryFrustumLeavesNode(tree, node.firstChild + c, frustum, leaves);
+}
+
+void queryFrustumLeaves(const QuadTree &tree, const FrustumPlanes &frustum, std::vector<int> &leaves)
+{
+    if (!tree.nodes.empty())
+        queryFrustumLeavesNode(tree, 0, frustum, leaves);
+}
+
+// Squared distance from a point to a box
+static float boxDistanceSquared(const vec3 &point, const vec3 &center, const vec3 &extent)
+{
+    float distance = 0.0f;
+    for (int c = 0; c < 3; ++c)
+    {
+        float d = std::max(std::fabs(point[c] - center[c]) - extent[c], 0.0f);
+        distance += d * d;
+    }
+    return distance;
+}
+
+static void queryRadiusNode(const QuadTree &tree, int nodeIndex, const vec3 &center, float radiusSquared, std::vector<int> &out)
+{
+    const QuadNode &node = tree.nodes[nodeIndex];
+    if (boxDistanceSquared(center, node.center, node.extent) > radiusSquared)
+        return;
+
+    if (node.firstChild < 0)
+    {
+        for (int i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+        {
+            const SpatialItem &item = tree.items[i];
+            if (boxDistanceSquared(center, item.center, item.extent) <= radiusSquared)
+                out.push_back(item.id);
+        }
+        return;
+    }
+
+    for (int c = 0; c < node.childCount; ++c)
+        queryRadiusNode(tree, node.firstChild + c, center, radiusSquared, out);
+}
+
+void queryRadius(const QuadTree &tree, const vec3 &center, float radius, std::vector<int> &out)
+{
+    if (!tree.nodes.empty())
+        queryRadiusNode(tree, 0, center, radius * radius, out);
+}
+
+// Slab test; returns the entry distance or FLT_MAX on a miss
+static float intersectRayBox(const vec3 &origin, const vec3 &inverseDirection, const vec3 &center, const vec3 &extent)
+{
+    float tNear = 0.0f;
+    float tFar = FLT_MAX;
+    for (int c = 0; c < 3; ++c)
+    {
+        float t0 = (center[c] - extent[c] - origin[c]) * inverseDirection[c];
+        float t1 = (center[c] + extent[c] - origin[c]) * inverseDirection[c];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tNear = std::max(tNear, t0);
+        tFar = std::min(tFar, t1);
+        if (tNear > tFar)
+            return FLT_MAX;
+    }
+    return tNear;
+}
+
+static void raycastNode(const QuadTree &tree, int nodeIndex, const vec3 &origin, const vec3 &inverseDirection,
+                        int &hit, float &hitDistance)
+{
+    const QuadNode &node = tree.nodes[nodeIndex];
+    if (intersectRayBox(origin, inverseDirection, node.center, node.extent) >= hitDistance)
+        return;
+
+    if (node.firstChild < 0)
+    {
+        for (int i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+        {
+            const SpatialItem &item = tree.items[i];
+            float t = intersectRayBox(origin, inverseDirection, item.center, item.extent);
+            if (t < hitDistance)
+            {
+                hitDistance = t;
+                hit = item.id;
+            }
+        }
+        return;
+    }
+
+    for (int c = 0; c < node.childCount; ++c)
+        raycastNode(tree, node.firstChild + c, origin, inverseDirection, hit, hitDistance);
+}
+
+int raycast(const QuadTree &tree, const vec3 &origin, const vec3 &direction, float &hitDistance)
+{
+    int hit = -1;
+    hitDistance = FLT_MAX;
+    if (tree.nodes.empty())
+        return hit;
+
+    // Zero components give infinities, which the slab test handles
+    vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    raycastNode(tree, 0, origin, inverseDirection, hit, hitDistance);
+    return hit;
+}
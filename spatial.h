@@ -0,0 +1,54 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include "Angel.h"
+#include "culling.h"
+#include <vector>
+
+// Static quadtree over the city grid. All nodes live in one flat array with
+// the children of a node stored next to each other, and every node covers a
+// contiguous range of items, so a block that is entirely visible is emitted
+// without testing its contents.
+struct QuadNode
+{
+    vec3 center; // Bounding box of everything below the node
+    vec3 extent;
+    int firstChild; // Index of the first child, -1 for leaves
+    int childCount;
+    int firstItem; // Range in QuadTree::items
+    int itemCount;
+};
+
+// One indexed object with its world-space bounding box
+struct SpatialItem
+{
+    vec3 center;
+    vec3 extent;
+    int id; // Index of the building
+};
+
+struct QuadTree
+{
+    std::vector<QuadNode> nodes; // nodes[0] is the root
+    std::vector<SpatialItem> items;
+};
+
+// Index over all buildings
+extern QuadTree cityIndex;
+
+// Maximum items in a leaf
+const int QuadLeafSize = 8;
+
+void buildQuadTree(QuadTree &tree, const std::vector<SpatialItem> &items);
+void buildCityIndex();
+
+// Queries append the ids of the matching items to out (the node indices
+// of the leaves for queryFrustumLeaves)
+void queryFrustum(const QuadTree &tree, const FrustumPlanes &frustum, std::vector<int> &out);
+void queryFrustumLeaves(const QuadTree &tree, const FrustumPlanes &frustum, std::vector<int> &leaves);
+void queryRadius(const QuadTree &tree, const vec3 &center, float radius, std::vector<int> &out);
+
+// Nearest item hit by a ray, or -1. Sets hitDistance along the (unit) direction.
+int raycast(const QuadTree &tree, const vec3 &origin, const vec3 &direction, float &hitDistance);
+
+#endif
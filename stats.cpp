@@ -0,0 +1,256 @@
+#include "Angel.h"
+#include "stats.h"
+#include "globals.h"
+#include "display.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "pvs.h"
+#include "lod.h"
+#include "impostor.h"
+#include "drawlist.h"
+#include "glstate.h"
+#include "gpucull.h"
+#include "props.h"
+#include <chrono>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+FrameStats frameStats;
+bool benchMode = false;
+
+// A bench pass renders with the defaults below, per-object mode with every
+// optimization on, after change() has turned off or swapped what it measures
+struct BenchPass
+{
+    const char *name;
+    StaticRenderMode mode;
+    void (*change)();
+};
+
+static void applyDefaults()
+{
+    frustumCulling = true;
+    spatialCulling = true;
+    pvsCulling = false;
+    lodEnabled = true;
+    impostorsEnabled = true;
+    drawSorting = true;
+    frontToBack = true;
+    glStateCache = true;
+    gpuCulling = false;
+    hizCulling = false;
+    instancedProps = true;
+    occlusionMode = OCCLUSION_SOFTWARE;
+}
+
+static const BenchPass benchPasses[] = {
+    {"instanced", RENDER_INSTANCED, []() {}},
+    {"per-object", RENDER_PER_OBJECT, []() {}},
+    {"separate-props", RENDER_PER_OBJECT, []() { instancedProps = false; }},
+    {"indirect", RENDER_INDIRECT, []() {}},
+    {"gpu-culling", RENDER_INDIRECT, []()
+     {
+         gpuCulling = true;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"gpu-hiz", RENDER_INDIRECT, []()
+     {
+         gpuCulling = true;
+         hizCulling = true;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"queries", RENDER_PER_OBJECT, []() { occlusionMode = OCCLUSION_QUERIES; }},
+    {"pvs", RENDER_PER_OBJECT, []()
+     {
+         buildPVS();
+         pvsCulling = true;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"no-occlusion", RENDER_PER_OBJECT, []() { occlusionMode = OCCLUSION_OFF; }},
+    {"no-lod", RENDER_PER_OBJECT, []()
+     {
+         lodEnabled = false;
+         impostorsEnabled = false;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"unsorted", RENDER_PER_OBJECT, []()
+     {
+         drawSorting = false;
+         glStateCache = false;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"state-order", RENDER_PER_OBJECT, []()
+     {
+         frontToBack = false;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"flat-culling", RENDER_PER_OBJECT, []()
+     {
+         spatialCulling = false;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"no-culling", RENDER_PER_OBJECT, []()
+     {
+         frustumCulling = false;
+         occlusionMode = OCCLUSION_OFF;
+     }},
+    {"batched", RENDER_BATCHED, []() {}}};
+static const int NumBenchPasses = sizeof(benchPasses) / sizeof(BenchPass);
+
+static void applyBenchPass(const BenchPass &pass)
+{
+    applyDefaults();
+    pass.change();
+    setStaticRenderMode(pass.mode);
+}
+
+// Bench progress
+static int benchFramesPerPass = 0;
+static int benchPass = 0;
+static int benchFrame = 0;
+static FrameStats benchTotals;
+static double benchSeconds = 0.0;
+static std::chrono::steady_clock::time_point frameStart;
+
+// Counter of the hardware cache misses of this thread, where the kernel
+// exposes one; -1 otherwise
+static int cacheMissCounter = -1;
+
+static void openCacheMissCounter()
+{
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cacheMissCounter = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    if (cacheMissCounter < 0)
+        printf("No hardware cache miss counter, the bench reports none\n");
+}
+
+static void resetBenchTotals()
+{
+    benchFrame = 0;
+    memset(&benchTotals, 0, sizeof(benchTotals));
+    benchSeconds = 0.0;
+}
+
+void startBench(int framesPerPass)
+{
+    benchMode = true;
+    benchFramesPerPass = framesPerPass;
+    benchPass = 0;
+    openCacheMissCounter();
+    resetBenchTotals();
+    applyBenchPass(benchPasses[0]);
+}
+
+void beginFrameStats()
+{
+    memset(&frameStats, 0, sizeof(frameStats));
+    frameStart = std::chrono::steady_clock::now();
+#ifdef __linux__
+    if (cacheMissCounter >= 0)
+    {
+        ioctl(cacheMissCounter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(cacheMissCounter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+void endFrameStats()
+{
+    if (!benchMode)
+        return;
+
+#ifdef __linux__
+    if (cacheMissCounter >= 0)
+    {
+        ioctl(cacheMissCounter, PERF_EVENT_IOC_DISABLE, 0);
+        long long misses = 0;
+        if (read(cacheMissCounter, &misses, sizeof(misses)) == sizeof(misses))
+            frameStats.cacheMisses = misses;
+    }
+#endif
+
+    benchSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+    benchTotals.drawCalls += frameStats.drawCalls;
+    benchTotals.triangles += frameStats.triangles;
+    benchTotals.bytesUploaded += frameStats.bytesUploaded;
+    benchTotals.visibleObjects += frameStats.visibleObjects;
+    benchTotals.culledObjects += frameStats.culledObjects;
+    benchTotals.boxTests += frameStats.boxTests;
+    benchTotals.occluders += frameStats.occluders;
+    benchTotals.occlusionTests += frameStats.occlusionTests;
+    benchTotals.occludedObjects += frameStats.occludedObjects;
+    benchTotals.occlusionQueries += frameStats.occlusionQueries;
+    benchTotals.occlusionMilliseconds += frameStats.occlusionMilliseconds;
+    benchTotals.glCalls += frameStats.glCalls;
+    benchTotals.glCallsSkipped += frameStats.glCallsSkipped;
+    benchTotals.overdraw += frameStats.overdraw;
+    benchTotals.overdrawCovered += frameStats.overdrawCovered;
+    benchTotals.fenceWaits += frameStats.fenceWaits;
+    benchTotals.fenceWaitMilliseconds += frameStats.fenceWaitMilliseconds;
+    benchTotals.worldUpdates += frameStats.worldUpdates;
+    benchTotals.cacheMisses += frameStats.cacheMisses;
+
+    if (++benchFrame < benchFramesPerPass)
+        return;
+
+    // Report the finished pass, averaged per frame
+    double frames = benchFrame;
+    printf("[bench] %-12s %6d frames  %8.1f draws  %9.1f tris  %8.1f visible  %8.1f culled  %8.1f tests  %8.1f bytes uploaded  %8.3f ms\n",
+           benchPasses[benchPass].name, benchFrame,
+           benchTotals.drawCalls / frames,
+           benchTotals.triangles / frames,
+           benchTotals.visibleObjects / frames,
+           benchTotals.culledObjects / frames,
+           benchTotals.boxTests / frames,
+           benchTotals.bytesUploaded / frames,
+           1000.0 * benchSeconds / frames);
+    printf("[bench] %-12s %8.1f gl calls  %8.1f skipped  %8.2f fence waits  %8.3f ms waiting  %8.1f world updates\n", "",
+           benchTotals.glCalls / frames,
+           benchTotals.glCallsSkipped / frames,
+           benchTotals.fenceWaits / frames,
+           benchTotals.fenceWaitMilliseconds / frames,
+           benchTotals.worldUpdates / frames);
+    if (cacheMissCounter >= 0)
+    {
+        printf("[bench] %-12s %10.0f cache misses\n", "",
+               benchTotals.cacheMisses / frames);
+    }
+    if (benchTotals.overdraw > 0.0)
+    {
+        printf("[bench] %-12s %8.2f overdraw per pixel  %8.2f per covered pixel\n", "",
+               benchTotals.overdraw / frames,
+               benchTotals.overdrawCovered / frames);
+    }
+    if (benchTotals.occlusionTests > 0)
+    {
+        printf("[bench] %-12s %8.1f occluders  %8.1f queries  %8.1f tested  %8.1f occluded (%.1f%%)  %8.3f ms occlusion\n", "",
+               benchTotals.occluders / frames,
+               benchTotals.occlusionQueries / frames,
+               benchTotals.occlusionTests / frames,
+               benchTotals.occludedObjects / frames,
+               100.0 * benchTotals.occludedObjects / benchTotals.occlusionTests,
+               benchTotals.occlusionMilliseconds / frames);
+    }
+
+    // Move on to the next pass, or quit when all are done
+    if (++benchPass >= NumBenchPasses)
+    {
+        exit(EXIT_SUCCESS);
+    }
+    resetBenchTotals();
+    applyBenchPass(benchPasses[benchPass]);
+}
@@ -0,0 +1,37 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Counters collected while rendering a single frame
+struct FrameStats
+{
+    long drawCalls;
+    long triangles;
+    long bytesUploaded;  // Buffer data sent to the GL during the frame
+    long visibleObjects; // Objects (or instances) that passed culling
+    long culledObjects;  // Objects (or instances) skipped by culling
+    long boxTests;       // Bounding boxes tested against the frustum
+    long occluders;      // Buildings drawn into the occlusion buffer
+    long occlusionTests; // Objects tested against the occlusion buffer
+    long occludedObjects; // Objects hidden behind the occluders
+    long occlusionQueries; // Hardware occlusion queries issued
+    double occlusionMilliseconds; // CPU time of occlusion culling, all threads
+    long glCalls;        // State changes and draws issued to the GL
+    long glCallsSkipped; // Redundant state changes filtered out
+    double overdraw;        // Fragments drawn per pixel, in overdraw mode
+    double overdrawCovered; // Same, over the pixels drawn at least once
+    long fenceWaits;        // Ring buffer segments the GPU was still reading
+    double fenceWaitMilliseconds;
+    long worldUpdates;      // Scene graph world matrices recomputed
+    long cacheMisses;       // Hardware cache misses of the rendering thread, in bench mode
+};
+
+extern FrameStats frameStats;
+
+// Bench mode: render a fixed number of frames per configuration and report
+extern bool benchMode;
+
+void beginFrameStats();
+void endFrameStats();
+void startBench(int framesPerPass);
+
+#endif
@@ -0,0 +1,75 @@
+#include "Angel.h"
+#include "transforms.h"
+#include "stats.h"
+#include "ring.h"
+#include <vector>
+
+// Same layout as the Camera block in the shaders; row-major like Angel
+struct CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+};
+
+static GLuint matrixBuffer = 0;
+static GLuint matrixTexture = 0;
+static std::vector<mat4> staticMatrices;
+static size_t uploadedMatrices = 0;
+
+void createTransforms()
+{
+    // One matrix is four RGBA32F texels, one per row
+    glGenBuffers(1, &matrixBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, matrixBuffer);
+    glGenTextures(1, &matrixTexture);
+    glActiveTexture(GL_TEXTURE0 + ModelMatricesUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, matrixTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, matrixBuffer);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void bindTransforms(GLuint program)
+{
+    GLuint block = glGetUniformBlockIndex(program, "Camera");
+    glUniformBlockBinding(program, block, CameraBlockBinding);
+
+    GLint sampler = glGetUniformLocation(program, "uModelMatrices");
+    if (sampler >= 0)
+    {
+        glUseProgram(program);
+        glUniform1i(sampler, ModelMatricesUnit);
+    }
+}
+
+void setCamera(const mat4 &view, const mat4 &projection)
+{
+    CameraBlock block;
+    block.view = view;
+    block.projection = projection;
+    block.viewProjection = projection * view;
+
+    // A new range of the ring each time, so the draws issued with the
+    // previous camera (impostor snapshots) keep theirs
+    GLintptr offset = writeRing(&block, sizeof(block));
+    glBindBufferRange(GL_UNIFORM_BUFFER, CameraBlockBinding, ringBuffer(), offset, sizeof(block));
+}
+
+void makeStatic(Object &obj)
+{
+    obj.matrixSlot = staticMatrices.size();
+    staticMatrices.push_back(obj.modelMatrix);
+}
+
+void uploadStaticMatrices()
+{
+    if (uploadedMatrices == staticMatrices.size())
+        return;
+
+    // Matrices are only ever added, the whole buffer is respecified
+    long bytes = staticMatrices.size() * sizeof(mat4);
+    glBindBuffer(GL_TEXTURE_BUFFER, matrixBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, bytes, &staticMatrices[0], GL_STATIC_DRAW);
+    frameStats.bytesUploaded += bytes;
+    uploadedMatrices = staticMatrices.size();
+}
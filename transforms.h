@@ -0,0 +1,31 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include "Angel.h"
+#include "objects.h"
+
+// Transforms kept on the GPU. View, projection and view-projection live in a
+// std140 uniform block ("Camera") written to the ring buffer (ring.h) once
+// per frame and shared by every program. World matrices of static objects are stored once in a texture
+// buffer; a static draw only sets the index of its matrix, and the shader
+// composes the transform per vertex.
+
+const GLuint CameraBlockBinding = 0;
+const int ModelMatricesUnit = 1; // Texture unit of the matrix buffer
+
+// Create the matrix buffer; called from init() after createRing()
+void createTransforms();
+
+// Connect a program's "Camera" block and matrix buffer sampler
+void bindTransforms(GLuint program);
+
+// Write the camera block and bind its range
+void setCamera(const mat4 &view, const mat4 &projection);
+
+// Store obj.modelMatrix as a static world matrix and keep its slot
+void makeStatic(Object &obj);
+
+// Upload the static matrices added since the last call
+void uploadStaticMatrices();
+
+#endif
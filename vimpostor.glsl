@@ -0,0 +1,68 @@
+#version 150
+
+// Far buildings drawn as cards textured from the impostor atlas (impostor.cpp)
+
+in vec2 vCorner; // Card corner in [-1, 1]
+
+// Per-instance building data, same layout as in vshader.glsl
+in vec4 vInstance; // xyz = translation, w = building height
+in vec4 vInstanceColor;
+
+// Cards are built in world space (camera block as in vshader.glsl)
+layout(std140) uniform Camera
+{
+    layout(row_major) mat4 uView;
+    layout(row_major) mat4 uProjection;
+    layout(row_major) mat4 uViewProjection;
+};
+uniform vec3 uEye;
+
+// Atlas layout: one layer per height class, uFrames x uFrames view directions
+uniform int uFrames;
+uniform int uClasses;
+uniform float uMinHeight;
+uniform float uClassStep;
+uniform float uHalfWidth; // Building footprint half-size
+uniform float uRoofHeight;
+
+out vec4 color;
+out vec3 texCoord; // Atlas coordinates and layer
+
+// Hemi-octahedral mapping between upper hemisphere directions and [-1, 1]^2
+vec2 encodeDirection(vec3 d)
+{
+    vec2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+    return vec2(p.x + p.y, p.x - p.y);
+}
+
+vec3 decodeDirection(vec2 e)
+{
+    vec2 p = vec2(e.x + e.y, e.x - e.y) * 0.5;
+    return normalize(vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y));
+}
+
+void main()
+{
+    // Height class and the bounding sphere its snapshots were taken around
+    int layer = clamp(int((vInstance.w - uMinHeight) / uClassStep), 0, uClasses - 1);
+    float top = uMinHeight + (float(layer) + 0.5) * uClassStep + uRoofHeight;
+    vec3 center = vInstance.xyz + vec3(0.0, 0.5 * top, 0.0);
+    float radius = length(vec3(uHalfWidth, 0.5 * top, uHalfWidth));
+
+    // Snapshot taken closest to the direction of the eye
+    vec3 toEye = uEye - center;
+    toEye.y = max(toEye.y, 0.0);
+    vec2 uv = encodeDirection(normalize(toEye)) * 0.5 + 0.5;
+    vec2 frame = min(floor(uv * float(uFrames)), float(uFrames - 1));
+    vec3 d = decodeDirection((frame + 0.5) / float(uFrames) * 2.0 - 1.0);
+
+    // Card facing that direction, with the basis of the snapshot camera
+    vec3 reference = d.y > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(reference, d));
+    vec3 up = cross(d, right);
+    vec3 position = center + (right * vCorner.x + up * vCorner.y) * radius;
+
+    texCoord = vec3((frame + vCorner * 0.5 + 0.5) / float(uFrames), float(layer));
+    color = vInstanceColor;
+    gl_Position = uViewProjection * vec4(position, 1.0);
+}
@@ -0,0 +1,52 @@
+#version 430
+
+// Static meshes of indirect mode (indirect.cpp): one shared vertex format,
+// everything else comes from the draw record of the command
+
+in vec4 vPosition;
+in vec4 vColor;
+in uint vDrawRecord; // Instanced, so the command's base instance selects it
+
+layout(std140) uniform Camera
+{
+    layout(row_major) mat4 uView;
+    layout(row_major) mat4 uProjection;
+    layout(row_major) mat4 uViewProjection;
+};
+
+// Same layout as DrawRecord in indirect.cpp
+struct DrawRecord
+{
+    mat4 model;
+    vec4 positionScale;
+    vec4 positionOffset;
+    ivec4 material; // x = lamp slot (-1 for everything else), y = traffic light
+};
+
+layout(std430, binding = 0) readonly buffer DrawRecords
+{
+    DrawRecord records[];
+};
+
+// Current state of every traffic light
+layout(std430, binding = 1) readonly buffer LightStates
+{
+    int lightStates[];
+};
+
+const vec4 lampOffColor = vec4(0.1, 0.1, 0.1, 1.0);
+
+out vec4 color;
+
+void main()
+{
+    DrawRecord record = records[vDrawRecord];
+    vec4 position = vec4(vPosition.xyz * record.positionScale.xyz + record.positionOffset.xyz, 1.0);
+    color = vColor;
+
+    int lampSlot = record.material.x;
+    if (lampSlot >= 0 && lampSlot != lightStates[record.material.y])
+        color = lampOffColor;
+
+    gl_Position = uViewProjection * (record.model * position);
+}
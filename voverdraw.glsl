@@ -0,0 +1,9 @@
+#version 150
+
+// Full screen triangle for the overdraw heat map (overdraw.cpp)
+
+void main()
+{
+    vec2 corner = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID & 2) * 2.0 - 1.0);
+    gl_Position = vec4(corner, 0.0, 1.0);
+}
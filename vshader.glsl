@@ -3,14 +3,78 @@
 in vec4 vPosition;
 in vec4 vColor;
 
-uniform mat4 uModelView;
-uniform mat4 uProjection;
+// Per-instance building data (used when uInstanced is set)
+in vec4 vInstance;      // xyz = translation, w = building height
+in vec4 vInstanceColor;
+
+// Per-frame camera data, shared with the other programs (transforms.cpp)
+layout(std140) uniform Camera
+{
+    layout(row_major) mat4 uView;
+    layout(row_major) mat4 uProjection;
+    layout(row_major) mat4 uViewProjection;
+};
+
+// World matrix: static objects fetch theirs from the matrix buffer (one row
+// per texel), objects that move pass it directly and set uModelIndex to -1
+uniform samplerBuffer uModelMatrices;
+uniform int uModelIndex;
+uniform mat4 uModel;
+
+// Positions may be stored quantized; this maps them back to model space
+uniform vec3 uPositionScale;
+uniform vec3 uPositionOffset;
+uniform bool uInstanced;
+
+// Traffic light lamps: the lamp in slot uLampSlot is lit when it matches
+// uLightState, otherwise it is dimmed (uLampSlot is -1 for everything else)
+uniform int uLightState;
+uniform int uLampSlot;
+
+// Instanced props (props.cpp): instance i uses the static matrix at
+// uModelIndex + i and the state of traffic light i, at texel
+// uLightStateBase + i
+uniform bool uInstancedProps;
+uniform usamplerBuffer uLightStates;
+uniform int uLightStateBase;
+
+const vec4 lampOffColor = vec4(0.1, 0.1, 0.1, 1.0);
 
 out vec4 color;
 
 void main()
 {
-    gl_Position = uProjection * uModelView * vPosition;
+    vec4 position = vec4(vPosition.xyz * uPositionScale + uPositionOffset, 1.0);
     color = vColor;
-}
 
+    if (uInstanced)
+    {
+        // The unit cube base (y in [0, 1]) stretches to the building height,
+        // the roof above it keeps its size
+        float base = min(position.y, 1.0);
+        position.y = base * vInstance.w + (position.y - base);
+        position.xyz += vInstance.xyz;
+        color = vInstanceColor;
+    }
+
+    int modelIndex = uModelIndex;
+    int lightState = uLightState;
+    if (uInstancedProps)
+    {
+        modelIndex += gl_InstanceID;
+        lightState = int(texelFetch(uLightStates, uLightStateBase + gl_InstanceID).r);
+    }
+
+    if (uLampSlot >= 0 && uLampSlot != lightState)
+        color = lampOffColor;
+
+    mat4 model = uModel;
+    if (modelIndex >= 0)
+    {
+        int row = 4 * modelIndex;
+        model = transpose(mat4(texelFetch(uModelMatrices, row), texelFetch(uModelMatrices, row + 1),
+                               texelFetch(uModelMatrices, row + 2), texelFetch(uModelMatrices, row + 3)));
+    }
+
+    gl_Position = uViewProjection * (model * position);
+}
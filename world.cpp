@@ -0,0 +1,92 @@
+#include "Angel.h"
+#include "world.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+
+BuildingStore buildings;
+
+// Bytes of CPU geometry freed by releaseGeometry(), for printWorldStats()
+static long releasedBytes = 0;
+
+void addBuilding(Object &building)
+{
+    // Skipping it would shift every later store index away from the ids of
+    // the spatial index and the instance buffers
+    if (building.lods.size() != BuildingLevels - 1)
+    {
+        std::cerr << "Building with " << building.lods.size() + 1 << " levels, expected " << BuildingLevels << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Same world box as isObjectVisible(), same sphere as lodScreenSize()
+    vec3 center = (building.boundsMin + building.boundsMax) * 0.5f;
+    vec3 extent = (building.boundsMax - building.boundsMin) * 0.5f;
+    const mat4 &m = building.modelMatrix;
+    vec3 worldCenter, worldExtent;
+    float scale = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        worldCenter[i] = m[i][0] * center.x + m[i][1] * center.y + m[i][2] * center.z + m[i][3];
+        worldExtent[i] = std::fabs(m[i][0]) * extent.x + std::fabs(m[i][1]) * extent.y + std::fabs(m[i][2]) * extent.z;
+        scale = std::max(scale, m[0][i] * m[0][i] + m[1][i] * m[1][i] + m[2][i] * m[2][i]);
+    }
+
+    buildings.centers.push_back(worldCenter);
+    buildings.extents.push_back(worldExtent);
+    buildings.radii.push_back(length(extent) * std::sqrt(scale));
+    buildings.lodLevels.push_back(building.lodLevel);
+    buildings.levelMeshes.push_back(building.mesh);
+    buildings.levelMeshes.push_back(building.lods[0].mesh);
+    buildings.matrixSlots.push_back(building.matrixSlot);
+    buildings.drawRecords.push_back(-1);
+    buildings.modelMatrices.push_back(building.modelMatrix);
+    for (int level = 0; level < BuildingLevels - 1; ++level)
+        buildings.lodSizes[level] = building.lodSizes[level];
+
+    releaseGeometry(building);
+}
+
+// Free a vector's storage, not just its contents
+template <typename T>
+static long releaseVector(std::vector<T> &v)
+{
+    long bytes = v.capacity() * sizeof(T);
+    std::vector<T>().swap(v);
+    return bytes;
+}
+
+long releaseGeometry(Object &obj)
+{
+    long bytes = releaseVector(obj.points) + releaseVector(obj.colors) + releaseVector(obj.indices);
+    for (auto &lod : obj.lods)
+        bytes += releaseGeometry(lod);
+    releasedBytes += bytes;
+    return bytes;
+}
+
+// Resident set size in bytes, 0 where /proc is not available
+static long residentBytes()
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void printWorldStats()
+{
+    long count = buildings.size();
+    long hot = sizeof(vec3) * 2 + sizeof(float) + sizeof(unsigned char) + sizeof(MeshHandle) * BuildingLevels +
+               sizeof(int) * 2;
+    long cold = sizeof(mat4);
+    printf("World store: %ld buildings, %ld B hot and %ld B cold each (was %d B of Objects plus geometry), "
+           "%.1f KB of CPU geometry released, %.1f MB resident\n",
+           count, hot, cold, int(sizeof(Object) * BuildingLevels), releasedBytes / 1024.0,
+           residentBytes() / (1024.0 * 1024.0));
+}
@@ -0,0 +1,56 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Angel.h"
+#include "objects.h"
+#include "culling.h"
+#include <vector>
+
+// World store: the buildings of per-object and indirect modes as a structure
+// of arrays rather than a vector of Objects. Culling, level selection and
+// drawing walk the hot arrays, each contiguous and indexed by building; the
+// matrices are cold and only read when other modes set up their buffers.
+// Buildings are only translated, so their world boxes are computed once, and
+// the CPU copies of their geometry are released once uploaded.
+
+const int BuildingLevels = 2; // Pyramid roof, then flat roof
+
+struct BuildingStore
+{
+    // Hot: touched every frame for each building in view
+    std::vector<vec3> centers;           // World bounding box
+    std::vector<vec3> extents;
+    std::vector<float> radii;            // Bounding sphere of the box, for level of detail
+    std::vector<unsigned char> lodLevels;
+    std::vector<MeshHandle> levelMeshes; // BuildingLevels per building, finest first
+    std::vector<int> matrixSlots;        // Static world matrix (transforms.h)
+    std::vector<int> drawRecords;        // First draw record of indirect mode, -1 before
+
+    // Cold
+    std::vector<mat4> modelMatrices;
+    float lodSizes[BuildingLevels - 1]; // Shared by every building
+
+    size_t size() const { return centers.size(); }
+    bool empty() const { return centers.empty(); }
+};
+
+extern BuildingStore buildings;
+
+// Append an uploaded, static building with its flat-roofed level, then
+// release its CPU geometry; any other number of levels is fatal
+void addBuilding(Object &building);
+
+inline bool isBuildingVisible(const FrustumPlanes &frustum, int index)
+{
+    return isBoxVisible(frustum, buildings.centers[index], buildings.extents[index]);
+}
+
+// Free the CPU copies of an object's vertices and indices, and of its
+// levels, once nothing reads them any more; returns the bytes freed
+long releaseGeometry(Object &obj);
+
+// Hot and cold bytes of the store, the geometry released, and the resident
+// set size, printed at startup
+void printWorldStats();
+
+#endif